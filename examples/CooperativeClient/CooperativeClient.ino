@@ -0,0 +1,275 @@
+/**************************************************************
+ *
+ * This sketch fetches two pages over two sockets at the same time,
+ * while a sensor keeps being sampled at a steady rate.
+ *
+ * Nothing in loop() blocks: the sockets are small state machines
+ * built on connectAsync()/pollConnect(), and the time the library
+ * does spend waiting on the modem is handed to the sensor through
+ * TinyGsmSetYield().
+ *
+ * The same callback is where a FreeRTOS task would vTaskDelay(),
+ * an event loop would run one pass, or C++20 coroutines waiting
+ * on other things would be resumed.
+ *
+ * TinyGSM Getting Started guide:
+ *   https://tiny.cc/tinygsm-readme
+ *
+ **************************************************************/
+
+// Select your modem:
+#define TINY_GSM_MODEM_SIM800
+// #define TINY_GSM_MODEM_SIM808
+// #define TINY_GSM_MODEM_SIM868
+// #define TINY_GSM_MODEM_SIM900
+// #define TINY_GSM_MODEM_SIM7000
+// #define TINY_GSM_MODEM_SIM5360
+// #define TINY_GSM_MODEM_SIM7600
+// #define TINY_GSM_MODEM_UBLOX
+// #define TINY_GSM_MODEM_SARAR4
+// #define TINY_GSM_MODEM_M95
+// #define TINY_GSM_MODEM_BG96
+// #define TINY_GSM_MODEM_A6
+// #define TINY_GSM_MODEM_A7
+// #define TINY_GSM_MODEM_M590
+// #define TINY_GSM_MODEM_MC60
+// #define TINY_GSM_MODEM_MC60E
+// #define TINY_GSM_MODEM_ESP8266
+// #define TINY_GSM_MODEM_XBEE
+// #define TINY_GSM_MODEM_SEQUANS_MONARCH
+
+// Set serial for debug console (to the Serial Monitor, default speed 115200)
+#define SerialMon Serial
+
+// Set serial for AT commands (to the module)
+// Use Hardware Serial on Mega, Leonardo, Micro
+#define SerialAT Serial1
+
+// or Software Serial on Uno, Nano
+//#include <SoftwareSerial.h>
+//SoftwareSerial SerialAT(2, 3); // RX, TX
+
+// Increase RX buffer to capture the entire response
+#define TINY_GSM_RX_BUFFER 650
+
+// See all AT commands, if wanted
+//#define DUMP_AT_COMMANDS
+
+// Define the serial console for debug prints, if needed
+//#define TINY_GSM_DEBUG SerialMon
+
+// Don't define TINY_GSM_YIELD() here, it would replace the callback below
+
+// set GSM PIN, if any
+#define GSM_PIN ""
+
+// Your GPRS credentials, if any
+const char apn[]  = "YourAPN";
+const char gprsUser[] = "";
+const char gprsPass[] = "";
+
+// Server details
+const char server[] = "vsh.pp.ua";
+const int  port = 80;
+const char* resources[] = { "/TinyGSM/logo.txt", "/TinyGSM/test_1k.bin" };
+
+// Sensor details
+#define SENSOR_PIN      A0
+#define SENSOR_EVERY_MS 50
+
+#include <TinyGsmClient.h>
+
+#ifdef DUMP_AT_COMMANDS
+  #include <StreamDebugger.h>
+  StreamDebugger debugger(SerialAT, SerialMon);
+  TinyGsm modem(debugger);
+#else
+  TinyGsm modem(SerialAT);
+#endif
+
+TinyGsmClient client0(modem, 0);
+TinyGsmClient client1(modem, 1);
+
+/*
+ * The sensor
+ */
+
+uint32_t lastSample = 0;
+uint32_t samples = 0;
+uint32_t samplesWhileWaiting = 0;
+long sensorSum = 0;
+
+void sampleSensor() {
+  if (millis() - lastSample < SENSOR_EVERY_MS) {
+    return;
+  }
+  lastSample = millis();
+  sensorSum += analogRead(SENSOR_PIN);
+  samples++;
+}
+
+// Called by the library every time it waits for the modem.
+// It must not use the modem (or the clients) itself.
+void onModemWait(uint32_t remaining_ms, TinyGsmWaitReason reason) {
+  uint32_t before = samples;
+  sampleSensor();
+  if (samples != before) {
+    samplesWhileWaiting++;
+  }
+}
+
+/*
+ * The sockets
+ */
+
+enum FetchState {
+  FETCH_START,
+  FETCH_CONNECTING,
+  FETCH_READING,
+  FETCH_DONE
+};
+
+struct Fetch {
+  TinyGsmClient* client;
+  const char*    resource;
+  FetchState     state;
+  uint32_t       bytes;
+  uint32_t       lastData;
+};
+
+Fetch fetches[] = {
+  { &client0, resources[0], FETCH_START, 0, 0 },
+  { &client1, resources[1], FETCH_START, 0, 0 },
+};
+
+// Moves a fetch along as far as it can go right now, without waiting
+void runFetch(Fetch& f, int id) {
+  switch (f.state) {
+  case FETCH_START:
+    SerialMon.print(id); SerialMon.println(": connecting");
+    if (!f.client->connectAsync(server, port)) {
+      SerialMon.print(id); SerialMon.println(": connect failed");
+      f.state = FETCH_DONE;
+      break;
+    }
+    f.state = FETCH_CONNECTING;
+    break;
+
+  case FETCH_CONNECTING:
+    switch (f.client->pollConnect()) {
+    case CONNECT_PENDING:
+      break;
+    case CONNECT_DONE:
+      SerialMon.print(id); SerialMon.println(": connected, sending request");
+      f.client->print(String("GET ") + f.resource + " HTTP/1.0\r\n");
+      f.client->print(String("Host: ") + server + "\r\n");
+      f.client->print("Connection: close\r\n\r\n");
+      f.lastData = millis();
+      f.state = FETCH_READING;
+      break;
+    default:
+      SerialMon.print(id); SerialMon.println(": connect failed");
+      f.state = FETCH_DONE;
+      break;
+    }
+    break;
+
+  case FETCH_READING: {
+    // Only take what is already there
+    uint8_t buf[64];
+    int avail = f.client->available();
+    if (avail > 0) {
+      if (avail > (int)sizeof(buf)) {
+        avail = sizeof(buf);
+      }
+      int len = f.client->read(buf, avail);
+      if (len > 0) {
+        f.bytes += len;
+        f.lastData = millis();
+      }
+    } else if (!f.client->connected() || millis() - f.lastData > 10000L) {
+      f.client->stop();
+      SerialMon.print(id); SerialMon.print(": done, received ");
+      SerialMon.print(f.bytes); SerialMon.println(" bytes");
+      f.state = FETCH_DONE;
+    }
+    break;
+  }
+
+  case FETCH_DONE:
+    break;
+  }
+}
+
+void setup() {
+  // Set console baud rate
+  SerialMon.begin(115200);
+  delay(10);
+
+  // !!!!!!!!!!!
+  // Set your reset, enable, power pins here
+  // !!!!!!!!!!!
+
+  SerialMon.println("Wait...");
+
+  // Set GSM module baud rate
+  SerialAT.begin(9600);
+  delay(3000);
+
+  // From here on, waiting for the modem samples the sensor
+  TinyGsmSetYield(onModemWait);
+
+  SerialMon.println("Initializing modem...");
+  modem.init();
+
+  // Unlock your SIM card with a PIN if needed
+  if ( GSM_PIN && modem.getSimStatus() != 3 ) {
+    modem.simUnlock(GSM_PIN);
+  }
+
+#if defined TINY_GSM_MODEM_XBEE
+  // The XBee must run the gprsConnect function BEFORE waiting for network!
+  modem.gprsConnect(apn, gprsUser, gprsPass);
+#endif
+
+  SerialMon.print("Waiting for network...");
+  if (!modem.waitForNetwork()) {
+    SerialMon.println(" fail");
+    while (true) { sampleSensor(); }
+  }
+  SerialMon.println(" success");
+
+  SerialMon.print(F("Connecting to "));
+  SerialMon.print(apn);
+  if (!modem.gprsConnect(apn, gprsUser, gprsPass)) {
+    SerialMon.println(" fail");
+    while (true) { sampleSensor(); }
+  }
+  SerialMon.println(" success");
+}
+
+void loop() {
+  sampleSensor();
+
+  bool done = true;
+  for (int i = 0; i < 2; i++) {
+    runFetch(fetches[i], i);
+    if (fetches[i].state != FETCH_DONE) {
+      done = false;
+    }
+  }
+
+  static bool reported = false;
+  if (done && !reported) {
+    reported = true;
+    SerialMon.print("Sensor samples: ");
+    SerialMon.print(samples);
+    SerialMon.print(" (");
+    SerialMon.print(samplesWhileWaiting);
+    SerialMon.println(" taken while waiting for the modem)");
+    if (samples) {
+      SerialMon.print("Sensor average: ");
+      SerialMon.println(sensorSum / (long)samples);
+    }
+  }
+}
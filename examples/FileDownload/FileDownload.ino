@@ -298,14 +298,21 @@ void loop() {
     clientReadStartTime = millis();
 
     printPercent(readLength, contentLength);
+    uint32_t nextPercent = contentLength / 13;
     while (readLength < contentLength && client.connected() && millis() - clientReadStartTime < clientReadTimeout) {
       while (client.available()) {
-        uint8_t c = client.read();
-        //SerialMon.print((char)c);       // Uncomment this to show data
-        crc.update(c);
-        readLength++;
-        if (readLength % (contentLength / 13) == 0) {
+        // Reading in blocks lets the modem copy straight into our buffer
+        uint8_t buf[256];
+        int len = client.read(buf, min((uint32_t)sizeof(buf), contentLength - readLength));
+        if (len <= 0) break;
+        for (int i = 0; i < len; i++) {
+          //SerialMon.print((char)buf[i]);  // Uncomment this to show data
+          crc.update(buf[i]);
+        }
+        readLength += len;
+        if (readLength >= nextPercent) {
           printPercent(readLength, contentLength);
+          nextPercent += contentLength / 13;
         }
         clientReadStartTime = millis();
       }
@@ -2,6 +2,8 @@
  *
  * This sketch uploads SSL certificates to the SIM8xx
  *
+ * It can run at every boot, the certificate is only written once.
+ *
  * TinyGSM Getting Started guide:
  *   https://tiny.cc/tinygsm-readme
  *
@@ -51,37 +53,16 @@ void setup() {
   SerialMon.println(F("Initializing modem..."));
   modem.init();
 
-  modem.sendAT(GF("+FSCREATE=" CERT_FILE));
-  if (modem.waitResponse() != 1) return;
-
-  const int cert_size = sizeof(cert);
-
-  modem.sendAT(GF("+FSWRITE=" CERT_FILE ",0,"), cert_size, GF(",10"));
-  if (modem.waitResponse(GF(">")) != 1) {
-    return;
-  }
-
-  for (int i = 0; i < cert_size; i++) {
-    char c = pgm_read_byte(&cert[i]);
-    modem.stream.write(c);
-  }
-
-  modem.stream.write(GSM_NL);
-  modem.stream.flush();
-
-  if (modem.waitResponse(2000) != 1) return;
-  
-  modem.sendAT(GF("+SSLSETCERT=\"" CERT_FILE "\""));
-  if (modem.waitResponse() != 1) return;
-  if (modem.waitResponse(5000L, GF(GSM_NL "+SSLSETCERT:")) != 1) return;
-  const int retCode = modem.stream.readStringUntil('\n').toInt();
-
+  // Streamed from flash a few bytes at a time, and only written when the
+  // modem doesn't already have this certificate in CERT_FILE
+  TinyGsmCertSource source(cert, sizeof(cert));
+  bool ok = modem.provisionCertificate(CERT_FILE, source);
 
   SerialMon.println();
   SerialMon.println();
   SerialMon.println(F("****************************"));
   SerialMon.print(F("Setting Certificate: "));
-  SerialMon.println((0 == retCode) ? "OK" : "FAILED");
+  SerialMon.println(ok ? "OK" : "FAILED");
   SerialMon.println(F("****************************"));
 }
 
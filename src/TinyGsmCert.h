@@ -0,0 +1,221 @@
+/**
+ * @file       TinyGsmCert.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef TinyGsmCert_h
+#define TinyGsmCert_h
+
+// Certificates for the modem's own TLS stack: where their bytes come from,
+// and the MD5 that tells whether the modem already has them.
+//
+// A certificate is only ever read TINY_GSM_CERT_CHUNK bytes at a time, so
+// it can stay in flash (or on an SD card) while being uploaded.
+// Included by TinyGsmCommon.h.
+
+// Bytes read from a certificate at a time (on the stack)
+#ifndef TINY_GSM_CERT_CHUNK
+  #define TINY_GSM_CERT_CHUNK 64
+#endif
+
+#if defined(__AVR__)
+  #define TINY_GSM_PGM_DWORD(p) pgm_read_dword(p)
+#else
+  #define TINY_GSM_PGM_DWORD(p) (*(p))
+#endif
+
+/*
+ * MD5 (RFC 1321)
+ */
+
+static const uint32_t TinyGsmMd5K[64] TINY_GSM_PROGMEM = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const uint8_t TinyGsmMd5S[16] TINY_GSM_PROGMEM = {
+  7, 12, 17, 22,  5,  9, 14, 20,  4, 11, 16, 23,  6, 10, 15, 21
+};
+
+// Fed any number of bytes at a time, keeps one 64 byte block
+class TinyGsmMd5
+{
+public:
+  TinyGsmMd5() {
+    begin();
+  }
+
+  void begin() {
+    _h[0] = 0x67452301;
+    _h[1] = 0xefcdab89;
+    _h[2] = 0x98badcfe;
+    _h[3] = 0x10325476;
+    _len  = 0;
+  }
+
+  void update(const uint8_t* p, size_t n) {
+    while (n--) {
+      _block[_len++ & 63] = *p++;
+      if ((_len & 63) == 0) {
+        transform();
+      }
+    }
+  }
+
+  void finish(uint8_t digest[16]) {
+    uint32_t bits = _len << 3;
+    uint8_t  pad  = 0x80;
+    update(&pad, 1);
+    pad = 0;
+    while ((_len & 63) != 56) {
+      update(&pad, 1);
+    }
+    uint8_t len[8] = { 0 };
+    for (uint8_t i = 0; i < 4; i++) {
+      len[i] = bits >> (8 * i);
+    }
+    update(len, 8);
+    for (uint8_t i = 0; i < 16; i++) {
+      digest[i] = _h[i / 4] >> (8 * (i % 4));
+    }
+  }
+
+private:
+  uint32_t word(uint8_t g) const {
+    const uint8_t* p = _block + 4 * g;
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+  }
+
+  void transform() {
+    uint32_t a = _h[0], b = _h[1], c = _h[2], d = _h[3];
+    for (uint8_t i = 0; i < 64; i++) {
+      uint32_t f;
+      uint8_t  g;
+      if (i < 16) {
+        f = (b & c) | (~b & d);
+        g = i;
+      } else if (i < 32) {
+        f = (d & b) | (~d & c);
+        g = (5 * i + 1) & 15;
+      } else if (i < 48) {
+        f = b ^ c ^ d;
+        g = (3 * i + 5) & 15;
+      } else {
+        f = c ^ (b | ~d);
+        g = (7 * i) & 15;
+      }
+      f += a + TINY_GSM_PGM_DWORD(&TinyGsmMd5K[i]) + word(g);
+      uint8_t s = TINY_GSM_PGM_BYTE(&TinyGsmMd5S[(i >> 4) * 4 + (i & 3)]);
+      a = d;
+      d = c;
+      c = b;
+      b += (f << s) | (f >> (32 - s));
+    }
+    _h[0] += a;
+    _h[1] += b;
+    _h[2] += c;
+    _h[3] += d;
+  }
+
+  uint32_t _h[4];
+  uint32_t _len;
+  uint8_t  _block[64];
+};
+
+/*
+ * Certificates
+ */
+
+// What a certificate is to the modem, the values are u-blox's +USECMNG types
+enum TinyGsmCertType {
+  TINY_GSM_CERT_CA     = 0,  // a trusted root, servers are checked against
+  TINY_GSM_CERT_CLIENT = 1,  // our own certificate, for client authentication
+  TINY_GSM_CERT_KEY    = 2,  // the private key that goes with it
+};
+
+// Copies up to len bytes of the certificate, from offset on, into buf.
+// Returns how many it did copy; less than asked for is an error.
+typedef size_t (*TinyGsmCertReader)(size_t offset, uint8_t* buf, size_t len, void* ctx);
+
+// Where a certificate's bytes come from: an array declared PROGMEM
+// (i.e. the ones in examples/more/SIM800_SslSetCert), or a reader callback
+class TinyGsmCertSource
+{
+public:
+  TinyGsmCertSource(const void* progmem, size_t len)
+    : _data((const uint8_t*)progmem), _reader(NULL), _ctx(NULL), _len(len)
+  {}
+
+  TinyGsmCertSource(TinyGsmCertReader reader, size_t len, void* ctx = NULL)
+    : _data(NULL), _reader(reader), _ctx(ctx), _len(len)
+  {}
+
+  size_t length() const {
+    return _len;
+  }
+
+  size_t read(size_t offset, uint8_t* buf, size_t len) const {
+    if (offset >= _len) {
+      return 0;
+    }
+    len = TinyGsmMin(len, _len - offset);
+    if (_reader) {
+      return _reader(offset, buf, len, _ctx);
+    }
+    for (size_t i = 0; i < len; i++) {
+      buf[i] = pgm_read_byte(_data + offset + i);
+    }
+    return len;
+  }
+
+private:
+  const uint8_t*    _data;
+  TinyGsmCertReader _reader;
+  void*             _ctx;
+  size_t            _len;
+};
+
+// MD5 of the whole certificate.  False if it couldn't all be read.
+static inline
+bool TinyGsmCertDigest(const TinyGsmCertSource& cert, uint8_t digest[16]) {
+  TinyGsmMd5 md5;
+  uint8_t    buf[TINY_GSM_CERT_CHUNK];
+  for (size_t pos = 0; pos < cert.length();) {
+    size_t n = TinyGsmMin(cert.length() - pos, sizeof(buf));
+    if (cert.read(pos, buf, n) != n) {
+      return false;
+    }
+    md5.update(buf, n);
+    pos += n;
+  }
+  md5.finish(digest);
+  return true;
+}
+
+// Writes len bytes of the certificate, from offset on, to out
+static inline
+bool TinyGsmCertWrite(Print& out, const TinyGsmCertSource& cert, size_t offset, size_t len) {
+  uint8_t buf[TINY_GSM_CERT_CHUNK];
+  while (len > 0) {
+    size_t n = TinyGsmMin(len, sizeof(buf));
+    if (cert.read(offset, buf, n) != n) {
+      return false;
+    }
+    out.write(buf, n);
+    offset += n;
+    len    -= n;
+  }
+  return true;
+}
+
+#endif
@@ -83,8 +83,11 @@ public:
 
 TINY_GSM_CLIENT_CONNECT_OVERLOADS()
 
+TINY_GSM_CLIENT_CONNECT_ASYNC_BLOCKING()
+
   virtual void stop(uint32_t maxWaitMs) {
     TINY_GSM_YIELD();
+    closeTx();
     at->sendAT(GF("+CIPCLOSE="), mux);
     sock_connected = false;
     at->waitResponse(maxWaitMs);
@@ -99,7 +102,7 @@ TINY_GSM_CLIENT_AVAILABLE_NO_MODEM_FIFO()
 
 TINY_GSM_CLIENT_READ_NO_MODEM_FIFO()
 
-TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
+TINY_GSM_CLIENT_FLUSH_CONNECTED()
 
   /*
    * Extended API
@@ -111,7 +114,9 @@ private:
   TinyGsmA6*      at;
   uint8_t         mux;
   bool            sock_connected;
+  TinyGsmConnectState connecting;
   RxFifo          rx;
+  TinyGsmTxBuffer<TINY_GSM_TX_BUFFER> tx;
 };
 
 
@@ -121,6 +126,8 @@ public:
     : stream(stream)
   {
     memset(sockets, 0, sizeof(sockets));
+    urcs.add(GF("+CIPRCV:"));
+    urcs.add(GF("+TCPCLOSED:"));
   }
 
   virtual ~TinyGsmA6() {}
@@ -184,6 +191,10 @@ TINY_GSM_MODEM_TEST_AT()
 
 TINY_GSM_MODEM_MAINTAIN_LISTEN()
 
+TINY_GSM_MODEM_URC_HANDLERS()
+
+TINY_GSM_MODEM_STATS()
+
   bool factoryDefault() {
     sendAT(GF("&FZE0&W"));  // Factory + Reset + Echo Off + Write
     waitResponse();
@@ -471,18 +482,13 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     if (waitResponse(GF(GSM_NL "+CUSD:")) != 1) {
       return "";
     }
-    stream.readStringUntil('"');
-    String hex = stream.readStringUntil('"');
-    stream.readStringUntil(',');
+    char hex[TINY_GSM_USSD_BUFFER];
+    streamSkipUntil('"');
+    size_t len = stream.readBytesUntil('"', hex, sizeof(hex));
+    streamSkipUntil(',');
     int dcs = stream.readStringUntil('\n').toInt();
 
-    if (dcs == 15) {
-      return TinyGsmDecodeHex7bit(hex);
-    } else if (dcs == 72) {
-      return TinyGsmDecodeHex16bit(hex);
-    } else {
-      return hex;
-    }
+    return TinyGsmDecodeUssd(hex, len, dcs, true);
   }
 
   bool sendSMS(const String& number, const String& text) {
@@ -608,43 +614,65 @@ public:
 
 TINY_GSM_MODEM_STREAM_UTILITIES()
 
-  // TODO: Optimize this!
   uint8_t waitResponse(uint32_t timeout_ms, String& data,
                        GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
                        GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
   {
-    /*String r1s(r1); r1s.trim();
-    String r2s(r2); r2s.trim();
-    String r3s(r3); r3s.trim();
-    String r4s(r4); r4s.trim();
-    String r5s(r5); r5s.trim();
-    DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
     data.reserve(64);
-    int index = 0;
+    return waitResponseImpl(timeout_ms, &data, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(uint32_t timeout_ms,
+                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    return waitResponseImpl(timeout_ms, NULL, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    return waitResponse(1000, r1, r2, r3, r4, r5);
+  }
+
+protected:
+
+  // Built-in URC's, added to urcs in this order by the constructor
+  enum {
+    URC_RECEIVE = 1,
+    URC_CLOSED,
+    URC_BUILTIN = URC_CLOSED
+  };
+
+  // Collects the response into data only if the caller asked for it
+  uint8_t waitResponseImpl(uint32_t timeout_ms, String* data,
+                           GsmConstStr r1, GsmConstStr r2, GsmConstStr r3,
+                           GsmConstStr r4, GsmConstStr r5)
+  {
+    TINY_GSM_WAIT_RESPONSE_HOOK();
+    TinyGsmMatcher<5> match;
+    match.add(r1);
+    match.add(r2);
+    match.add(r3);
+    match.add(r4);
+    match.add(r5);
+    uint8_t index = 0;
     unsigned long startMillis = millis();
     do {
-      TINY_GSM_YIELD();
+      TINY_GSM_YIELD_FOR(TinyGsmRemaining(startMillis, timeout_ms), match.reason());
       while (stream.available() > 0) {
         TINY_GSM_YIELD();
         int a = stream.read();
         if (a <= 0) continue; // Skip 0x00 bytes, just in case
-        data += (char)a;
-        if (r1 && data.endsWith(r1)) {
-          index = 1;
-          goto finish;
-        } else if (r2 && data.endsWith(r2)) {
-          index = 2;
-          goto finish;
-        } else if (r3 && data.endsWith(r3)) {
-          index = 3;
-          goto finish;
-        } else if (r4 && data.endsWith(r4)) {
-          index = 4;
-          goto finish;
-        } else if (r5 && data.endsWith(r5)) {
-          index = 5;
+        if (data) *data += (char)a;
+        uint8_t hit = match.feed(a);
+        uint8_t urc = urcs.feed(a);
+        if (hit) {
+          index = hit;
           goto finish;
-        } else if (data.endsWith(GF("+CIPRCV:"))) {
+        } else if (!urc) {
+          continue;
+        } else if (urc == URC_RECEIVE) {
           int mux = stream.readStringUntil(',').toInt();
           int len = stream.readStringUntil(',').toInt();
           int len_orig = len;
@@ -653,55 +681,52 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
           } else {
             DBG("### Got: ", len, "->", sockets[mux]->rx.free());
           }
-          while (len--) {
-            TINY_GSM_MODEM_STREAM_TO_MUX_FIFO_WITH_DOUBLE_TIMEOUT
-          }
+          TinyGsmStreamToFifo(stream, len, sockets[mux]->rx, sockets[mux]->_timeout);
           if (len_orig > sockets[mux]->available()) { // TODO
             DBG("### Fewer characters received than expected: ", sockets[mux]->available(), " vs ", len_orig);
           }
-          data = "";
-        } else if (data.endsWith(GF("+TCPCLOSED:"))) {
+          if (data) *data = "";
+        } else if (urc == URC_CLOSED) {
           int mux = stream.readStringUntil('\n').toInt();
           if (mux >= 0 && mux < TINY_GSM_MUX_COUNT) {
             sockets[mux]->sock_connected = false;
           }
-          data = "";
+          if (data) *data = "";
           DBG("### Closed: ", mux);
+        } else {
+          urcs.dispatch(urc, stream);
+          if (data) *data = "";
         }
+        TINY_GSM_STATS_URC(urcs.prefix(urc));
+        match.reset();
+        urcs.lineStart();
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_STATS_RESPONSE(index);
     if (!index) {
-      data.trim();
-      if (data.length()) {
-        DBG("### Unhandled:", data);
+      if (data) {
+        data->trim();
+        if (data->length()) {
+          DBG("### Unhandled:", *data);
+        }
+        *data = "";
+      } else if (match.lineLength() > 2) {
+        DBG("### Unhandled:", match.line());
       }
-      data = "";
     }
-    //data.replace(GSM_NL, "/");
-    //DBG('<', index, '>', data);
     return index;
   }
 
-  uint8_t waitResponse(uint32_t timeout_ms,
-                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
-                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
-  {
-    String data;
-    return waitResponse(timeout_ms, data, r1, r2, r3, r4, r5);
-  }
-
-  uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
-                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
-  {
-    return waitResponse(1000, r1, r2, r3, r4, r5);
-  }
-
 public:
   Stream&       stream;
 
 protected:
   GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  TinyGsmUrcTable<URC_BUILTIN + TINY_GSM_URC_HANDLERS> urcs;
+#ifdef TINY_GSM_STATS
+  TinyGsmStats  stats;
+#endif
 };
 
 #endif
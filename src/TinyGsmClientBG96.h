@@ -17,6 +17,7 @@
 #endif
 
 #define TINY_GSM_MUX_COUNT 12
+#define TINY_GSM_MAX_READ_CHUNK 1500
 
 #include <TinyGsmCommon.h>
 
@@ -63,7 +64,6 @@ public:
     this->at = modem;
     this->mux = mux;
     sock_available = 0;
-    prev_check = 0;
     sock_connected = false;
     got_data = false;
 
@@ -83,10 +83,21 @@ public:
 
 TINY_GSM_CLIENT_CONNECT_OVERLOADS()
 
+  // Starts connecting and returns right away, see pollConnect()
+  virtual bool connectAsync(const char *host, uint16_t port, int timeout_s = 20) {
+    stop();
+    TINY_GSM_YIELD();
+    rx.clear();
+    return at->modemConnectAsync(host, port, mux, false, timeout_s);
+  }
+
+TINY_GSM_CLIENT_POLL_CONNECT()
+
   virtual void stop(uint32_t maxWaitMs) {
     TINY_GSM_CLIENT_DUMP_MODEM_BUFFER()
     at->sendAT(GF("+QICLOSE="), mux);
     sock_connected = false;
+    connecting.cancel();
     at->waitResponse();
   }
 
@@ -98,7 +109,7 @@ TINY_GSM_CLIENT_AVAILABLE_WITH_BUFFER_CHECK()
 
 TINY_GSM_CLIENT_READ_WITH_BUFFER_CHECK()
 
-TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
+TINY_GSM_CLIENT_FLUSH_CONNECTED()
 
   /*
    * Extended API
@@ -110,10 +121,12 @@ private:
   TinyGsmBG96*    at;
   uint8_t         mux;
   uint16_t        sock_available;
-  uint32_t        prev_check;
+  TinyGsmPollTimer poll;
   bool            sock_connected;
   bool            got_data;
+  TinyGsmConnectState connecting;
   RxFifo          rx;
+  TinyGsmTxBuffer<TINY_GSM_TX_BUFFER> tx;
 };
 
 
@@ -145,6 +158,8 @@ public:
     : stream(stream)
   {
     memset(sockets, 0, sizeof(sockets));
+    urcs.add(GF("+QIURC:"));
+    urcs.add(GF("+QIOPEN:"));
   }
   virtual ~TinyGsmBG96() {}
 
@@ -193,6 +208,10 @@ TINY_GSM_MODEM_TEST_AT()
 
 TINY_GSM_MODEM_MAINTAIN_CHECK_SOCKS()
 
+TINY_GSM_MODEM_URC_HANDLERS()
+
+TINY_GSM_MODEM_STATS()
+
   bool factoryDefault() {
     sendAT(GF("&FZE0&W"));  // Factory + Reset + Echo Off + Write
     waitResponse();
@@ -327,9 +346,37 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
       return false;
     }
 
+    // Configure Domain Name Server (DNS), if set
+    if (!modemSetDns()) {
+      return false;
+    }
+
     return true;
   }
 
+  // Like gprsConnect(), but keeps context 1 if it's still active on the
+  // same APN, i.e. when only the MCU was reset
+  bool gprsConnectWarm(const char* apn, const char* user = NULL, const char* pwd = NULL) {
+    // +QIACT: 1,<context_state>,<context_type>,"<IP_address>"
+    sendAT(GF("+QIACT?"));
+    int active = waitResponse(150000L, GF(GSM_NL "+QIACT: 1,1,"), GFP(GSM_OK), GFP(GSM_ERROR));
+    if (active == 1) {
+      waitResponse();
+      // +QICSGP: <context_type>,"<APN>","<username>","<password>",<authentication>
+      sendAT(GF("+QICSGP=1"));
+      if (waitResponse(GF(GSM_NL "+QICSGP:")) == 1) {
+        streamSkipUntil('"');
+        String current = stream.readStringUntil('"');
+        waitResponse();
+        if (current.equalsIgnoreCase(apn) && modemSetDns()) {
+          DBG("### Reusing the PDP context");
+          return true;
+        }
+      }
+    }
+    return gprsConnect(apn, user, pwd);
+  }
+
   bool gprsDisconnect() {
     sendAT(GF("+QIDEACT=1"));  // Deactivate the bearer context
     if (waitResponse(40000L) != 1)
@@ -358,6 +405,10 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
     return TinyGsmIpFromString(getLocalIP());
   }
 
+TINY_GSM_MODEM_DNS()
+
+TINY_GSM_MODEM_DNS_SERVERS()
+
   /*
    * Phone Call functions
    */
@@ -423,15 +474,7 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
       return false;
     }
 
-    uint16_t* t = (uint16_t*)text;
-    for (size_t i=0; i<len; i++) {
-      uint8_t c = t[i] >> 8;
-      if (c < 0x10) { stream.print('0'); }
-      stream.print(c, HEX);
-      c = t[i] & 0xFF;
-      if (c < 0x10) { stream.print('0'); }
-      stream.print(c, HEX);
-    }
+    TinyGsmPrintHexUcs2(stream, (const uint16_t*)text, len);
     stream.write((char)0x1A);
     stream.flush();
     return waitResponse(60000L) == 1;
@@ -516,23 +559,104 @@ protected:
    }
    int rsp;
    uint32_t timeout_ms = ((uint32_t)timeout_s) * 1000;
+   char addr[16];
 
     // <PDPcontextID>(1-16), <connectID>(0-11),"TCP/UDP/TCP LISTENER/UDP SERVICE",
     // "<IP_address>/<domain_name>",<remote_port>,<local_port>,<access_mode>(0-2 0=buffer)
-    sendAT(GF("+QIOPEN=1,"), mux, ',', GF("\"TCP"), GF("\",\""), host, GF("\","), port, GF(",0,0"));
+    sendAT(GF("+QIOPEN=1,"), mux, ',', GF("\"TCP"), GF("\",\""), modemHostAddress(host, addr, ssl), GF("\","), port, GF(",0,0"));
     rsp = waitResponse();
 
-    if (waitResponse(timeout_ms, GF(GSM_NL "+QIOPEN:")) != 1) {
-      return false;
+    // The +QIOPEN of a connectAsync() on another socket may come first
+    int id;
+    do {
+      if (waitResponse(timeout_ms, GF(GSM_NL "+QIOPEN:")) != 1) {
+        dns_cache.forget(host);  // The address may have changed
+        return false;
+      }
+      id = stream.readStringUntil(',').toInt();
+      // Read status
+      rsp = stream.readStringUntil('\n').toInt();
+    } while (id != mux && modemConnectDone(id, 0 == rsp));
+
+    if (0 != rsp) {
+      dns_cache.forget(host);
     }
+    return (id == mux && 0 == rsp);
+  }
 
-    if (stream.readStringUntil(',').toInt() != mux) {
+  // Like modemConnect(), but only waits for the modem to take the command.
+  // The +QIOPEN: <mux>,<err> comes later, as a URC.
+  bool modemConnectAsync(const char* host, uint16_t port, uint8_t mux,
+                         bool ssl = false, int timeout_s = 20) {
+    if (ssl) {
+      DBG("SSL not yet supported on this module!");
+    }
+    char addr[16];
+    sendAT(GF("+QIOPEN=1,"), mux, ',', GF("\"TCP"), GF("\",\""), modemHostAddress(host, addr, ssl), GF("\","), port, GF(",0,0"));
+    if (waitResponse() != 1) {
       return false;
     }
-    // Read status
-    rsp = stream.readStringUntil('\n').toInt();
+    sockets[mux]->connecting.start(((uint32_t)timeout_s) * 1000);
+    return true;
+  }
+
+TINY_GSM_MODEM_CONNECT_DONE()
+
+TINY_GSM_MODEM_HOST_ADDRESS()
+
+  // After the OK come a +QIURC: "dnsgip",<err>,<IP_count>,<DNS_ttl> and a
+  // +QIURC: "dnsgip","<IP_address>" for each address, the first one is used
+  IPAddress modemLookup(const char* host, uint32_t& ttl_s, int timeout_s) {
+    uint32_t timeout_ms = ((uint32_t)timeout_s) * 1000;
+    unsigned long startMillis = millis();
+    sendAT(GF("+QIDNSGIP=1,\""), host, '"');
+    if (waitResponse() != 1) {
+      return IPAddress(0,0,0,0);
+    }
+    IPAddress ip(0,0,0,0);
+    int left = -1;
+    while (left != 0) {
+      // Other +QIURC's still get handled by modemQiurc()
+      if (waitResponse(TinyGsmRemaining(startMillis, timeout_ms), GF("+QIURC:")) != 1) {
+        return IPAddress(0,0,0,0);
+      }
+      if (!modemQiurc()) {
+        continue;
+      }
+      String res = stream.readStringUntil('\n');
+      if (left < 0) {
+        int count = res.indexOf(',');
+        if (res.toInt() != 0 || count < 0) {
+          return IPAddress(0,0,0,0);
+        }
+        left = res.substring(count + 1).toInt();
+        int ttl = res.indexOf(',', count + 1);
+        if (ttl > 0) {
+          ttl_s = res.substring(ttl + 1).toInt();
+        }
+      } else {
+        if (ip == IPAddress(0,0,0,0)) {
+          ip = TinyGsmIpFromString(res);
+        }
+        left--;
+      }
+    }
+    return ip;
+  }
 
-    return (0 == rsp);
+  bool modemSetDns() {
+    if (dns_primary == IPAddress(0,0,0,0)) {
+      return true;
+    }
+    char primary[16];
+    char secondary[16];
+    TinyGsmIpToString(dns_primary, primary);
+    if (dns_secondary == IPAddress(0,0,0,0)) {
+      sendAT(GF("+QIDNSCFG=1,\""), primary, '"');
+    } else {
+      sendAT(GF("+QIDNSCFG=1,\""), primary, GF("\",\""), TinyGsmIpToString(dns_secondary, secondary), '"');
+    }
+    return waitResponse() == 1;
   }
 
   int16_t modemSend(const void* buff, size_t len, uint8_t mux) {
@@ -549,20 +673,21 @@ protected:
     return len;
   }
 
-  size_t modemRead(size_t size, uint8_t mux) {
+  size_t modemRead(size_t size, uint8_t mux, uint8_t* dst = NULL, size_t dst_size = 0) {
     sendAT(GF("+QIRD="), mux, ',', (uint16_t)size);
     if (waitResponse(GF("+QIRD:")) != 1) {
       return 0;
     }
     int len = stream.readStringUntil('\n').toInt();
 
-    for (int i=0; i<len; i++) {
-      TINY_GSM_MODEM_STREAM_TO_MUX_FIFO_WITH_DOUBLE_TIMEOUT
-    }
+    size_t len_read = TINY_GSM_MODEM_STREAM_TO_MUX(len);
     waitResponse();
     DBG("### READ:", len, "from", mux);
     sockets[mux]->sock_available = modemGetAvailable(mux);
-    return len;
+    if (!sockets[mux]->sock_available) {
+      sockets[mux]->sock_connected = modemGetConnected(mux);
+    }
+    return len_read;
   }
 
   size_t modemGetAvailable(uint8_t mux) {
@@ -577,17 +702,51 @@ protected:
       }
       waitResponse();
     }
-    if (!result) {
-      sockets[mux]->sock_connected = modemGetConnected(mux);
-    }
     return result;
   }
 
+TINY_GSM_MODEM_UPDATE_AVAILABLE("+QIRD=", ",0", "+QIRD:", 2)
+
+  // Refreshes the state of all sockets with one +QISTATE, which lists every
+  // open socket of the context.  Sockets that aren't listed are closed, but
+  // only once the final OK says the list is complete; without it the
+  // sockets in muxes are asked about one by one.
+  void modemUpdateConnected(uint16_t muxes) {
+    sendAT(GF("+QISTATE=0,1"));
+    bool connected[TINY_GSM_MUX_COUNT] = {};
+    uint8_t rsp;
+    while ((rsp = waitResponse(GF("+QISTATE:"), GFP(GSM_OK), GFP(GSM_ERROR))) == 1) {
+      int muxNo = stream.readStringUntil(',').toInt();
+      streamSkipUntil(','); // Skip socket type
+      streamSkipUntil(','); // Skip remote ip
+      streamSkipUntil(','); // Skip remote port
+      streamSkipUntil(','); // Skip local port
+      int res = stream.readStringUntil(',').toInt(); // socket state
+      streamSkipUntil('\n');
+      if (muxNo >= 0 && muxNo < TINY_GSM_MUX_COUNT) {
+        connected[muxNo] = (2 == res);
+      }
+    }
+    if (rsp != 2) {
+      for (int mux = 0; mux < TINY_GSM_MUX_COUNT; mux++) {
+        if ((muxes & (1U << mux)) && sockets[mux]) {
+          sockets[mux]->sock_connected = modemGetConnected(mux);
+        }
+      }
+      return;
+    }
+    for (int muxNo = 0; muxNo < TINY_GSM_MUX_COUNT; muxNo++) {
+      if (sockets[muxNo]) {
+        sockets[muxNo]->sock_connected = connected[muxNo];
+      }
+    }
+  }
+
   bool modemGetConnected(uint8_t mux) {
     sendAT(GF("+QISTATE=1,"), mux);
     //+QISTATE: 0,"TCP","151.139.237.11",80,5087,4,1,0,0,"uart1"
 
-    if (waitResponse(GF("+QISTATE:")))
+    if (waitResponse(GF("+QISTATE:")) != 1)
       return false;
 
     streamSkipUntil(','); // Skip mux
@@ -611,97 +770,140 @@ public:
 
 TINY_GSM_MODEM_STREAM_UTILITIES()
 
-  // TODO: Optimize this!
   uint8_t waitResponse(uint32_t timeout_ms, String& data,
                        GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
                        GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
   {
-    /*String r1s(r1); r1s.trim();
-    String r2s(r2); r2s.trim();
-    String r3s(r3); r3s.trim();
-    String r4s(r4); r4s.trim();
-    String r5s(r5); r5s.trim();
-    DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
     data.reserve(64);
-    int index = 0;
+    return waitResponseImpl(timeout_ms, &data, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(uint32_t timeout_ms,
+                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    return waitResponseImpl(timeout_ms, NULL, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    return waitResponse(1000, r1, r2, r3, r4, r5);
+  }
+
+protected:
+
+  // Handles the rest of a +QIURC: line.  Returns true, with the stream
+  // right after the "dnsgip", for those of a host name lookup.
+  bool modemQiurc() {
+    stream.readStringUntil('\"');
+    String urc = stream.readStringUntil('\"');
+    stream.readStringUntil(',');
+    if (urc == "recv") {
+      int mux = stream.readStringUntil('\n').toInt();
+      DBG("### URC RECV:", mux);
+      if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
+        sockets[mux]->got_data = true;
+      }
+    } else if (urc == "closed") {
+      int mux = stream.readStringUntil('\n').toInt();
+      DBG("### URC CLOSE:", mux);
+      if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
+        sockets[mux]->sock_connected = false;
+      }
+    } else if (urc == "dnsgip") {
+      return true;
+    } else {
+      stream.readStringUntil('\n');
+    }
+    return false;
+  }
+
+  // Built-in URC's, added to urcs in this order by the constructor
+  enum {
+    URC_QIURC = 1,
+    URC_QIOPEN,
+    URC_BUILTIN = URC_QIOPEN
+  };
+
+  // Collects the response into data only if the caller asked for it
+  uint8_t waitResponseImpl(uint32_t timeout_ms, String* data,
+                           GsmConstStr r1, GsmConstStr r2, GsmConstStr r3,
+                           GsmConstStr r4, GsmConstStr r5)
+  {
+    TINY_GSM_WAIT_RESPONSE_HOOK();
+    TinyGsmMatcher<5> match;
+    match.add(r1);
+    match.add(r2);
+    match.add(r3);
+    match.add(r4);
+    match.add(r5);
+    uint8_t index = 0;
     unsigned long startMillis = millis();
     do {
-      TINY_GSM_YIELD();
+      TINY_GSM_YIELD_FOR(TinyGsmRemaining(startMillis, timeout_ms), match.reason());
       while (stream.available() > 0) {
         TINY_GSM_YIELD();
         int a = stream.read();
         if (a <= 0) continue; // Skip 0x00 bytes, just in case
-        data += (char)a;
-        if (r1 && data.endsWith(r1)) {
-          index = 1;
+        if (data) *data += (char)a;
+        uint8_t hit = match.feed(a);
+        uint8_t urc = urcs.feed(a);
+        if (hit) {
+          index = hit;
           goto finish;
-        } else if (r2 && data.endsWith(r2)) {
-          index = 2;
-          goto finish;
-        } else if (r3 && data.endsWith(r3)) {
-          index = 3;
-          goto finish;
-        } else if (r4 && data.endsWith(r4)) {
-          index = 4;
-          goto finish;
-        } else if (r5 && data.endsWith(r5)) {
-          index = 5;
-          goto finish;
-        } else if (data.endsWith(GF(GSM_NL "+QIURC:"))) {
-          stream.readStringUntil('\"');
-          String urc = stream.readStringUntil('\"');
-          stream.readStringUntil(',');
-          if (urc == "recv") {
-            int mux = stream.readStringUntil('\n').toInt();
-            DBG("### URC RECV:", mux);
-            if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
-              sockets[mux]->got_data = true;
-            }
-          } else if (urc == "closed") {
-            int mux = stream.readStringUntil('\n').toInt();
-            DBG("### URC CLOSE:", mux);
-            if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
-              sockets[mux]->sock_connected = false;
-            }
-          } else {
-            stream.readStringUntil('\n');
+        } else if (!urc) {
+          continue;
+        } else if (urc == URC_QIURC) {
+          if (modemQiurc()) {
+            stream.readStringUntil('\n');  // A late "dnsgip"
+          }
+          if (data) *data = "";
+        } else if (urc == URC_QIOPEN) {
+          int mux = stream.readStringUntil(',').toInt();
+          int err = stream.readStringUntil('\n').toInt();
+          if (!modemConnectDone(mux, 0 == err)) {
+            DBG("### Unexpected +QIOPEN:", mux, err);
           }
-          data = "";
+          if (data) *data = "";
+        } else {
+          urcs.dispatch(urc, stream);
+          if (data) *data = "";
         }
+        TINY_GSM_STATS_URC(urcs.prefix(urc));
+        match.reset();
+        urcs.lineStart();
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_STATS_RESPONSE(index);
     if (!index) {
-      data.trim();
-      if (data.length()) {
-        DBG("### Unhandled:", data);
+      if (data) {
+        data->trim();
+        if (data->length()) {
+          DBG("### Unhandled:", *data);
+        }
+        *data = "";
+      } else if (match.lineLength() > 2) {
+        DBG("### Unhandled:", match.line());
       }
-      data = "";
     }
-    //data.replace(GSM_NL, "/");
-    //DBG('<', index, '>', data);
     return index;
   }
 
-  uint8_t waitResponse(uint32_t timeout_ms,
-                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
-                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
-  {
-    String data;
-    return waitResponse(timeout_ms, data, r1, r2, r3, r4, r5);
-  }
-
-  uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
-                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
-  {
-    return waitResponse(1000, r1, r2, r3, r4, r5);
-  }
-
 public:
   Stream&       stream;
 
 protected:
   GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE> dns_cache;
+  IPAddress     dns_primary;
+  IPAddress     dns_secondary;
+  TinyGsmUrcTable<URC_BUILTIN + TINY_GSM_URC_HANDLERS> urcs;
+  TINY_GSM_MODEM_RX_STAGING()
+#ifdef TINY_GSM_STATS
+  TinyGsmStats  stats;
+#endif
 };
 
 #endif
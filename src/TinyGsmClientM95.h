@@ -17,6 +17,7 @@
 #endif
 
 #define TINY_GSM_MUX_COUNT 6
+#define TINY_GSM_MAX_READ_CHUNK 1500
 
 #include <TinyGsmCommon.h>
 
@@ -81,6 +82,8 @@ public:
 
 TINY_GSM_CLIENT_CONNECT_OVERLOADS()
 
+TINY_GSM_CLIENT_CONNECT_ASYNC_BLOCKING()
+
   virtual void stop(uint32_t maxWaitMs) {
     TINY_GSM_CLIENT_DUMP_MODEM_BUFFER()
     at->sendAT(GF("+QICLOSE="), mux);
@@ -96,7 +99,7 @@ TINY_GSM_CLIENT_AVAILABLE_NO_BUFFER_CHECK()
 
 TINY_GSM_CLIENT_READ_NO_BUFFER_CHECK()
 
-TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
+TINY_GSM_CLIENT_FLUSH_CONNECTED()
 
   /*
    * Extended API
@@ -109,7 +112,9 @@ private:
   uint8_t         mux;
   uint16_t        sock_available;
   bool            sock_connected;
+  TinyGsmConnectState connecting;
   RxFifo          rx;
+  TinyGsmTxBuffer<TINY_GSM_TX_BUFFER> tx;
 };
 
 
@@ -141,6 +146,8 @@ public:
     : stream(stream)
   {
     memset(sockets, 0, sizeof(sockets));
+    urcs.add(GF("+QIRDI:"));
+    urcs.add(GF("CLOSED"));
   }
 
   virtual ~TinyGsmM95() {}
@@ -197,6 +204,10 @@ TINY_GSM_MODEM_TEST_AT()
 
 TINY_GSM_MODEM_MAINTAIN_LISTEN()
 
+TINY_GSM_MODEM_URC_HANDLERS()
+
+TINY_GSM_MODEM_STATS()
+
   bool factoryDefault() {
     sendAT(GF("&FZE0&W"));  // Factory + Reset + Echo Off + Write
     waitResponse();
@@ -442,22 +453,17 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
     if (waitResponse(10000L, GF(GSM_NL "+CUSD:")) != 1) {
       return "";
     }
-    stream.readStringUntil('"');
-    String hex = stream.readStringUntil('"');
-    stream.readStringUntil(',');
+    char hex[TINY_GSM_USSD_BUFFER];
+    streamSkipUntil('"');
+    size_t len = stream.readBytesUntil('"', hex, sizeof(hex));
+    streamSkipUntil(',');
     int dcs = stream.readStringUntil('\n').toInt();
 
     if (waitResponse() != 1) {
       return "";
     }
 
-    if (dcs == 15) {
-      return TinyGsmDecodeHex8bit(hex);
-    } else if (dcs == 72) {
-      return TinyGsmDecodeHex16bit(hex);
-    } else {
-      return hex;
-    }
+    return TinyGsmDecodeUssd(hex, len, dcs);
   }
 
   bool sendSMS(const String& number, const String& text) {
@@ -489,15 +495,7 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
       return false;
     }
 
-    uint16_t* t = (uint16_t*)text;
-    for (size_t i=0; i<len; i++) {
-      uint8_t c = t[i] >> 8;
-      if (c < 0x10) { stream.print('0'); }
-      stream.print(c, HEX);
-      c = t[i] & 0xFF;
-      if (c < 0x10) { stream.print('0'); }
-      stream.print(c, HEX);
-    }
+    TinyGsmPrintHexUcs2(stream, (const uint16_t*)text, len);
     stream.write((char)0x1A);
     stream.flush();
     return waitResponse(60000L) == 1;
@@ -650,7 +648,7 @@ protected:
     return len;  // TODO
   }
 
-  size_t modemRead(size_t size, uint8_t mux) {
+  size_t modemRead(size_t size, uint8_t mux, uint8_t* dst = NULL, size_t dst_size = 0) {
     // TODO:  Does this work????
     // AT+QIRD=<id>,<sc>,<sid>,<len>
     // id = GPRS context number = 0, set in GPRS connect
@@ -674,14 +672,12 @@ protected:
       if (len < size) {
           sockets[mux]->sock_available = len;
       }
-      for (uint16_t i=0; i<len; i++) {
-        TINY_GSM_MODEM_STREAM_TO_MUX_FIFO_WITH_DOUBLE_TIMEOUT
-        sockets[mux]->sock_available--;
-        // ^^ One less character available after moving from modem's FIFO to our FIFO
-      }
+      size_t len_read = TINY_GSM_MODEM_STREAM_TO_MUX(len);
+      sockets[mux]->sock_available -= len;
+      // ^^ That much less available after moving from modem's FIFO to ours
       waitResponse();  // ends with an OK
       DBG("### READ:", len, "from", mux);
-      return len;
+      return len_read;
     } else {
         sockets[mux]->sock_available = 0;
         return 0;
@@ -716,43 +712,65 @@ public:
 
 TINY_GSM_MODEM_STREAM_UTILITIES()
 
-  // TODO: Optimize this!
   uint8_t waitResponse(uint32_t timeout_ms, String& data,
                        GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
                        GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
   {
-    /*String r1s(r1); r1s.trim();
-    String r2s(r2); r2s.trim();
-    String r3s(r3); r3s.trim();
-    String r4s(r4); r4s.trim();
-    String r5s(r5); r5s.trim();
-    DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
     data.reserve(64);
-    int index = 0;
+    return waitResponseImpl(timeout_ms, &data, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(uint32_t timeout_ms,
+                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    return waitResponseImpl(timeout_ms, NULL, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    return waitResponse(1000, r1, r2, r3, r4, r5);
+  }
+
+protected:
+
+  // Built-in URC's, added to urcs in this order by the constructor
+  enum {
+    URC_RX_DATA_IND = 1,
+    URC_CLOSED,
+    URC_BUILTIN = URC_CLOSED
+  };
+
+  // Collects the response into data only if the caller asked for it
+  uint8_t waitResponseImpl(uint32_t timeout_ms, String* data,
+                           GsmConstStr r1, GsmConstStr r2, GsmConstStr r3,
+                           GsmConstStr r4, GsmConstStr r5)
+  {
+    TINY_GSM_WAIT_RESPONSE_HOOK();
+    TinyGsmMatcher<5> match;
+    match.add(r1);
+    match.add(r2);
+    match.add(r3);
+    match.add(r4);
+    match.add(r5);
+    uint8_t index = 0;
     unsigned long startMillis = millis();
     do {
-      TINY_GSM_YIELD();
+      TINY_GSM_YIELD_FOR(TinyGsmRemaining(startMillis, timeout_ms), match.reason());
       while (stream.available() > 0) {
         TINY_GSM_YIELD();
         int a = stream.read();
         if (a <= 0) continue; // Skip 0x00 bytes, just in case
-        data += (char)a;
-        if (r1 && data.endsWith(r1)) {
-          index = 1;
-          goto finish;
-        } else if (r2 && data.endsWith(r2)) {
-          index = 2;
-          goto finish;
-        } else if (r3 && data.endsWith(r3)) {
-          index = 3;
-          goto finish;
-        } else if (r4 && data.endsWith(r4)) {
-          index = 4;
+        if (data) *data += (char)a;
+        uint8_t hit = match.feed(a);
+        uint8_t urc = urcs.feed(a);
+        if (hit) {
+          index = hit;
           goto finish;
-        } else if (r5 && data.endsWith(r5)) {
-          index = 5;
-          goto finish;
-        } else if (data.endsWith(GF(GSM_NL "+QIRDI:"))) {
+        } else if (!urc) {
+          continue;
+        } else if (urc == URC_RX_DATA_IND) {
           streamSkipUntil(',');  // Skip the context
           streamSkipUntil(',');  // Skip the role
           int mux = stream.readStringUntil('\n').toInt();
@@ -762,51 +780,49 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
             // we set the value to 1500, the maximum possible size.
             sockets[mux]->sock_available = 1500;
           }
-          data = "";
-        } else if (data.endsWith(GF("CLOSED" GSM_NL))) {
-          int nl = data.lastIndexOf(GSM_NL, data.length()-8);
-          int coma = data.indexOf(',', nl+2);
-          int mux = data.substring(nl+2, coma).toInt();
+          if (data) *data = "";
+        } else if (urc == URC_CLOSED) {
+          int mux = atoi(match.line());
           if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
             sockets[mux]->sock_connected = false;
           }
-          data = "";
+          if (data) *data = "";
           DBG("### Closed: ", mux);
+        } else {
+          urcs.dispatch(urc, stream);
+          if (data) *data = "";
         }
+        TINY_GSM_STATS_URC(urcs.prefix(urc));
+        match.reset();
+        urcs.lineStart();
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_STATS_RESPONSE(index);
     if (!index) {
-      data.trim();
-      if (data.length()) {
-        DBG("### Unhandled:", data);
+      if (data) {
+        data->trim();
+        if (data->length()) {
+          DBG("### Unhandled:", *data);
+        }
+        *data = "";
+      } else if (match.lineLength() > 2) {
+        DBG("### Unhandled:", match.line());
       }
-      data = "";
     }
-    //data.replace(GSM_NL, "/");
-    //DBG('<', index, '>', data);
     return index;
   }
 
-  uint8_t waitResponse(uint32_t timeout_ms,
-                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
-                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
-  {
-    String data;
-    return waitResponse(timeout_ms, data, r1, r2, r3, r4, r5);
-  }
-
-  uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
-                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
-  {
-    return waitResponse(1000, r1, r2, r3, r4, r5);
-  }
-
 public:
   Stream&       stream;
 
 protected:
   GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  TinyGsmUrcTable<URC_BUILTIN + TINY_GSM_URC_HANDLERS> urcs;
+  TINY_GSM_MODEM_RX_STAGING()
+#ifdef TINY_GSM_STATS
+  TinyGsmStats  stats;
+#endif
 };
 
 #endif
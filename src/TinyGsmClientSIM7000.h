@@ -17,6 +17,7 @@
 #endif
 
 #define TINY_GSM_MUX_COUNT 8
+#define TINY_GSM_MAX_READ_CHUNK 1460
 
 #include <TinyGsmCommon.h>
 
@@ -68,7 +69,6 @@ public:
     this->at = modem;
     this->mux = mux;
     sock_available = 0;
-    prev_check = 0;
     sock_connected = false;
     got_data = false;
 
@@ -88,10 +88,21 @@ public:
 
 TINY_GSM_CLIENT_CONNECT_OVERLOADS()
 
+  // Starts connecting and returns right away, see pollConnect()
+  virtual bool connectAsync(const char *host, uint16_t port, int timeout_s = 75) {
+    stop();
+    TINY_GSM_YIELD();
+    rx.clear();
+    return at->modemConnectAsync(host, port, mux, false, timeout_s);
+  }
+
+TINY_GSM_CLIENT_POLL_CONNECT()
+
   virtual void stop(uint32_t maxWaitMs) {
     TINY_GSM_CLIENT_DUMP_MODEM_BUFFER()
     at->sendAT(GF("+CIPCLOSE="), mux);
     sock_connected = false;
+    connecting.cancel();
     at->waitResponse();
   }
 
@@ -103,7 +114,7 @@ TINY_GSM_CLIENT_AVAILABLE_WITH_BUFFER_CHECK()
 
 TINY_GSM_CLIENT_READ_WITH_BUFFER_CHECK()
 
-TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
+TINY_GSM_CLIENT_FLUSH_CONNECTED()
 
   /*
    * Extended API
@@ -115,10 +126,12 @@ private:
   TinyGsmSim7000* at;
   uint8_t         mux;
   uint16_t        sock_available;
-  uint32_t        prev_check;
+  TinyGsmPollTimer poll;
   bool            sock_connected;
   bool            got_data;
+  TinyGsmConnectState connecting;
   RxFifo          rx;
+  TinyGsmTxBuffer<TINY_GSM_TX_BUFFER> tx;
 };
 
 
@@ -152,6 +165,11 @@ public:
     : stream(stream)
   {
     memset(sockets, 0, sizeof(sockets));
+    urcs.add(GF("+CIPRXGET:"));
+    urcs.add(GF("+RECEIVE:"));
+    urcs.add(GF("CLOSED"));
+    urcs.add(GF("CONNECT OK"));
+    urcs.add(GF("CONNECT FAIL"));
   }
 
   virtual ~TinyGsmSim7000() {}
@@ -214,6 +232,10 @@ TINY_GSM_MODEM_TEST_AT()
 
 TINY_GSM_MODEM_MAINTAIN_CHECK_SOCKS()
 
+TINY_GSM_MODEM_URC_HANDLERS()
+
+TINY_GSM_MODEM_STATS()
+
   bool factoryDefault() {  // these commands aren't supported
     return false;
   }
@@ -452,6 +474,11 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
       return false;
     }
 
+    // Configure Domain Name Server (DNS), if set
+    if (!modemSetDns()) {
+      return false;
+    }
+
     return true;
   }
 
@@ -505,6 +532,10 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return TinyGsmIpFromString(getLocalIP());
   }
 
+TINY_GSM_MODEM_DNS()
+
+TINY_GSM_MODEM_DNS_SERVERS()
+
   /*
    * Phone Call functions
    */
@@ -531,18 +562,13 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     if (waitResponse(10000L, GF(GSM_NL "+CUSD:")) != 1) {
       return "";
     }
-    stream.readStringUntil('"');
-    String hex = stream.readStringUntil('"');
-    stream.readStringUntil(',');
+    char hex[TINY_GSM_USSD_BUFFER];
+    streamSkipUntil('"');
+    size_t len = stream.readBytesUntil('"', hex, sizeof(hex));
+    streamSkipUntil(',');
     int dcs = stream.readStringUntil('\n').toInt();
 
-    if (dcs == 15) {
-      return TinyGsmDecodeHex8bit(hex);
-    } else if (dcs == 72) {
-      return TinyGsmDecodeHex16bit(hex);
-    } else {
-      return hex;
-    }
+    return TinyGsmDecodeUssd(hex, len, dcs);
   }
 
   bool sendSMS(const String& number, const String& text) {
@@ -577,15 +603,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
       return false;
     }
 
-    uint16_t* t = (uint16_t*)text;
-    for (size_t i=0; i<len; i++) {
-      uint8_t c = t[i] >> 8;
-      if (c < 0x10) { stream.print('0'); }
-      stream.print(c, HEX);
-      c = t[i] & 0xFF;
-      if (c < 0x10) { stream.print('0'); }
-      stream.print(c, HEX);
-    }
+    TinyGsmPrintHexUcs2(stream, (const uint16_t*)text, len);
     stream.write((char)0x1A);
     stream.flush();
     return waitResponse(60000L) == 1;
@@ -821,16 +839,45 @@ protected:
 
    int rsp;
    uint32_t timeout_ms = ((uint32_t)timeout_s) * 1000;
-   sendAT(GF("+CIPSTART="), mux, ',', GF("\"TCP"), GF("\",\""), host, GF("\","),
-          port);
+   char addr[16];
+   sendAT(GF("+CIPSTART="), mux, ',', GF("\"TCP"), GF("\",\""),
+          modemHostAddress(host, addr, ssl), GF("\","), port);
    rsp = waitResponse(
        timeout_ms, GF("CONNECT OK" GSM_NL), GF("CONNECT FAIL" GSM_NL),
        GF("ALREADY CONNECT" GSM_NL), GF("ERROR" GSM_NL),
        GF("CLOSE OK" GSM_NL)  // Happens when HTTPS handshake fails
    );
+   if (rsp != 1) {
+     dns_cache.forget(host);  // The address may have changed
+   }
    return (1 == rsp);
   }
 
+  // Like modemConnect(), but only waits for the modem to take the command.
+  // The "<mux>, CONNECT OK" comes later, as a URC.
+  bool modemConnectAsync(const char* host, uint16_t port, uint8_t mux,
+                         bool ssl = false, int timeout_s = 75) {
+    if (ssl) {
+      DBG("SSL not yet supported on this module!");
+    }
+    char addr[16];
+    sendAT(GF("+CIPSTART="), mux, ',', GF("\"TCP"), GF("\",\""),
+           modemHostAddress(host, addr, ssl), GF("\","), port);
+    if (waitResponse() != 1) {
+      return false;
+    }
+    sockets[mux]->connecting.start(((uint32_t)timeout_s) * 1000);
+    return true;
+  }
+
+TINY_GSM_MODEM_CONNECT_DONE()
+
+TINY_GSM_MODEM_HOST_ADDRESS()
+
+TINY_GSM_MODEM_LOOKUP_CDNSGIP()
+
+TINY_GSM_MODEM_SET_DNS_CDNSCFG()
+
   int16_t modemSend(const void* buff, size_t len, uint8_t mux) {
     sendAT(GF("+CIPSEND="), mux, ',', (uint16_t)len);
     if (waitResponse(GF(">")) != 1) {
@@ -845,7 +892,7 @@ protected:
     return stream.readStringUntil('\n').toInt();
   }
 
-  size_t modemRead(size_t size, uint8_t mux) {
+  size_t modemRead(size_t size, uint8_t mux, uint8_t* dst = NULL, size_t dst_size = 0) {
 #ifdef TINY_GSM_USE_HEX
     sendAT(GF("+CIPRXGET=3,"), mux, ',', (uint16_t)size);
     if (waitResponse(GF("+CIPRXGET:")) != 1) {
@@ -865,25 +912,20 @@ protected:
     // ^^ Confirmed number of data bytes to be read, which may be less than requested.
     // 0 indicates that no data can be read.
     // This is actually be the number of bytes that will be remaining after the read
-    for (int i=0; i<len_requested; i++) {
-      uint32_t startMillis = millis();
 #ifdef TINY_GSM_USE_HEX
-      while (stream.available() < 2 && (millis() - startMillis < sockets[mux]->_timeout)) { TINY_GSM_YIELD(); }
-      char buf[4] = { 0, };
-      buf[0] = stream.read();
-      buf[1] = stream.read();
-      char c = strtol(buf, NULL, 16);
+    size_t malformed = 0;
+    size_t len_read = TINY_GSM_MODEM_HEX_TO_MUX(len_requested, &malformed);
+    if (malformed) {
+      DBG("### Malformed hex data:", malformed);
+    }
 #else
-      while (!stream.available() && (millis() - startMillis < sockets[mux]->_timeout)) { TINY_GSM_YIELD(); }
-      char c = stream.read();
+    size_t len_read = TINY_GSM_MODEM_STREAM_TO_MUX(len_requested);
 #endif
-      sockets[mux]->rx.put(c);
-    }
-    DBG("### READ:", len_requested, "from", mux);
+    DBG("### READ:", len_read, "from", mux);
     // sockets[mux]->sock_available = modemGetAvailable(mux);
     sockets[mux]->sock_available = len_confirmed;
     waitResponse();
-    return len_requested;
+    return len_read;
   }
 
   size_t modemGetAvailable(uint8_t mux) {
@@ -896,12 +938,40 @@ protected:
       waitResponse();
     }
     DBG("### Available:", result, "on", mux);
-    if (!result) {
-      sockets[mux]->sock_connected = modemGetConnected(mux);
-    }
     return result;
   }
 
+TINY_GSM_MODEM_UPDATE_AVAILABLE("+CIPRXGET=4,", "", "+CIPRXGET:", 2)
+
+  // Refreshes the state of all sockets with one +CIPSTATUS, which lists
+  // every connection as C: <n>,<bearer>,<type>,<IP>,<port>,<state>.
+  // The list has all of the modem's connections, C: 0 to C: 7, whether
+  // they're sockets here or not, and is read up to its last line so none
+  // is left for the next command.
+  // For a single socket the shorter +CIPSTATUS=<n> answer is enough.
+  void modemUpdateConnected(uint16_t muxes) {
+    if (!(muxes & (muxes - 1))) {
+      for (int mux = 0; mux < TINY_GSM_MUX_COUNT; mux++) {
+        if ((muxes & (1U << mux)) && sockets[mux]) {
+          sockets[mux]->sock_connected = modemGetConnected(mux);
+        }
+      }
+      return;
+    }
+    sendAT(GF("+CIPSTATUS"));
+    int muxNo = -1;
+    while (muxNo < 7) {
+      if (waitResponse(GF("C: ")) != 1) {
+        break;
+      }
+      muxNo = stream.readStringUntil(',').toInt();
+      String state = stream.readStringUntil('\n');
+      if (muxNo >= 0 && muxNo < TINY_GSM_MUX_COUNT && sockets[muxNo]) {
+        sockets[muxNo]->sock_connected = state.indexOf("\"CONNECTED\"") >= 0;
+      }
+    }
+  }
+
   bool modemGetConnected(uint8_t mux) {
     sendAT(GF("+CIPSTATUS="), mux);
     int res = waitResponse(GF(",\"CONNECTED\""), GF(",\"CLOSED\""), GF(",\"CLOSING\""), GF(",\"INITIAL\""));
@@ -917,107 +987,140 @@ public:
 
 TINY_GSM_MODEM_STREAM_UTILITIES()
 
-  // TODO: Optimize this!
   uint8_t waitResponse(uint32_t timeout_ms, String& data,
                        GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
                        GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
   {
-    /*String r1s(r1); r1s.trim();
-    String r2s(r2); r2s.trim();
-    String r3s(r3); r3s.trim();
-    String r4s(r4); r4s.trim();
-    String r5s(r5); r5s.trim();
-    DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
     data.reserve(64);
-    int index = 0;
+    return waitResponseImpl(timeout_ms, &data, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(uint32_t timeout_ms,
+                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    return waitResponseImpl(timeout_ms, NULL, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    return waitResponse(1000, r1, r2, r3, r4, r5);
+  }
+
+protected:
+
+  // Built-in URC's, added to urcs in this order by the constructor
+  enum {
+    URC_RXGET = 1,
+    URC_RECEIVE,
+    URC_CLOSED,
+    URC_CONNECT_OK,
+    URC_CONNECT_FAIL,
+    URC_BUILTIN = URC_CONNECT_FAIL
+  };
+
+  // Collects the response into data only if the caller asked for it
+  uint8_t waitResponseImpl(uint32_t timeout_ms, String* data,
+                           GsmConstStr r1, GsmConstStr r2, GsmConstStr r3,
+                           GsmConstStr r4, GsmConstStr r5)
+  {
+    TINY_GSM_WAIT_RESPONSE_HOOK();
+    TinyGsmMatcher<5> match;
+    match.add(r1);
+    match.add(r2);
+    match.add(r3);
+    match.add(r4);
+    match.add(r5);
+    uint8_t index = 0;
     unsigned long startMillis = millis();
     do {
-      TINY_GSM_YIELD();
+      TINY_GSM_YIELD_FOR(TinyGsmRemaining(startMillis, timeout_ms), match.reason());
       while (stream.available() > 0) {
         TINY_GSM_YIELD();
         int a = stream.read();
         if (a <= 0) continue; // Skip 0x00 bytes, just in case
-        data += (char)a;
-        if (r1 && data.endsWith(r1)) {
-          index = 1;
+        if (data) *data += (char)a;
+        uint8_t hit = match.feed(a);
+        uint8_t urc = urcs.feed(a);
+        if (hit) {
+          index = hit;
           goto finish;
-        } else if (r2 && data.endsWith(r2)) {
-          index = 2;
-          goto finish;
-        } else if (r3 && data.endsWith(r3)) {
-          index = 3;
-          goto finish;
-        } else if (r4 && data.endsWith(r4)) {
-          index = 4;
-          goto finish;
-        } else if (r5 && data.endsWith(r5)) {
-          index = 5;
-          goto finish;
-        } else if (data.endsWith(GF(GSM_NL "+CIPRXGET:"))) {
+        } else if (!urc) {
+          continue;
+        } else if (urc == URC_RXGET) {
           String mode = stream.readStringUntil(',');
           if (mode.toInt() == 1) {
             int mux = stream.readStringUntil('\n').toInt();
             if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
               sockets[mux]->got_data = true;
             }
-            data = "";
+            if (data) *data = "";
             DBG("### Got Data:", mux);
           } else {
-            data += mode;
+            if (data) *data += mode;
           }
-        } else if (data.endsWith(GF(GSM_NL "+RECEIVE:"))) {
+        } else if (urc == URC_RECEIVE) {
           int mux = stream.readStringUntil(',').toInt();
           int len = stream.readStringUntil('\n').toInt();
           if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
             sockets[mux]->got_data = true;
             sockets[mux]->sock_available = len;
           }
-          data = "";
+          if (data) *data = "";
           DBG("### Got Data:", len, "on", mux);
-        } else if (data.endsWith(GF("CLOSED" GSM_NL))) {
-          int nl = data.lastIndexOf(GSM_NL, data.length()-8);
-          int coma = data.indexOf(',', nl+2);
-          int mux = data.substring(nl+2, coma).toInt();
+        } else if (urc == URC_CLOSED) {
+          int mux = atoi(match.line());
           if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
             sockets[mux]->sock_connected = false;
+            sockets[mux]->connecting.finish(false);
           }
-          data = "";
+          if (data) *data = "";
           DBG("### Closed: ", mux);
+        } else if (urc == URC_CONNECT_OK || urc == URC_CONNECT_FAIL) {
+          // Left to a blocking modemConnect() waiting for it
+          if (!modemConnectDone(atoi(match.line()), urc == URC_CONNECT_OK)) {
+            continue;
+          }
+          if (data) *data = "";
+        } else {
+          urcs.dispatch(urc, stream);
+          if (data) *data = "";
         }
+        TINY_GSM_STATS_URC(urcs.prefix(urc));
+        match.reset();
+        urcs.lineStart();
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_STATS_RESPONSE(index);
     if (!index) {
-      data.trim();
-      if (data.length()) {
-        DBG("### Unhandled:", data);
+      if (data) {
+        data->trim();
+        if (data->length()) {
+          DBG("### Unhandled:", *data);
+        }
+        *data = "";
+      } else if (match.lineLength() > 2) {
+        DBG("### Unhandled:", match.line());
       }
-      data = "";
     }
-    //data.replace(GSM_NL, "/");
-    //DBG('<', index, '>', data);
     return index;
   }
 
-  uint8_t waitResponse(uint32_t timeout_ms,
-                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
-                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
-  {
-    String data;
-    return waitResponse(timeout_ms, data, r1, r2, r3, r4, r5);
-  }
-
-  uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
-                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
-  {
-    return waitResponse(1000, r1, r2, r3, r4, r5);
-  }
-
 public:
   Stream&       stream;
 
 protected:
   GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE> dns_cache;
+  IPAddress     dns_primary;
+  IPAddress     dns_secondary;
+  TinyGsmUrcTable<URC_BUILTIN + TINY_GSM_URC_HANDLERS> urcs;
+  TINY_GSM_MODEM_RX_STAGING()
+#ifdef TINY_GSM_STATS
+  TinyGsmStats  stats;
+#endif
 };
 
 #endif
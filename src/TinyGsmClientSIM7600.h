@@ -17,6 +17,7 @@
 #endif
 
 #define TINY_GSM_MUX_COUNT 10
+#define TINY_GSM_MAX_READ_CHUNK 1500
 
 #include <TinyGsmCommon.h>
 
@@ -68,7 +69,6 @@ public:
     this->at = modem;
     this->mux = mux;
     sock_available = 0;
-    prev_check = 0;
     sock_connected = false;
     got_data = false;
 
@@ -88,6 +88,8 @@ public:
 
 TINY_GSM_CLIENT_CONNECT_OVERLOADS()
 
+TINY_GSM_CLIENT_CONNECT_ASYNC_BLOCKING()
+
   virtual void stop(uint32_t maxWaitMs) {
     TINY_GSM_CLIENT_DUMP_MODEM_BUFFER()
     at->sendAT(GF("+CIPCLOSE="), mux);
@@ -103,7 +105,7 @@ TINY_GSM_CLIENT_AVAILABLE_WITH_BUFFER_CHECK()
 
 TINY_GSM_CLIENT_READ_WITH_BUFFER_CHECK()
 
-TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
+TINY_GSM_CLIENT_FLUSH_CONNECTED()
 
   /*
    * Extended API
@@ -115,10 +117,12 @@ private:
   TinyGsmSim7600* at;
   uint8_t         mux;
   uint16_t        sock_available;
-  uint32_t        prev_check;
+  TinyGsmPollTimer poll;
   bool            sock_connected;
   bool            got_data;
+  TinyGsmConnectState connecting;
   RxFifo          rx;
+  TinyGsmTxBuffer<TINY_GSM_TX_BUFFER> tx;
 };
 
 
@@ -128,6 +132,10 @@ public:
     : stream(stream)
   {
     memset(sockets, 0, sizeof(sockets));
+    urcs.add(GF("+CIPRXGET:"));
+    urcs.add(GF("+RECEIVE:"));
+    urcs.add(GF("+IPCLOSE:"));
+    urcs.add(GF("+CIPEVENT:"));
   }
 
   virtual ~TinyGsmSim7600(){}
@@ -190,6 +198,10 @@ TINY_GSM_MODEM_TEST_AT()
 
 TINY_GSM_MODEM_MAINTAIN_CHECK_SOCKS()
 
+TINY_GSM_MODEM_URC_HANDLERS()
+
+TINY_GSM_MODEM_STATS()
+
   bool factoryDefault() {  // these commands aren't supported
     return false;
   }
@@ -382,9 +394,27 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
       return false;
     }
 
+    // Configure Domain Name Server (DNS), if set
+    if (!modemSetDns()) {
+      return false;
+    }
+
     return true;
   }
 
+  // Like gprsConnect(), but keeps the socket service if it's still open
+  // on the same APN, i.e. when only the MCU was reset
+  bool gprsConnectWarm(const char* apn, const char* user = NULL, const char* pwd = NULL) {
+    sendAT(GF("+NETOPEN?"));
+    int open = waitResponse(GF(GSM_NL "+NETOPEN: 1"), GF(GSM_NL "+NETOPEN: 0"));
+    waitResponse();
+    if (open == 1 && modemGetApn().equalsIgnoreCase(apn) && modemSetDns()) {
+      DBG("### Reusing the socket service");
+      return true;
+    }
+    return gprsConnect(apn, user, pwd);
+  }
+
   bool gprsDisconnect() {
 
     // Close all sockets and stop the socket service
@@ -435,6 +465,10 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return TinyGsmIpFromString(getLocalIP());
   }
 
+TINY_GSM_MODEM_DNS()
+
+TINY_GSM_MODEM_DNS_SERVERS()
+
   /*
    * Phone Call functions
    */
@@ -463,18 +497,13 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     if (waitResponse(10000L, GF(GSM_NL "+CUSD:")) != 1) {
       return "";
     }
-    stream.readStringUntil('"');
-    String hex = stream.readStringUntil('"');
-    stream.readStringUntil(',');
+    char hex[TINY_GSM_USSD_BUFFER];
+    streamSkipUntil('"');
+    size_t len = stream.readBytesUntil('"', hex, sizeof(hex));
+    streamSkipUntil(',');
     int dcs = stream.readStringUntil('\n').toInt();
 
-    if (dcs == 15) {
-      return TinyGsmDecodeHex8bit(hex);
-    } else if (dcs == 72) {
-      return TinyGsmDecodeHex16bit(hex);
-    } else {
-      return hex;
-    }
+    return TinyGsmDecodeUssd(hex, len, dcs);
   }
 
   bool sendSMS(const String& number, const String& text) {
@@ -514,15 +543,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
       return false;
     }
 
-    uint16_t* t = (uint16_t*)text;
-    for (size_t i=0; i<len; i++) {
-      uint8_t c = t[i] >> 8;
-      if (c < 0x10) { stream.print('0'); }
-      stream.print(c, HEX);
-      c = t[i] & 0xFF;
-      if (c < 0x10) { stream.print('0'); }
-      stream.print(c, HEX);
-    }
+    TinyGsmPrintHexUcs2(stream, (const uint16_t*)text, len);
     stream.write((char)0x1A);
     stream.flush();
     return waitResponse(60000L) == 1;
@@ -669,15 +690,42 @@ protected:
 
    // Establish a connection in multi-socket mode
    uint32_t timeout_ms = ((uint32_t)timeout_s) * 1000;
-   sendAT(GF("+CIPOPEN="), mux, ',', GF("\"TCP"), GF("\",\""), host, GF("\","),
-          port);
+   char addr[16];
+   sendAT(GF("+CIPOPEN="), mux, ',', GF("\"TCP"), GF("\",\""),
+          modemHostAddress(host, addr, ssl), GF("\","), port);
    // The reply is +CIPOPEN: ## of socket created
    if (waitResponse(timeout_ms, GF(GSM_NL "+CIPOPEN:")) != 1) {
+     dns_cache.forget(host);  // The address may have changed
      return false;
    }
    return true;
   }
 
+TINY_GSM_MODEM_HOST_ADDRESS()
+
+TINY_GSM_MODEM_GET_APN_CGDCONT()
+
+  // +CDNSGIP: 1,"<host>","<IP1>"[,"<IP2>"] or +CDNSGIP: 0,<err>, then
+  // the OK or ERROR
+  IPAddress modemLookup(const char* host, uint32_t& /*ttl_s*/, int timeout_s) {
+    sendAT(GF("+CDNSGIP=\""), host, '"');
+    if (waitResponse(((uint32_t)timeout_s)*1000, GF(GSM_NL "+CDNSGIP:")) != 1) {
+      return IPAddress(0,0,0,0);
+    }
+    String res = stream.readStringUntil('\n');
+    waitResponse();
+    if (res.toInt() != 1) {
+      return IPAddress(0,0,0,0);
+    }
+    int start = res.indexOf("\",\"");  // the end of "<host>"
+    if (start < 0) {
+      return IPAddress(0,0,0,0);
+    }
+    return TinyGsmIpFromString(res.substring(start + 3));
+  }
+
+TINY_GSM_MODEM_SET_DNS_CDNSCFG()
+
   int16_t modemSend(const void* buff, size_t len, uint8_t mux) {
     sendAT(GF("+CIPSEND="), mux, ',', (uint16_t)len);
     if (waitResponse(GF(">")) != 1) {
@@ -694,7 +742,7 @@ protected:
     return stream.readStringUntil('\n').toInt();
   }
 
-  size_t modemRead(size_t size, uint8_t mux) {
+  size_t modemRead(size_t size, uint8_t mux, uint8_t* dst = NULL, size_t dst_size = 0) {
 #ifdef TINY_GSM_USE_HEX
     sendAT(GF("+CIPRXGET=3,"), mux, ',', (uint16_t)size);
     if (waitResponse(GF("+CIPRXGET:")) != 1) {
@@ -712,25 +760,20 @@ protected:
     //  ^^ Requested number of data bytes (1-1460 bytes)to be read
     int len_confirmed = stream.readStringUntil('\n').toInt();
     // ^^ The data length which not read in the buffer
-    for (int i=0; i<len_requested; i++) {
-      uint32_t startMillis = millis();
 #ifdef TINY_GSM_USE_HEX
-      while (stream.available() < 2 && (millis() - startMillis < sockets[mux]->_timeout)) { TINY_GSM_YIELD(); }
-      char buf[4] = { 0, };
-      buf[0] = stream.read();
-      buf[1] = stream.read();
-      char c = strtol(buf, NULL, 16);
+    size_t malformed = 0;
+    size_t len_read = TINY_GSM_MODEM_HEX_TO_MUX(len_requested, &malformed);
+    if (malformed) {
+      DBG("### Malformed hex data:", malformed);
+    }
 #else
-      while (!stream.available() && (millis() - startMillis < sockets[mux]->_timeout)) { TINY_GSM_YIELD(); }
-      char c = stream.read();
+    size_t len_read = TINY_GSM_MODEM_STREAM_TO_MUX(len_requested);
 #endif
-      sockets[mux]->rx.put(c);
-    }
-    DBG("### READ:", len_requested, "from", mux);
+    DBG("### READ:", len_read, "from", mux);
     // sockets[mux]->sock_available = modemGetAvailable(mux);
     sockets[mux]->sock_available = len_confirmed;
     waitResponse();
-    return len_requested;
+    return len_read;
   }
 
   size_t modemGetAvailable(uint8_t mux) {
@@ -743,23 +786,29 @@ protected:
       waitResponse();
     }
     DBG("### Available:", result, "on", mux);
-    if (!result) {
-      sockets[mux]->sock_connected = modemGetConnected(mux);
-    }
     return result;
   }
 
-  bool modemGetConnected(uint8_t mux) {
-    // Read the status of all sockets at once
+TINY_GSM_MODEM_UPDATE_AVAILABLE("+CIPRXGET=4,", "", "+CIPRXGET:", 2)
+
+  // Reads the status of all sockets at once
+  void modemUpdateConnected(uint16_t) {
     sendAT(GF("+CIPCLOSE?"));
     if (waitResponse(GF("+CIPCLOSE:")) != 1) {
-      // return false;  // TODO:  Why does this not read correctly?
+      // return;  // TODO:  Why does this not read correctly?
     }
-    for (int muxNo = 0; muxNo <= TINY_GSM_MUX_COUNT; muxNo++) {
+    for (int muxNo = 0; muxNo < TINY_GSM_MUX_COUNT; muxNo++) {
       // +CIPCLOSE:<link0_state>,<link1_state>,...,<link9_state>
-      sockets[muxNo]->sock_connected = stream.parseInt();
+      bool connected = stream.parseInt();
+      if (sockets[muxNo]) {
+        sockets[muxNo]->sock_connected = connected;
+      }
     }
     waitResponse();  // Should be an OK at the end
+  }
+
+  bool modemGetConnected(uint8_t mux) {
+    modemUpdateConnected(1U << mux);
     return sockets[mux]->sock_connected;
   }
 
@@ -771,114 +820,141 @@ public:
 
 TINY_GSM_MODEM_STREAM_UTILITIES()
 
-  // TODO: Optimize this!
   uint8_t waitResponse(uint32_t timeout_ms, String& data,
                        GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
                        GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
   {
-    /*String r1s(r1); r1s.trim();
-    String r2s(r2); r2s.trim();
-    String r3s(r3); r3s.trim();
-    String r4s(r4); r4s.trim();
-    String r5s(r5); r5s.trim();
-    DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
     data.reserve(64);
-    int index = 0;
+    return waitResponseImpl(timeout_ms, &data, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(uint32_t timeout_ms,
+                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    return waitResponseImpl(timeout_ms, NULL, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    return waitResponse(1000, r1, r2, r3, r4, r5);
+  }
+
+protected:
+
+  // Built-in URC's, added to urcs in this order by the constructor
+  enum {
+    URC_RXGET = 1,
+    URC_RECEIVE,
+    URC_CLOSED,
+    URC_NET_ERROR,
+    URC_BUILTIN = URC_NET_ERROR
+  };
+
+  // Collects the response into data only if the caller asked for it
+  uint8_t waitResponseImpl(uint32_t timeout_ms, String* data,
+                           GsmConstStr r1, GsmConstStr r2, GsmConstStr r3,
+                           GsmConstStr r4, GsmConstStr r5)
+  {
+    TINY_GSM_WAIT_RESPONSE_HOOK();
+    TinyGsmMatcher<5> match;
+    match.add(r1);
+    match.add(r2);
+    match.add(r3);
+    match.add(r4);
+    match.add(r5);
+    uint8_t index = 0;
     unsigned long startMillis = millis();
     do {
-      TINY_GSM_YIELD();
+      TINY_GSM_YIELD_FOR(TinyGsmRemaining(startMillis, timeout_ms), match.reason());
       while (stream.available() > 0) {
         TINY_GSM_YIELD();
         int a = stream.read();
         if (a <= 0) continue; // Skip 0x00 bytes, just in case
-        data += (char)a;
-        if (r1 && data.endsWith(r1)) {
-          index = 1;
-          goto finish;
-        } else if (r2 && data.endsWith(r2)) {
-          index = 2;
+        if (data) *data += (char)a;
+        uint8_t hit = match.feed(a);
+        uint8_t urc = urcs.feed(a);
+        if (hit) {
+          index = hit;
           goto finish;
-        } else if (r3 && data.endsWith(r3)) {
-          index = 3;
-          goto finish;
-        } else if (r4 && data.endsWith(r4)) {
-          index = 4;
-          goto finish;
-        } else if (r5 && data.endsWith(r5)) {
-          index = 5;
-          goto finish;
-        } else if (data.endsWith(GF(GSM_NL "+CIPRXGET:"))) {
+        } else if (!urc) {
+          continue;
+        } else if (urc == URC_RXGET) {
           String mode = stream.readStringUntil(',');
           if (mode.toInt() == 1) {
             int mux = stream.readStringUntil('\n').toInt();
             if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
               sockets[mux]->got_data = true;
             }
-            data = "";
+            if (data) *data = "";
             DBG("### Got Data:", mux);
           } else {
-            data += mode;
+            if (data) *data += mode;
           }
-        } else if (data.endsWith(GF(GSM_NL "+RECEIVE:"))) {
+        } else if (urc == URC_RECEIVE) {
           int mux = stream.readStringUntil(',').toInt();
           int len = stream.readStringUntil('\n').toInt();
           if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
             sockets[mux]->got_data = true;
             sockets[mux]->sock_available = len;
           }
-          data = "";
+          if (data) *data = "";
           DBG("### Got Data:", len, "on", mux);
-        } else if (data.endsWith(GF("+IPCLOSE:"))) {
+        } else if (urc == URC_CLOSED) {
           int mux = stream.readStringUntil(',').toInt();
           streamSkipUntil('\n');  // Skip the reason code
           if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
             sockets[mux]->sock_connected = false;
           }
-          data = "";
+          if (data) *data = "";
           DBG("### Closed: ", mux);
-        } else if (data.endsWith(GF("+CIPEVENT:"))) {
+        } else if (urc == URC_NET_ERROR) {
           // Need to close all open sockets and release the network library.
           // User will then need to reconnect.
           DBG("### Network error!");
           if (!isGprsConnected()) {
             gprsDisconnect();
           }
-          data = "";
+          if (data) *data = "";
+        } else {
+          urcs.dispatch(urc, stream);
+          if (data) *data = "";
         }
+        TINY_GSM_STATS_URC(urcs.prefix(urc));
+        match.reset();
+        urcs.lineStart();
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_STATS_RESPONSE(index);
     if (!index) {
-      data.trim();
-      if (data.length()) {
-        DBG("### Unhandled:", data);
+      if (data) {
+        data->trim();
+        if (data->length()) {
+          DBG("### Unhandled:", *data);
+        }
+        *data = "";
+      } else if (match.lineLength() > 2) {
+        DBG("### Unhandled:", match.line());
       }
-      data = "";
     }
-    //data.replace(GSM_NL, "/");
-    //DBG('<', index, '>', data);
     return index;
   }
 
-  uint8_t waitResponse(uint32_t timeout_ms,
-                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
-                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
-  {
-    String data;
-    return waitResponse(timeout_ms, data, r1, r2, r3, r4, r5);
-  }
-
-  uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
-                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
-  {
-    return waitResponse(1000, r1, r2, r3, r4, r5);
-  }
-
 public:
   Stream&       stream;
 
 protected:
   GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE> dns_cache;
+  IPAddress     dns_primary;
+  IPAddress     dns_secondary;
+  TinyGsmUrcTable<URC_BUILTIN + TINY_GSM_URC_HANDLERS> urcs;
+  TINY_GSM_MODEM_RX_STAGING()
+#ifdef TINY_GSM_STATS
+  TinyGsmStats  stats;
+#endif
 };
 
 #endif
@@ -18,6 +18,14 @@
 #endif
 
 #define TINY_GSM_MUX_COUNT 5
+#define TINY_GSM_MAX_READ_CHUNK 1460
+// Most a single +CIPSEND takes on a TCP connection, see +CIPSEND?
+#define TINY_GSM_MAX_SEND_CHUNK 1460
+
+// Number of +CIPSEND's that may wait for their DATA ACCEPT at the same time
+#if !defined(TINY_GSM_SEND_PIPELINE)
+  #define TINY_GSM_SEND_PIPELINE 4
+#endif
 
 #include <TinyGsmCommon.h>
 
@@ -69,7 +77,6 @@ public:
     this->at = modem;
     this->mux = mux;
     sock_available = 0;
-    prev_check = 0;
     sock_connected = false;
     got_data = false;
 
@@ -89,10 +96,22 @@ public:
 
 TINY_GSM_CLIENT_CONNECT_OVERLOADS()
 
+  // Starts connecting and returns right away, see pollConnect()
+  virtual bool connectAsync(const char *host, uint16_t port, int timeout_s = 75) {
+    stop();
+    TINY_GSM_YIELD();
+    rx.clear();
+    return at->modemConnectAsync(host, port, mux, false, timeout_s);
+  }
+
+TINY_GSM_CLIENT_POLL_CONNECT()
+
   virtual void stop(uint32_t maxWaitMs) {
     TINY_GSM_CLIENT_DUMP_MODEM_BUFFER()
+    at->modemWaitAccepted(mux, 0);  // A quick close drops what isn't sent yet
     at->sendAT(GF("+CIPCLOSE="), mux, GF(",1"));  // Quick close
     sock_connected = false;
+    connecting.cancel();
     at->waitResponse();
   }
 
@@ -100,11 +119,38 @@ TINY_GSM_CLIENT_CONNECT_OVERLOADS()
 
 TINY_GSM_CLIENT_WRITE()
 
+  // How much can be written without waiting for earlier sends to finish:
+  // a whole +CIPSEND while the send window has room, else what still fits
+  // the transmit buffer.  Nothing once a send has failed.
+  virtual int availableForWrite() {
+    if (getWriteError()) {
+      return 0;
+    }
+    if (at->sends_pending < TINY_GSM_SEND_PIPELINE) {
+      return TinyGsmMax((size_t)TINY_GSM_MAX_SEND_CHUNK, tx.free());
+    }
+    return tx.free();
+  }
+
 TINY_GSM_CLIENT_AVAILABLE_WITH_BUFFER_CHECK()
 
 TINY_GSM_CLIENT_READ_WITH_BUFFER_CHECK()
 
-TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
+  // Also waits for the DATA ACCEPT of this socket's sends, so one that
+  // failed shows in getWriteError() once this returns
+  virtual void flush() {
+    sendTx();
+    at->stream.flush();
+    at->modemWaitAccepted(mux, 0);
+  }
+
+  virtual uint8_t connected() {
+    if (available()) {
+      return true;
+    }
+    return sock_connected;
+  }
+  virtual operator bool() { return connected(); }
 
   /*
    * Extended API
@@ -116,10 +162,12 @@ private:
   TinyGsmSim800*  at;
   uint8_t         mux;
   uint16_t        sock_available;
-  uint32_t        prev_check;
+  TinyGsmPollTimer poll;
   bool            sock_connected;
   bool            got_data;
+  TinyGsmConnectState connecting;
   RxFifo          rx;
+  TinyGsmTxBuffer<TINY_GSM_TX_BUFFER> tx;
 };
 
 
@@ -142,6 +190,13 @@ public:
     sock_connected = at->modemConnect(host, port, mux, true, timeout_s);
     return sock_connected;
   }
+
+  virtual bool connectAsync(const char *host, uint16_t port, int timeout_s = 75) {
+    stop();
+    TINY_GSM_YIELD();
+    rx.clear();
+    return at->modemConnectAsync(host, port, mux, true, timeout_s);
+  }
 };
 
 
@@ -151,6 +206,16 @@ public:
     : stream(stream)
   {
     memset(sockets, 0, sizeof(sockets));
+    sends_pending = 0;
+    urcs.add(GF("+CIPRXGET:"));
+    urcs.add(GF("+RECEIVE:"));
+    urcs.add(GF("CLOSED"));
+    urcs.add(GF("DATA ACCEPT:"));
+    urcs.add(GF("SEND FAIL"));
+    urcs.add(GF("CONNECT OK"));
+    urcs.add(GF("CONNECT FAIL"));
+    dns_primary = IPAddress(8,8,8,8);
+    dns_secondary = IPAddress(8,8,4,4);
   }
 
   virtual ~TinyGsmSim800() {}
@@ -222,19 +287,26 @@ TINY_GSM_MODEM_TEST_AT()
 
 TINY_GSM_MODEM_MAINTAIN_CHECK_SOCKS()
 
+TINY_GSM_MODEM_URC_HANDLERS()
+
+TINY_GSM_MODEM_STATS()
+
+TINY_GSM_MODEM_SEND_BATCH()
+
   bool factoryDefault() {
-    sendAT(GF("&FZE0&W"));  // Factory + Reset + Echo Off + Write
-    waitResponse();
-    sendAT(GF("+IPR=0"));   // Auto-baud
-    waitResponse();
-    sendAT(GF("+IFC=0,0")); // No Flow Control
+    // Anything after Z on the same line may be dropped, so the reset and
+    // the final write go on lines of their own
+    sendAT(GF("&FZ"));         // Factory + Reset
     waitResponse();
-    sendAT(GF("+ICF=3,3")); // 8 data 0 parity 1 stop
-    waitResponse();
-    sendAT(GF("+CSCLK=0")); // Disable Slow Clock
-    waitResponse();
-    sendAT(GF("&W"));       // Write configuration
-    return waitResponse() == 1;
+    TinyGsmAtBatch<64> batch;
+    batch.add(GF("E0"));       // Echo Off
+    batch.add(GF("+IPR=0"));   // Auto-baud
+    batch.add(GF("+IFC=0,0")); // No Flow Control
+    batch.add(GF("+ICF=3,3")); // 8 data 0 parity 1 stop
+    batch.add(GF("+CSCLK=0")); // Disable Slow Clock
+    bool ok = sendBatch(batch) == batch.count();
+    sendAT(GF("&W"));          // Write configuration
+    return (waitResponse() == 1) && ok;
   }
 
 TINY_GSM_MODEM_GET_INFO_ATI()
@@ -364,38 +436,16 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   bool gprsConnect(const char* apn, const char* user = NULL, const char* pwd = NULL) {
     gprsDisconnect();
 
-    // Set the Bearer for the IP
-    sendAT(GF("+SAPBR=3,1,\"Contype\",\"GPRS\""));  // Set the connection type to GPRS
-    waitResponse();
-
-    sendAT(GF("+SAPBR=3,1,\"APN\",\""), apn, '"');  // Set the APN
-    waitResponse();
-
-    if (user && strlen(user) > 0) {
-      sendAT(GF("+SAPBR=3,1,\"USER\",\""), user, '"');  // Set the user name
-      waitResponse();
-    }
-    if (pwd && strlen(pwd) > 0) {
-      sendAT(GF("+SAPBR=3,1,\"PWD\",\""), pwd, '"');  // Set the password
-      waitResponse();
-    }
-
     // Define the PDP context
     sendAT(GF("+CGDCONT=1,\"IP\",\""), apn, '"');
-    waitResponse();
+    if (waitResponse() != 1) {
+      return false;
+    }
 
     // Activate the PDP context
     sendAT(GF("+CGACT=1,1"));
     waitResponse(60000L);
 
-    // Open the definied GPRS bearer context
-    sendAT(GF("+SAPBR=1,1"));
-    waitResponse(85000L);
-    // Query the GPRS bearer context status
-    sendAT(GF("+SAPBR=2,1"));
-    if (waitResponse(30000L) != 1)
-      return false;
-
     // Attach to GPRS
     sendAT(GF("+CGATT=1"));
     if (waitResponse(60000L) != 1)
@@ -403,55 +453,53 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
 
     // TODO: wait AT+CGATT?
 
-    // Set to multi-IP
-    sendAT(GF("+CIPMUX=1"));
-    if (waitResponse() != 1) {
-      return false;
-    }
-
-    // Put in "quick send" mode (thus no extra "Send OK")
-    sendAT(GF("+CIPQSEND=1"));
-    if (waitResponse() != 1) {
-      return false;
-    }
-
-    // Set to get data manually
-    sendAT(GF("+CIPRXGET=1"));
-    if (waitResponse() != 1) {
-      return false;
-    }
-
-    // Start Task and Set APN, USER NAME, PASSWORD
-    sendAT(GF("+CSTT=\""), apn, GF("\",\""), user, GF("\",\""), pwd, GF("\""));
-    if (waitResponse(60000L) != 1) {
-      return false;
-    }
-
-    // Bring Up Wireless Connection with GPRS or CSD
-    sendAT(GF("+CIICR"));
-    if (waitResponse(60000L) != 1) {
-      return false;
-    }
-
-    // Get Local IP Address, only assigned after connection
-    sendAT(GF("+CIFSR;E0"));
-    if (waitResponse(10000L) != 1) {
-      return false;
-    }
+    return modemStartIp(apn, user, pwd);
+  }
 
-    // Configure Domain Name Server (DNS)
-    sendAT(GF("+CDNSCFG=\"8.8.8.8\",\"8.8.4.4\""));
-    if (waitResponse() != 1) {
-      return false;
+  // Like gprsConnect(), but first asks the modem what it still has up,
+  // i.e. when only the MCU was reset, and skips those steps instead of
+  // tearing everything down.  Anything it can't reuse gets the full
+  // gprsConnect().
+  bool gprsConnectWarm(const char* apn, const char* user = NULL, const char* pwd = NULL) {
+    String state = modemIpState();
+    if (state == GF("IP STATUS") || state == GF("IP PROCESSING")) {
+      // The TCP/IP stack has its IP, keep it if it's on the same APN and
+      // in multi-IP mode
+      sendAT(GF("+CIPMUX?"));
+      int mux = waitResponse(GF("+CIPMUX: 1"), GF("+CIPMUX: 0"));
+      waitResponse();
+      if (mux == 1 && modemIpApn().equalsIgnoreCase(apn)) {
+        DBG("### Reusing the GPRS connection");
+        sends_pending = 0;
+        TinyGsmAtBatch<32> batch;
+        batch.add(GF("+CIPQSEND=1"));  // Put in "quick send" mode (thus no extra "Send OK")
+        batch.add(GF("+CIPRXGET=1"));  // Set to get data manually
+        if (sendBatch(batch) == batch.count() && modemSetDns()) {
+          return true;
+        }
+        DBG("### Can't reuse the GPRS connection");
+      }
+    } else if (state == GF("IP INITIAL")) {
+      // Still attached, only the TCP/IP stack needs starting
+      sendAT(GF("+CGATT?"));
+      int attached = waitResponse(GF(GSM_NL "+CGATT: 1"), GF(GSM_NL "+CGATT: 0"));
+      waitResponse();
+      if (attached == 1) {
+        DBG("### Reusing the GPRS attach");
+        sends_pending = 0;
+        if (modemStartIp(apn, user, pwd)) {
+          return true;
+        }
+      }
     }
-
-    return true;
+    return gprsConnect(apn, user, pwd);
   }
 
   bool gprsDisconnect() {
     // Shut the TCP/IP connection
     // CIPSHUT will close *all* open connections
     sendAT(GF("+CIPSHUT"));
+    sends_pending = 0;
     if (waitResponse(60000L) != 1)
       return false;
 
@@ -499,6 +547,10 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return TinyGsmIpFromString(getLocalIP());
   }
 
+TINY_GSM_MODEM_DNS()
+
+TINY_GSM_MODEM_DNS_SERVERS()
+
   /*
    * Phone Call functions
    */
@@ -554,9 +606,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    */
 
   String sendUSSD(const String& code) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
-    sendAT(GF("+CSCS=\"HEX\""));
+    sendAT(GF("+CMGF=1;+CSCS=\"HEX\""));
     waitResponse();
     sendAT(GF("+CUSD=1,\""), code, GF("\""));
     if (waitResponse() != 1) {
@@ -565,25 +615,18 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     if (waitResponse(10000L, GF(GSM_NL "+CUSD:")) != 1) {
       return "";
     }
-    stream.readStringUntil('"');
-    String hex = stream.readStringUntil('"');
-    stream.readStringUntil(',');
+    char hex[TINY_GSM_USSD_BUFFER];
+    streamSkipUntil('"');
+    size_t len = stream.readBytesUntil('"', hex, sizeof(hex));
+    streamSkipUntil(',');
     int dcs = stream.readStringUntil('\n').toInt();
 
-    if (dcs == 15) {
-      return TinyGsmDecodeHex8bit(hex);
-    } else if (dcs == 72) {
-      return TinyGsmDecodeHex16bit(hex);
-    } else {
-      return hex;
-    }
+    return TinyGsmDecodeUssd(hex, len, dcs);
   }
 
   bool sendSMS(const String& number, const String& text) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
-    //Set GSM 7 bit default alphabet (3GPP TS 23.038)
-    sendAT(GF("+CSCS=\"GSM\""));
+    //Text mode, GSM 7 bit default alphabet (3GPP TS 23.038)
+    sendAT(GF("+CMGF=1;+CSCS=\"GSM\""));
     waitResponse();
     sendAT(GF("+CMGS=\""), number, GF("\""));
     if (waitResponse(GF(">")) != 1) {
@@ -596,11 +639,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool sendSMS_UTF16(const String& number, const void* text, size_t len) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
-    sendAT(GF("+CSCS=\"HEX\""));
-    waitResponse();
-    sendAT(GF("+CSMP=17,167,0,8"));
+    sendAT(GF("+CMGF=1;+CSCS=\"HEX\";+CSMP=17,167,0,8"));
     waitResponse();
 
     sendAT(GF("+CMGS=\""), number, GF("\""));
@@ -608,15 +647,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
       return false;
     }
 
-    uint16_t* t = (uint16_t*)text;
-    for (size_t i=0; i<len; i++) {
-      uint8_t c = t[i] >> 8;
-      if (c < 0x10) { stream.print('0'); }
-      stream.print(c, HEX);
-      c = t[i] & 0xFF;
-      if (c < 0x10) { stream.print('0'); }
-      stream.print(c, HEX);
-    }
+    TinyGsmPrintHexUcs2(stream, (const uint16_t*)text, len);
     stream.write((char)0x1A);
     stream.flush();
     return waitResponse(60000L) == 1;
@@ -628,6 +659,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    */
 
   String getGsmLocation() {
+    modemOpenBearer();
     sendAT(GF("+CIPGSMLOC=1,1"));
     if (waitResponse(10000L, GF(GSM_NL "+CIPGSMLOC:")) != 1) {
       return "";
@@ -757,6 +789,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   byte NTPServerSync(String server = "pool.ntp.org", byte TimeZone = 3) {
+    modemOpenBearer();
     sendAT(GF("+CNTPCID=1"));
     if (waitResponse(10000L) != 1) {
         return -1;
@@ -782,6 +815,47 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return -1;
   }
 
+  /*
+   * Certificate functions
+   */
+
+  // Puts a certificate (PEM or DER) into file on the modem's file system,
+  // i.e. "C:\\USER\\CERT.CRT", and has the SSL stack use it.  If the file
+  // already holds the same bytes (the same MD5) it isn't written again.
+  bool provisionCertificate(const char* file, const TinyGsmCertSource& cert) {
+    uint8_t want[16];
+    uint8_t have[16];
+    if (!TinyGsmCertDigest(cert, want)) {
+      return false;
+    }
+    int32_t size = modemFileSize(file);
+    if (size != (int32_t)cert.length() || !modemFileDigest(file, size, have) ||
+        memcmp(have, want, sizeof(want)) != 0)
+    {
+      DBG("### Uploading certificate", file);
+      if (!modemFileWrite(file, cert, size >= 0)) {
+        return false;
+      }
+      if (!modemFileDigest(file, cert.length(), have) ||
+          memcmp(have, want, sizeof(want)) != 0)
+      {
+        DBG("### Certificate check failed", file);
+        sendAT(GF("+FSDEL="), file);
+        waitResponse();
+        return false;
+      }
+    }
+    // Only points the SSL stack at the file
+    sendAT(GF("+SSLSETCERT=\""), file, '"');
+    if (waitResponse() != 1) {
+      return false;
+    }
+    if (waitResponse(5000L, GF(GSM_NL "+SSLSETCERT:")) != 1) {
+      return false;
+    }
+    return stream.readStringUntil('\n').toInt() == 0;
+  }
+
   /*
    * Client related functions
    */
@@ -793,6 +867,7 @@ protected:
  {
     int rsp;
     uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
+    char addr[16];
 #if !defined(TINY_GSM_MODEM_SIM900)
     sendAT(GF("+CIPSSL="), ssl);
     rsp = waitResponse();
@@ -800,7 +875,7 @@ protected:
       return false;
     }
 #endif
-    sendAT(GF("+CIPSTART="), mux, ',', GF("\"TCP"), GF("\",\""), host, GF("\","), port);
+    sendAT(GF("+CIPSTART="), mux, ',', GF("\"TCP"), GF("\",\""), modemHostAddress(host, addr, ssl), GF("\","), port);
     rsp = waitResponse(timeout_ms,
                        GF("CONNECT OK" GSM_NL),
                        GF("CONNECT FAIL" GSM_NL),
@@ -808,24 +883,321 @@ protected:
                        GF("ERROR" GSM_NL),
                        GF("CLOSE OK" GSM_NL)   // Happens when HTTPS handshake fails
                       );
+    if (rsp != 1) {
+      dns_cache.forget(host);  // The address may have changed
+    }
     return (1 == rsp);
   }
 
+  // Like modemConnect(), but only waits for the modem to take the command.
+  // The "<mux>, CONNECT OK" comes later, as a URC.
+  bool modemConnectAsync(const char* host, uint16_t port, uint8_t mux,
+                         bool ssl = false, int timeout_s = 75)
+  {
+    char addr[16];
+#if !defined(TINY_GSM_MODEM_SIM900)
+    sendAT(GF("+CIPSSL="), ssl);
+    if (waitResponse() != 1 && ssl) {
+      return false;
+    }
+#endif
+    sendAT(GF("+CIPSTART="), mux, ',', GF("\"TCP"), GF("\",\""), modemHostAddress(host, addr, ssl), GF("\","), port);
+    if (waitResponse() != 1) {
+      return false;
+    }
+    sockets[mux]->connecting.start(((uint32_t)timeout_s)*1000);
+    return true;
+  }
+
+TINY_GSM_MODEM_CONNECT_DONE()
+
+TINY_GSM_MODEM_HOST_ADDRESS()
+
+  // Starts the TCP/IP stack on an attached modem
+  bool modemStartIp(const char* apn, const char* user, const char* pwd) {
+    TinyGsmAtBatch<48> batch;
+    batch.add(GF("+CIPMUX=1"));    // Set to multi-IP
+    batch.add(GF("+CIPQSEND=1"));  // Put in "quick send" mode (thus no extra "Send OK")
+    batch.add(GF("+CIPRXGET=1"));  // Set to get data manually
+    if (sendBatch(batch) != batch.count()) {
+      return false;
+    }
+
+    // Start Task and Set APN, USER NAME, PASSWORD
+    // Not in the batch: sent twice, it's answered with ERROR in IP START
+    sendAT(GF("+CSTT=\""), apn, GF("\",\""), user, GF("\",\""), pwd, GF("\""));
+    if (waitResponse(60000L) != 1) {
+      return false;
+    }
+
+    // Bring Up Wireless Connection with GPRS or CSD
+    sendAT(GF("+CIICR"));
+    if (waitResponse(60000L) != 1) {
+      return false;
+    }
+
+    // Get Local IP Address, only assigned after connection
+    sendAT(GF("+CIFSR;E0"));
+    if (waitResponse(10000L) != 1) {
+      return false;
+    }
+
+    // Configure Domain Name Server (DNS)
+    if (!modemSetDns()) {
+      return false;
+    }
+
+    return true;
+  }
+
+  // The TCP/IP stack's state, i.e. "IP INITIAL" or "IP STATUS".  In
+  // multi-IP mode a C: line for every connection follows, those are left
+  // for the next waitResponse() to skip.
+  String modemIpState() {
+    sendAT(GF("+CIPSTATUS"));
+    if (waitResponse(GF("STATE: ")) != 1) {
+      return "";
+    }
+    String state = stream.readStringUntil('\n');
+    state.trim();
+    return state;
+  }
+
+  // The APN the TCP/IP stack was started with, from +CSTT: "<apn>",...
+  String modemIpApn() {
+    sendAT(GF("+CSTT?"));
+    if (waitResponse(GF("+CSTT: \"")) != 1) {
+      return "";
+    }
+    String apn = stream.readStringUntil('"');
+    waitResponse();
+    return apn;
+  }
+
+  // Opens the +SAPBR bearer the location and NTP functions use, with the
+  // APN, user and password of the TCP/IP stack, if it isn't open yet
+  bool modemOpenBearer() {
+    sendAT(GF("+SAPBR=2,1"));
+    if (waitResponse(GF("+SAPBR: 1,")) != 1) {
+      return false;
+    }
+    int status = stream.readStringUntil(',').toInt();
+    waitResponse();
+    if (status == 1) {  // connected
+      return true;
+    }
+
+    sendAT(GF("+CSTT?"));
+    if (waitResponse(GF("+CSTT: \"")) != 1) {
+      return false;
+    }
+    String apn = stream.readStringUntil('"');
+    streamSkipUntil('"');
+    String user = stream.readStringUntil('"');
+    streamSkipUntil('"');
+    String pwd = stream.readStringUntil('"');
+    waitResponse();
+
+    // Set the Bearer for the IP
+    TinyGsmAtBatch<TINY_GSM_BATCH_BUFFER> batch;
+    batch.add(GF("+SAPBR=3,1,\"Contype\",\"GPRS\""));  // Set the connection type to GPRS
+    batch.add(GF("+SAPBR=3,1,\"APN\",\""), apn.c_str(), '"');  // Set the APN
+    if (user.length() > 0) {
+      batch.add(GF("+SAPBR=3,1,\"USER\",\""), user.c_str(), '"');  // Set the user name
+    }
+    if (pwd.length() > 0) {
+      batch.add(GF("+SAPBR=3,1,\"PWD\",\""), pwd.c_str(), '"');  // Set the password
+    }
+    if (batch.overflow() || sendBatch(batch) != batch.count()) {
+      return false;
+    }
+
+    // Open the definied GPRS bearer context
+    sendAT(GF("+SAPBR=1,1"));
+    return waitResponse(85000L) == 1;
+  }
+
+TINY_GSM_MODEM_LOOKUP_CDNSGIP()
+
+TINY_GSM_MODEM_SET_DNS_CDNSCFG()
+
+  // -1 if there's no such file
+  int32_t modemFileSize(const char* file) {
+    sendAT(GF("+FSFLSIZE="), file);
+    if (waitResponse(GF(GSM_NL "+FSFLSIZE:")) != 1) {
+      return -1;
+    }
+    int32_t size = stream.readStringUntil('\n').toInt();
+    waitResponse();
+    return size;
+  }
+
+  // Replaces the file with the certificate, at most 10240 bytes per +FSWRITE
+  bool modemFileWrite(const char* file, const TinyGsmCertSource& cert, bool exists) {
+    if (exists) {
+      sendAT(GF("+FSDEL="), file);
+      if (waitResponse() != 1) {
+        return false;
+      }
+    }
+    sendAT(GF("+FSCREATE="), file);
+    if (waitResponse() != 1) {
+      return false;
+    }
+    for (size_t pos = 0; pos < cert.length();) {
+      size_t n = TinyGsmMin(cert.length() - pos, (size_t)10240);
+      sendAT(GF("+FSWRITE="), file, ',', pos ? 1 : 0, ',', (uint16_t)n, GF(",10"));  // 0 new, 1 append
+      if (waitResponse(GF(">")) != 1) {
+        return false;
+      }
+      if (!TinyGsmCertWrite(stream, cert, pos, n)) {
+        return false;
+      }
+      stream.flush();
+      if (waitResponse(10000L) != 1) {
+        return false;
+      }
+      pos += n;
+    }
+    return true;
+  }
+
+  // MD5 of the first len bytes of the file, read back with +FSREAD
+  bool modemFileDigest(const char* file, size_t len, uint8_t digest[16]) {
+    TinyGsmMd5 md5;
+    uint8_t    buf[TINY_GSM_CERT_CHUNK];
+    for (size_t pos = 0; pos < len;) {
+      size_t n = TinyGsmMin(len - pos, (size_t)10240);
+      sendAT(GF("+FSREAD="), file, GF(",1,"), (uint16_t)n, ',', (uint32_t)pos);  // 1 from pos
+      // <CR><LF>, then exactly n bytes of data, then OK
+      if (!streamSkipUntil('\n')) {
+        return false;
+      }
+      for (size_t left = n; left > 0;) {
+        size_t got = stream.readBytes((char*)buf, TinyGsmMin(left, sizeof(buf)));
+        if (!got) {
+          return false;
+        }
+        md5.update(buf, got);
+        left -= got;
+      }
+      if (waitResponse() != 1) {
+        return false;
+      }
+      pos += n;
+    }
+    md5.finish(digest);
+    return true;
+  }
+
+  // In quick send mode (+CIPQSEND=1) the modem takes the next command as
+  // soon as it has the data, so this doesn't wait for the DATA ACCEPT.
+  // The sends waiting for one are kept with their socket and length, and
+  // waitResponse() matches the DATA ACCEPT's and SEND FAIL's to them as
+  // URC's.  A send that fails, or is accepted only in part, sets the write
+  // error of its socket.  Only when TINY_GSM_SEND_PIPELINE sends are
+  // waiting does this block, before it sends, for room.
   int16_t modemSend(const void* buff, size_t len, uint8_t mux) {
+    modemWaitAccepted(-1, TINY_GSM_SEND_PIPELINE - 1);
     sendAT(GF("+CIPSEND="), mux, ',', (uint16_t)len);
     if (waitResponse(GF(">")) != 1) {
       return 0;
     }
     stream.write((uint8_t*)buff, len);
     stream.flush();
-    if (waitResponse(GF(GSM_NL "DATA ACCEPT:")) != 1) {
-      return 0;
+    sends[sends_pending].mux = mux;
+    sends[sends_pending].len = len;
+    sends_pending++;
+    return len;
+  }
+
+  // Waits until no more than max sends of mux (of all sockets for -1) are
+  // waiting for their DATA ACCEPT.  Those that don't get one in time count
+  // as failed.
+  bool modemWaitAccepted(int8_t mux, uint8_t max, uint32_t timeout_ms = 10000L) {
+    while (modemSendsPending(mux) > max) {
+      String line;
+      switch (waitResponse(timeout_ms, line, GF(GSM_NL "DATA ACCEPT:"),
+                           GF("SEND FAIL"), GFP(GSM_ERROR))) {
+      case 1:
+        modemAccepted();
+        break;
+      case 2:
+        // <mux>, SEND FAIL
+        line = line.substring(line.lastIndexOf('\n') + 1);
+        modemSendFailed(line.toInt());
+        break;
+      case 3:
+        modemSendFailed(-1);
+        break;
+      default:
+        DBG("### No DATA ACCEPT for", sends_pending, "sends");
+        while (sends_pending) {
+          modemSendFailed(-1);
+        }
+        return false;
+      }
     }
-    streamSkipUntil(','); // Skip mux
-    return stream.readStringUntil('\n').toInt();
+    return true;
+  }
+
+  uint8_t modemSendsPending(int8_t mux) {
+    if (mux < 0) {
+      return sends_pending;
+    }
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < sends_pending; i++) {
+      if (sends[i].mux == mux) n++;
+    }
+    return n;
+  }
+
+  // Reads the rest of a DATA ACCEPT:<mux>,<length>, for the oldest send
+  // waiting on that socket
+  void modemAccepted() {
+    int mux = stream.readStringUntil(',').toInt();
+    uint16_t len = stream.readStringUntil('\n').toInt();
+    int8_t i = modemFindSend(mux);
+    if (i < 0) {
+      return;
+    }
+    if (len < sends[i].len) {
+      DBG("### Accepted", len, "of", sends[i].len, "on", mux);
+      modemSendFailed(mux);
+    } else {
+      modemDropSend(i);
+    }
+  }
+
+  // The oldest send waiting on mux (the oldest of all for -1) failed
+  void modemSendFailed(int mux) {
+    int8_t i = modemFindSend(mux);
+    if (i < 0) {
+      return;
+    }
+    mux = sends[i].mux;
+    DBG("### Send failed:", mux);
+    if (sockets[mux]) {
+      sockets[mux]->setWriteError();
+    }
+    modemDropSend(i);
   }
 
-  size_t modemRead(size_t size, uint8_t mux) {
+  int8_t modemFindSend(int mux) {
+    for (uint8_t i = 0; i < sends_pending; i++) {
+      if (mux < 0 || sends[i].mux == mux) return i;
+    }
+    return -1;
+  }
+
+  void modemDropSend(uint8_t i) {
+    sends_pending--;
+    for (; i < sends_pending; i++) {
+      sends[i] = sends[i + 1];
+    }
+  }
+
+  size_t modemRead(size_t size, uint8_t mux, uint8_t* dst = NULL, size_t dst_size = 0) {
 #ifdef TINY_GSM_USE_HEX
     sendAT(GF("+CIPRXGET=3,"), mux, ',', (uint16_t)size);
     if (waitResponse(GF("+CIPRXGET:")) != 1) {
@@ -845,25 +1217,20 @@ protected:
     // ^^ Confirmed number of data bytes to be read, which may be less than requested.
     // 0 indicates that no data can be read.
     // This is actually be the number of bytes that will be remaining after the read
-    for (int i=0; i<len_requested; i++) {
-      uint32_t startMillis = millis();
 #ifdef TINY_GSM_USE_HEX
-      while (stream.available() < 2 && (millis() - startMillis < sockets[mux]->_timeout)) { TINY_GSM_YIELD(); }
-      char buf[4] = { 0, };
-      buf[0] = stream.read();
-      buf[1] = stream.read();
-      char c = strtol(buf, NULL, 16);
+    size_t malformed = 0;
+    size_t len_read = TINY_GSM_MODEM_HEX_TO_MUX(len_requested, &malformed);
+    if (malformed) {
+      DBG("### Malformed hex data:", malformed);
+    }
 #else
-      while (!stream.available() && (millis() - startMillis < sockets[mux]->_timeout)) { TINY_GSM_YIELD(); }
-      char c = stream.read();
+    size_t len_read = TINY_GSM_MODEM_STREAM_TO_MUX(len_requested);
 #endif
-      sockets[mux]->rx.put(c);
-    }
-    DBG("### READ:", len_requested, "from", mux);
+    DBG("### READ:", len_read, "from", mux);
     // sockets[mux]->sock_available = modemGetAvailable(mux);
     sockets[mux]->sock_available = len_confirmed;
     waitResponse();
-    return len_requested;
+    return len_read;
   }
 
   size_t modemGetAvailable(uint8_t mux) {
@@ -876,12 +1243,40 @@ protected:
       waitResponse();
     }
     DBG("### Available:", result, "on", mux);
-    if (!result) {
-      sockets[mux]->sock_connected = modemGetConnected(mux);
-    }
     return result;
   }
 
+TINY_GSM_MODEM_UPDATE_AVAILABLE("+CIPRXGET=4,", "", "+CIPRXGET:", 2)
+
+  // Refreshes the state of all sockets with one +CIPSTATUS, which lists
+  // every connection as C: <n>,<bearer>,<type>,<IP>,<port>,<state>.
+  // The list has all of the modem's connections, C: 0 to C: 5, whether
+  // they're sockets here or not, and is read up to its last line so none
+  // is left for the next command.
+  // For a single socket the shorter +CIPSTATUS=<n> answer is enough.
+  void modemUpdateConnected(uint16_t muxes) {
+    if (!(muxes & (muxes - 1))) {
+      for (int mux = 0; mux < TINY_GSM_MUX_COUNT; mux++) {
+        if ((muxes & (1U << mux)) && sockets[mux]) {
+          sockets[mux]->sock_connected = modemGetConnected(mux);
+        }
+      }
+      return;
+    }
+    sendAT(GF("+CIPSTATUS"));
+    int muxNo = -1;
+    while (muxNo < 5) {
+      if (waitResponse(GF("C: ")) != 1) {
+        break;
+      }
+      muxNo = stream.readStringUntil(',').toInt();
+      String state = stream.readStringUntil('\n');
+      if (muxNo >= 0 && muxNo < TINY_GSM_MUX_COUNT && sockets[muxNo]) {
+        sockets[muxNo]->sock_connected = state.indexOf("\"CONNECTED\"") >= 0;
+      }
+    }
+  }
+
   bool modemGetConnected(uint8_t mux) {
     sendAT(GF("+CIPSTATUS="), mux);
     waitResponse(GF("+CIPSTATUS"));
@@ -899,106 +1294,152 @@ public:
 
 TINY_GSM_MODEM_STREAM_UTILITIES()
 
-  // TODO: Optimize this!
   uint8_t waitResponse(uint32_t timeout_ms, String& data,
                        GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
                        GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
   {
-    /*String r1s(r1); r1s.trim();
-    String r2s(r2); r2s.trim();
-    String r3s(r3); r3s.trim();
-    String r4s(r4); r4s.trim();
-    String r5s(r5); r5s.trim();
-    DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
     data.reserve(64);
-    int index = 0;
+    return waitResponseImpl(timeout_ms, &data, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(uint32_t timeout_ms,
+                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    return waitResponseImpl(timeout_ms, NULL, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    return waitResponse(1000, r1, r2, r3, r4, r5);
+  }
+
+protected:
+
+  // Built-in URC's, added to urcs in this order by the constructor
+  enum {
+    URC_RXGET = 1,
+    URC_RECEIVE,
+    URC_CLOSED,
+    URC_ACCEPT,
+    URC_SEND_FAIL,
+    URC_CONNECT_OK,
+    URC_CONNECT_FAIL,
+    URC_BUILTIN = URC_CONNECT_FAIL
+  };
+
+  // Collects the response into data only if the caller asked for it
+  uint8_t waitResponseImpl(uint32_t timeout_ms, String* data,
+                           GsmConstStr r1, GsmConstStr r2, GsmConstStr r3,
+                           GsmConstStr r4, GsmConstStr r5)
+  {
+    TINY_GSM_WAIT_RESPONSE_HOOK();
+    TinyGsmMatcher<5> match;
+    match.add(r1);
+    match.add(r2);
+    match.add(r3);
+    match.add(r4);
+    match.add(r5);
+    uint8_t index = 0;
     unsigned long startMillis = millis();
     do {
-      TINY_GSM_YIELD();
+      TINY_GSM_YIELD_FOR(TinyGsmRemaining(startMillis, timeout_ms), match.reason());
       while (stream.available() > 0) {
         int a = stream.read();
         if (a <= 0) continue; // Skip 0x00 bytes, just in case
-        data += (char)a;
-        if (r1 && data.endsWith(r1)) {
-          index = 1;
-          goto finish;
-        } else if (r2 && data.endsWith(r2)) {
-          index = 2;
+        if (data) *data += (char)a;
+        uint8_t hit = match.feed(a);
+        uint8_t urc = urcs.feed(a);
+        if (hit) {
+          index = hit;
           goto finish;
-        } else if (r3 && data.endsWith(r3)) {
-          index = 3;
-          goto finish;
-        } else if (r4 && data.endsWith(r4)) {
-          index = 4;
-          goto finish;
-        } else if (r5 && data.endsWith(r5)) {
-          index = 5;
-          goto finish;
-        } else if (data.endsWith(GF(GSM_NL "+CIPRXGET:"))) {
+        } else if (!urc) {
+          continue;
+        } else if (urc == URC_RXGET) {
           String mode = stream.readStringUntil(',');
           if (mode.toInt() == 1) {
             int mux = stream.readStringUntil('\n').toInt();
             if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
               sockets[mux]->got_data = true;
             }
-            data = "";
+            if (data) *data = "";
             DBG("### Got Data:", mux);
           } else {
-            data += mode;
+            if (data) *data += mode;
           }
-        } else if (data.endsWith(GF(GSM_NL "+RECEIVE:"))) {
+        } else if (urc == URC_RECEIVE) {
           int mux = stream.readStringUntil(',').toInt();
           int len = stream.readStringUntil('\n').toInt();
           if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
             sockets[mux]->got_data = true;
             sockets[mux]->sock_available = len;
           }
-          data = "";
+          if (data) *data = "";
           DBG("### Got Data:", len, "on", mux);
-        } else if (data.endsWith(GF("CLOSED" GSM_NL))) {
-          int nl = data.lastIndexOf(GSM_NL, data.length()-8);
-          int coma = data.indexOf(',', nl+2);
-          int mux = data.substring(nl+2, coma).toInt();
+        } else if (urc == URC_CLOSED) {
+          int mux = atoi(match.line());
           if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
             sockets[mux]->sock_connected = false;
+            sockets[mux]->connecting.finish(false);
           }
-          data = "";
+          if (data) *data = "";
           DBG("### Closed: ", mux);
+        } else if (urc == URC_ACCEPT) {
+          modemAccepted();
+          if (data) *data = "";
+        } else if (urc == URC_SEND_FAIL) {
+          modemSendFailed(atoi(match.line()));
+          if (data) *data = "";
+        } else if (urc == URC_CONNECT_OK || urc == URC_CONNECT_FAIL) {
+          // Left to a blocking modemConnect() waiting for it
+          if (!modemConnectDone(atoi(match.line()), urc == URC_CONNECT_OK)) {
+            continue;
+          }
+          if (data) *data = "";
+        } else {
+          urcs.dispatch(urc, stream);
+          if (data) *data = "";
         }
+        TINY_GSM_STATS_URC(urcs.prefix(urc));
+        match.reset();
+        urcs.lineStart();
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_STATS_RESPONSE(index);
     if (!index) {
-      data.trim();
-      if (data.length()) {
-        DBG("### Unhandled:", data);
+      if (data) {
+        data->trim();
+        if (data->length()) {
+          DBG("### Unhandled:", *data);
+        }
+        *data = "";
+      } else if (match.lineLength() > 2) {
+        DBG("### Unhandled:", match.line());
       }
-      data = "";
     }
-    //data.replace(GSM_NL, "/");
-    //DBG('<', index, '>', data);
     return index;
   }
 
-  uint8_t waitResponse(uint32_t timeout_ms,
-                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
-                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
-  {
-    String data;
-    return waitResponse(timeout_ms, data, r1, r2, r3, r4, r5);
-  }
-
-  uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
-                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
-  {
-    return waitResponse(1000, r1, r2, r3, r4, r5);
-  }
-
 public:
   Stream&       stream;
 
 protected:
   GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  struct {
+    uint8_t  mux;
+    uint16_t len;
+  }             sends[TINY_GSM_SEND_PIPELINE];
+  uint8_t       sends_pending;
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE> dns_cache;
+  IPAddress     dns_primary;
+  IPAddress     dns_secondary;
+  TinyGsmUrcTable<URC_BUILTIN + TINY_GSM_URC_HANDLERS> urcs;
+  TINY_GSM_MODEM_RX_STAGING()
+#ifdef TINY_GSM_STATS
+  TinyGsmStats  stats;
+#endif
 };
 
 #endif
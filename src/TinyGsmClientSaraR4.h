@@ -17,6 +17,7 @@
 #endif
 
 #define TINY_GSM_MUX_COUNT 7
+#define TINY_GSM_MAX_READ_CHUNK 1024
 
 #include <TinyGsmCommon.h>
 
@@ -62,7 +63,6 @@ public:
     this->at = modem;
     this->mux = mux;
     sock_available = 0;
-    prev_check = 0;
     sock_connected = false;
     got_data = false;
 
@@ -91,6 +91,25 @@ public:
 
 TINY_GSM_CLIENT_CONNECT_OVERLOADS()
 
+  // Starts connecting and returns right away, see pollConnect()
+  virtual bool connectAsync(const char *host, uint16_t port, int timeout_s = 120) {
+    stop();
+    TINY_GSM_YIELD();
+    rx.clear();
+    uint8_t oldMux = mux;
+    if (!at->modemCreateSocket(&mux, false)) {
+      return false;
+    }
+    if (mux != oldMux) {
+        DBG("WARNING:  Mux number changed from", oldMux, "to", mux);
+        at->sockets[oldMux] = NULL;
+    }
+    at->sockets[mux] = this;
+    return at->modemConnectAsync(host, port, mux, false, timeout_s);
+  }
+
+TINY_GSM_CLIENT_POLL_CONNECT()
+
   virtual void stop(uint32_t maxWaitMs) {
     TINY_GSM_CLIENT_DUMP_MODEM_BUFFER()
 
@@ -106,6 +125,7 @@ TINY_GSM_CLIENT_CONNECT_OVERLOADS()
     // NOTE:  can take up to 120s to get a response
     at->waitResponse((maxWaitMs - (millis() - startMillis)));
     sock_connected = false;
+    connecting.cancel();
   }
 
   virtual void stop() { stop(135000L); }
@@ -116,7 +136,7 @@ TINY_GSM_CLIENT_AVAILABLE_WITH_BUFFER_CHECK()
 
 TINY_GSM_CLIENT_READ_WITH_BUFFER_CHECK()
 
-TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
+TINY_GSM_CLIENT_FLUSH_CONNECTED()
 
   /*
    * Extended API
@@ -128,10 +148,12 @@ private:
   TinyGsmSaraR4*   at;
   uint8_t         mux;
   uint16_t        sock_available;
-  uint32_t        prev_check;
+  TinyGsmPollTimer poll;
   bool            sock_connected;
   bool            got_data;
+  TinyGsmConnectState connecting;
   RxFifo          rx;
+  TinyGsmTxBuffer<TINY_GSM_TX_BUFFER> tx;
 };
 
 
@@ -161,6 +183,22 @@ public:
     at->maintain();
     return sock_connected;
   }
+
+  virtual bool connectAsync(const char *host, uint16_t port, int timeout_s = 120) {
+    stop();
+    TINY_GSM_YIELD();
+    rx.clear();
+    uint8_t oldMux = mux;
+    if (!at->modemCreateSocket(&mux, true)) {
+      return false;
+    }
+    if (mux != oldMux) {
+        DBG("WARNING:  Mux number changed from", oldMux, "to", mux);
+        at->sockets[oldMux] = NULL;
+    }
+    at->sockets[mux] = this;
+    return at->modemConnectAsync(host, port, mux, true, timeout_s);
+  }
 };
 
 
@@ -170,6 +208,9 @@ public:
     : stream(stream)
   {
     memset(sockets, 0, sizeof(sockets));
+    urcs.add(GF("+UUSORD:"));
+    urcs.add(GF("+UUSOCL:"));
+    urcs.add(GF("+UUSOCO:"));
   }
 
   virtual ~TinyGsmSaraR4(){}
@@ -247,6 +288,10 @@ TINY_GSM_MODEM_TEST_AT()
 
 TINY_GSM_MODEM_MAINTAIN_CHECK_SOCKS()
 
+TINY_GSM_MODEM_URC_HANDLERS()
+
+TINY_GSM_MODEM_STATS()
+
   bool factoryDefault() {
     sendAT(GF("&F"));  // Resets the current profile, other NVM not affected
     return waitResponse() == 1;
@@ -410,6 +455,22 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return true;
   }
 
+  // Like gprsConnect(), but keeps PDP context 1 if it's still active on the
+  // same APN, i.e. when only the MCU was reset.  Redefining the context
+  // would detach the modem from the network.
+  bool gprsConnectWarm(const char* apn, const char* user = NULL, const char* pwd = NULL) {
+    sendAT(GF("+CGACT?"));
+    int active = waitResponse(GF(GSM_NL "+CGACT: 1,1"), GFP(GSM_OK), GFP(GSM_ERROR));
+    if (active == 1) {
+      waitResponse();
+      if (modemGetApn().equalsIgnoreCase(apn)) {
+        DBG("### Reusing the PDP context");
+        return true;
+      }
+    }
+    return gprsConnect(apn, user, pwd);
+  }
+
   bool gprsDisconnect() {
     // sendAT(GF("+CGACT=0,1"));  // Deactivate PDP context 1
     sendAT(GF("+CGACT=0"));  // Deactivate all contexts
@@ -448,6 +509,8 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
     return TinyGsmIpFromString(getLocalIP());
   }
 
+TINY_GSM_MODEM_DNS()
+
   /*
    * Phone Call functions
    */
@@ -545,15 +608,20 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
     return temp;
   }
 
+  /*
+   * Certificate functions
+   */
+
+TINY_GSM_MODEM_CERT_USECMNG()
+
   /*
    * Client related functions
    */
 
 protected:
 
-  bool modemConnect(const char* host, uint16_t port, uint8_t* mux,
-                    bool ssl = false, int timeout_s = 120) {
-    uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
+  // Creates the socket that modemConnect() connects, the modem picks its number
+  bool modemCreateSocket(uint8_t* mux, bool ssl) {
     // create a socket
     sendAT(GF("+USOCR=6"));
     // reply is +USOCR: ## of socket created
@@ -575,6 +643,15 @@ protected:
     // Enable KEEPALIVE, 30 sec
     // sendAT(GF("+USOSO="), *mux, GF(",6,2,30000"));
     // waitResponse();
+    return true;
+  }
+
+  bool modemConnect(const char* host, uint16_t port, uint8_t* mux,
+                    bool ssl = false, int timeout_s = 120) {
+    uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
+    if (!modemCreateSocket(mux, ssl)) {
+      return false;
+    }
 
     // connect on the allocated socket
 
@@ -584,11 +661,23 @@ protected:
     // has a nasty habit of locking up when opening a socket, especially if
     // the cellular service is poor.
     // NOT supported on SARA-R404M / SARA-R410M-01B
-    sendAT(GF("+USOCO="), *mux, ",\"", host, "\",", port, ",1");
-    waitResponse(timeout_ms, GF(GSM_NL "+UUSOCO: "));
-    stream.readStringUntil(',').toInt();  // skip repeated mux
-    int connection_status = stream.readStringUntil('\n').toInt();
-    return (0 == connection_status);
+    char addr[16];
+    sendAT(GF("+USOCO="), *mux, ",\"", modemHostAddress(host, addr, ssl), "\",", port, ",1");
+    // The +UUSOCO of a connectAsync() on another socket may come first
+    int id;
+    int connection_status;
+    do {
+      if (waitResponse(timeout_ms, GF(GSM_NL "+UUSOCO:")) != 1) {
+        dns_cache.forget(host);  // The address may have changed
+        return false;
+      }
+      id = stream.readStringUntil(',').toInt();
+      connection_status = stream.readStringUntil('\n').toInt();
+    } while (id != *mux && modemConnectDone(id, 0 == connection_status));
+    if (0 != connection_status) {
+      dns_cache.forget(host);
+    }
+    return (id == *mux && 0 == connection_status);
 
     // use synchronous open
     // sendAT(GF("+USOCO="), *mux, ",\"", host, "\",", port, ",0");
@@ -596,6 +685,42 @@ protected:
     // return (1 == rsp);
   }
 
+  // Like modemConnect() on a socket from modemCreateSocket(), but only waits
+  // for the modem to take the command.  The +UUSOCO comes later, as a URC.
+  bool modemConnectAsync(const char* host, uint16_t port, uint8_t mux,
+                         bool ssl = false, int timeout_s = 120) {
+    char addr[16];
+    const char* to = modemHostAddress(host, addr, ssl);
+    sockets[mux]->connecting.start(((uint32_t)timeout_s)*1000);
+    // NOT supported on SARA-R404M / SARA-R410M-01B
+    sendAT(GF("+USOCO="), mux, ",\"", to, "\",", port, ",1");
+    if (waitResponse() != 1) {
+      sockets[mux]->connecting.cancel();
+      return false;
+    }
+    return true;
+  }
+
+TINY_GSM_MODEM_CONNECT_DONE()
+
+TINY_GSM_MODEM_HOST_ADDRESS()
+
+TINY_GSM_MODEM_CERT_MD5_USECMNG()
+
+TINY_GSM_MODEM_GET_APN_CGDCONT()
+
+  // +UDNSRN: "<IP_address>", resolution can take over a minute
+  IPAddress modemLookup(const char* host, uint32_t& /*ttl_s*/, int timeout_s) {
+    sendAT(GF("+UDNSRN=0,\""), host, '"');
+    if (waitResponse(((uint32_t)timeout_s)*1000, GF(GSM_NL "+UDNSRN:")) != 1) {
+      return IPAddress(0,0,0,0);
+    }
+    streamSkipUntil('"');
+    String ip = stream.readStringUntil('"');
+    waitResponse();
+    return TinyGsmIpFromString(ip);
+  }
+
   int16_t modemSend(const void* buff, size_t len, uint8_t mux) {
     sendAT(GF("+USOWR="), mux, ',', (uint16_t)len);
     if (waitResponse(GF("@")) != 1) {
@@ -614,7 +739,7 @@ protected:
     return sent;
   }
 
-  size_t modemRead(size_t size, uint8_t mux) {
+  size_t modemRead(size_t size, uint8_t mux, uint8_t* dst = NULL, size_t dst_size = 0) {
     sendAT(GF("+USORD="), mux, ',', (uint16_t)size);
     if (waitResponse(GF(GSM_NL "+USORD:")) != 1) {
       return 0;
@@ -623,14 +748,15 @@ protected:
     int len = stream.readStringUntil(',').toInt();
     streamSkipUntil('\"');
 
-    for (int i=0; i<len; i++) {
-      TINY_GSM_MODEM_STREAM_TO_MUX_FIFO_WITH_DOUBLE_TIMEOUT
-    }
+    size_t len_read = TINY_GSM_MODEM_STREAM_TO_MUX(len);
     streamSkipUntil('\"');
     waitResponse();
     DBG("### READ:", len, "from", mux);
     sockets[mux]->sock_available = modemGetAvailable(mux);
-    return len;
+    if (!sockets[mux]->sock_available) {
+      sockets[mux]->sock_connected = modemGetConnected(mux);
+    }
+    return len_read;
   }
 
   size_t modemGetAvailable(uint8_t mux) {
@@ -646,13 +772,21 @@ protected:
       // if (result) DBG("### DATA AVAILABLE:", result, "on", mux);
       waitResponse();
     }
-    if (!result) {
-      sockets[mux]->sock_connected = modemGetConnected(mux);
-    }
     DBG("### AVAILABLE:", result, "on", mux);
     return result;
   }
 
+TINY_GSM_MODEM_UPDATE_AVAILABLE("+USORD=", ",0", GSM_NL "+USORD:", 1)
+
+  // There's no command for the state of all sockets, so ask one by one
+  void modemUpdateConnected(uint16_t muxes) {
+    for (int mux = 0; mux < TINY_GSM_MUX_COUNT; mux++) {
+      if ((muxes & (1U << mux)) && sockets[mux]) {
+        sockets[mux]->sock_connected = modemGetConnected(mux);
+      }
+    }
+  }
+
   bool modemGetConnected(uint8_t mux) {
     // NOTE:  Querying a closed socket gives an error "operation not allowed"
     sendAT(GF("+USOCTL="), mux, ",10");
@@ -686,99 +820,130 @@ public:
 
 TINY_GSM_MODEM_STREAM_UTILITIES()
 
-  // TODO: Optimize this!
   uint8_t waitResponse(uint32_t timeout_ms, String& data,
                        GsmConstStr r1 = GFP(GSM_OK),
                        GsmConstStr r2 = GFP(GSM_ERROR),
                        GsmConstStr r3 = GFP(GSM_CME_ERROR),
                        GsmConstStr r4 = NULL, GsmConstStr r5 = NULL) {
-    /*String r1s(r1); r1s.trim();
-    String r2s(r2); r2s.trim();
-    String r3s(r3); r3s.trim();
-    String r4s(r4); r4s.trim();
-    String r5s(r5); r5s.trim();
-    DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
     data.reserve(64);
-    int index = 0;
+    return waitResponseImpl(timeout_ms, &data, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(uint32_t timeout_ms,
+                       GsmConstStr r1 = GFP(GSM_OK),
+                       GsmConstStr r2 = GFP(GSM_ERROR),
+                       GsmConstStr r3 = GFP(GSM_CME_ERROR),
+                       GsmConstStr r4 = NULL, GsmConstStr r5 = NULL) {
+    return waitResponseImpl(timeout_ms, NULL, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(GsmConstStr r1 = GFP(GSM_OK),
+                       GsmConstStr r2 = GFP(GSM_ERROR),
+                       GsmConstStr r3 = GFP(GSM_CME_ERROR),
+                       GsmConstStr r4 = NULL, GsmConstStr r5 = NULL) {
+    return waitResponse(1000, r1, r2, r3, r4, r5);
+  }
+
+protected:
+
+  // Built-in URC's, added to urcs in this order by the constructor
+  enum {
+    URC_READ = 1,
+    URC_CLOSED,
+    URC_CONNECTED,
+    URC_BUILTIN = URC_CONNECTED
+  };
+
+  // Collects the response into data only if the caller asked for it
+  uint8_t waitResponseImpl(uint32_t timeout_ms, String* data,
+                           GsmConstStr r1, GsmConstStr r2, GsmConstStr r3,
+                           GsmConstStr r4, GsmConstStr r5)
+  {
+    TINY_GSM_WAIT_RESPONSE_HOOK();
+    TinyGsmMatcher<5> match;
+    match.add(r1);
+    match.add(r2);
+    match.add(r3);
+    match.add(r4);
+    match.add(r5);
+    uint8_t index = 0;
     unsigned long startMillis = millis();
     do {
-      TINY_GSM_YIELD();
+      TINY_GSM_YIELD_FOR(TinyGsmRemaining(startMillis, timeout_ms), match.reason());
       while (stream.available() > 0) {
         TINY_GSM_YIELD();
         int a = stream.read();
-        if (a <= 0) continue;  // Skip 0x00 bytes, just in case
-        data += (char)a;
-        if (r1 && data.endsWith(r1)) {
-          index = 1;
-          goto finish;
-        } else if (r2 && data.endsWith(r2)) {
-          index = 2;
-          goto finish;
-        } else if (r3 && data.endsWith(r3)) {
-          index = 3;
-          if (r3 == GFP(GSM_CME_ERROR)) {
+        if (a <= 0) continue; // Skip 0x00 bytes, just in case
+        if (data) *data += (char)a;
+        uint8_t hit = match.feed(a);
+        uint8_t urc = urcs.feed(a);
+        if (hit) {
+          index = hit;
+          if (hit == 3 && r3 == GFP(GSM_CME_ERROR)) {
             streamSkipUntil('\n');  // Read out the error
           }
           goto finish;
-        } else if (r4 && data.endsWith(r4)) {
-          index = 4;
-          goto finish;
-        } else if (r5 && data.endsWith(r5)) {
-          index = 5;
-          goto finish;
-        } else if (data.endsWith(GF("+UUSORD:"))) {
+        } else if (!urc) {
+          continue;
+        } else if (urc == URC_READ) {
           int mux = stream.readStringUntil(',').toInt();
           int len = stream.readStringUntil('\n').toInt();
           if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
             sockets[mux]->got_data = true;
             sockets[mux]->sock_available = len;
           }
-          data = "";
+          if (data) *data = "";
           DBG("### URC Data Received:", len, "on", mux);
-        } else if (data.endsWith(GF("+UUSOCL:"))) {
+        } else if (urc == URC_CLOSED) {
           int mux = stream.readStringUntil('\n').toInt();
           if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
             sockets[mux]->sock_connected = false;
           }
-          data = "";
+          if (data) *data = "";
           DBG("### URC Sock Closed: ", mux);
+        } else if (urc == URC_CONNECTED) {
+          int mux = stream.readStringUntil(',').toInt();
+          int err = stream.readStringUntil('\n').toInt();
+          if (!modemConnectDone(mux, 0 == err)) {
+            DBG("### Unexpected +UUSOCO:", mux, err);
+          }
+          if (data) *data = "";
+        } else {
+          urcs.dispatch(urc, stream);
+          if (data) *data = "";
         }
+        TINY_GSM_STATS_URC(urcs.prefix(urc));
+        match.reset();
+        urcs.lineStart();
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_STATS_RESPONSE(index);
     if (!index) {
-      data.trim();
-      if (data.length()) {
-        DBG("### Unhandled:", data);
+      if (data) {
+        data->trim();
+        if (data->length()) {
+          DBG("### Unhandled:", *data);
+        }
+        *data = "";
+      } else if (match.lineLength() > 2) {
+        DBG("### Unhandled:", match.line());
       }
-      data = "";
     }
-    // data.replace(GSM_NL, "/");
-    // DBG('<', index, '>', data);
     return index;
   }
 
-  uint8_t waitResponse(uint32_t timeout_ms,
-                       GsmConstStr r1 = GFP(GSM_OK),
-                       GsmConstStr r2 = GFP(GSM_ERROR),
-                       GsmConstStr r3 = GFP(GSM_CME_ERROR),
-                       GsmConstStr r4 = NULL, GsmConstStr r5 = NULL) {
-    String data;
-    return waitResponse(timeout_ms, data, r1, r2, r3, r4, r5);
-  }
-
-  uint8_t waitResponse(GsmConstStr r1 = GFP(GSM_OK),
-                       GsmConstStr r2 = GFP(GSM_ERROR),
-                       GsmConstStr r3 = GFP(GSM_CME_ERROR),
-                       GsmConstStr r4 = NULL, GsmConstStr r5 = NULL) {
-    return waitResponse(1000, r1, r2, r3, r4, r5);
-  }
-
 public:
   Stream& stream;
 
 protected:
   GsmClient* sockets[TINY_GSM_MUX_COUNT];
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE> dns_cache;
+  TinyGsmUrcTable<URC_BUILTIN + TINY_GSM_URC_HANDLERS> urcs;
+  TINY_GSM_MODEM_RX_STAGING()
+#ifdef TINY_GSM_STATS
+  TinyGsmStats  stats;
+#endif
 };
 
 #endif
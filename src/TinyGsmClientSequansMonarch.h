@@ -16,6 +16,7 @@
 #endif
 
 #define TINY_GSM_MUX_COUNT 6
+#define TINY_GSM_MAX_READ_CHUNK 1500
 
 #include <TinyGsmCommon.h>
 
@@ -72,7 +73,6 @@ public:
     this->at = modem;
     this->mux = mux;
     sock_available = 0;
-    prev_check = 0;
     sock_connected = false;
     got_data = false;
 
@@ -94,10 +94,21 @@ public:
 
 TINY_GSM_CLIENT_CONNECT_OVERLOADS()
 
+  // Starts connecting and returns right away, see pollConnect()
+  virtual bool connectAsync(const char *host, uint16_t port, int timeout_s = 75) {
+    if (sock_connected) stop();
+    TINY_GSM_YIELD();
+    rx.clear();
+    return at->modemConnectAsync(host, port, mux, false, timeout_s);
+  }
+
+TINY_GSM_CLIENT_POLL_CONNECT()
+
   virtual void stop(uint32_t maxWaitMs) {
     TINY_GSM_CLIENT_DUMP_MODEM_BUFFER()
     at->sendAT(GF("+SQNSH="), mux);
     sock_connected = false;
+    connecting.cancel();
     at->waitResponse();
   }
 
@@ -109,7 +120,7 @@ TINY_GSM_CLIENT_AVAILABLE_WITH_BUFFER_CHECK()
 
 TINY_GSM_CLIENT_READ_WITH_BUFFER_CHECK()
 
-TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
+TINY_GSM_CLIENT_FLUSH_CONNECTED()
 
   /*
    * Extended API
@@ -121,10 +132,12 @@ private:
   TinyGsmSequansMonarch* at;
   uint8_t         mux;
   uint16_t        sock_available;
-  uint32_t        prev_check;
+  TinyGsmPollTimer poll;
   bool            sock_connected;
   bool            got_data;
+  TinyGsmConnectState connecting;
   RxFifo          rx;
+  TinyGsmTxBuffer<TINY_GSM_TX_BUFFER> tx;
 };
 
 
@@ -147,7 +160,29 @@ public:
     stop();
     TINY_GSM_YIELD();
     rx.clear();
+    if (!configureProfile()) {
+      return false;
+    }
+    sock_connected = at->modemConnect(host, port, mux, true, timeout_s);
+    return sock_connected;
+  }
+
+  virtual bool connectAsync(const char *host, uint16_t port, int timeout_s = 75) {
+    stop();
+    TINY_GSM_YIELD();
+    rx.clear();
+    if (!configureProfile()) {
+      return false;
+    }
+    return at->modemConnectAsync(host, port, mux, true, timeout_s);
+  }
 
+  void setStrictSSL(bool strict) {
+    strictSSL = strict;
+  }
+
+protected:
+  bool configureProfile() {
     // configure security profile 1 with parameters:
     if (strictSSL) {
       // require minimum of TLS 1.2 (3)
@@ -164,15 +199,8 @@ public:
       DBG("failed to configure security profile");
       return false;
     }
-
-    sock_connected = at->modemConnect(host, port, mux, true, timeout_s);
-    return sock_connected;
-  }
-
-  void setStrictSSL(bool strict) {
-    strictSSL = strict;
+    return true;
   }
-
 };
 
 public:
@@ -181,6 +209,8 @@ public:
     : stream(stream)
   {
     memset(sockets, 0, sizeof(sockets));
+    urcs.add(GF("+SQNSRING:"));
+    urcs.add(GF("+SQNSH: "));
   }
 
   virtual ~TinyGsmSequansMonarch() {}
@@ -229,20 +259,39 @@ TINY_GSM_MODEM_SET_BAUD_IPR()
 TINY_GSM_MODEM_TEST_AT()
 
   void maintain() {
+    bool checked = false;
     for (int mux = 1; mux <= TINY_GSM_MUX_COUNT; mux++) {
       GsmClient* sock = sockets[mux % TINY_GSM_MUX_COUNT];
       if (sock && sock->got_data) {
         sock->got_data = false;
         sock->sock_available = modemGetAvailable(mux);
-        // modemGetConnected() always checks the state of ALL socks
-        modemGetConnected();
+        sock->poll.checked(sock->sock_available > 0);
+        checked = true;
       }
     }
+    if (checked) {
+      // modemGetConnected() always checks the state of ALL socks
+      modemGetConnected();
+    }
+    TINY_GSM_MODEM_SEND_IDLE_TX()
     while (stream.available()) {
       waitResponse(15, NULL, NULL);
   }
+    // There's no URC for a finished connect, so ask
+    bool ask = false;
+    for (int mux = 0; mux < TINY_GSM_MUX_COUNT; mux++) {
+      if (sockets[mux] && sockets[mux]->connecting.due()) ask = true;
+    }
+    if (ask) {
+      modemGetConnected();
+    }
+    TINY_GSM_MODEM_CHECK_CONNECTS()
   }
 
+TINY_GSM_MODEM_URC_HANDLERS()
+
+TINY_GSM_MODEM_STATS()
+
   bool factoryDefault() {
     sendAT(GF("&FZE0&W"));  // Factory + Reset + Echo Off + Write
     waitResponse();
@@ -509,12 +558,12 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
 
 protected:
 
-  bool modemConnect(const char* host, uint16_t port, uint8_t mux,
-                    bool ssl = false, int timeout_s = 75)
+  // Configures the socket and dials, the connection may still be opening
+  bool modemDial(const char* host, uint16_t port, uint8_t mux,
+                 bool ssl, uint32_t timeout_ms)
  {
     int rsp;
     unsigned long startMillis = millis();
-    uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
 
     if (ssl) {
       // enable SSl and use security profile 1
@@ -566,7 +615,18 @@ protected:
                       );
 
     // creation of socket failed immediately.
-    if (rsp != 1) return false;
+    return (rsp == 1);
+  }
+
+  bool modemConnect(const char* host, uint16_t port, uint8_t mux,
+                    bool ssl = false, int timeout_s = 75)
+ {
+    unsigned long startMillis = millis();
+    uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
+
+    if (!modemDial(host, port, mux, ssl, timeout_ms)) {
+      return false;
+    }
 
     // wait until we get a good status
     bool connected = false;
@@ -577,6 +637,21 @@ protected:
     return connected;
   }
 
+  // Like modemConnect(), but doesn't wait for the connection to open.
+  // maintain() checks on it with modemGetConnected().
+  bool modemConnectAsync(const char* host, uint16_t port, uint8_t mux,
+                         bool ssl = false, int timeout_s = 75)
+  {
+    GsmClient* sock = sockets[mux % TINY_GSM_MUX_COUNT];
+    uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
+    sock->connecting.start(timeout_ms);
+    if (!modemDial(host, port, mux, ssl, timeout_ms)) {
+      sock->connecting.cancel();
+      return false;
+    }
+    return true;
+  }
+
 
   int modemSend(const void* buff, size_t len, uint8_t mux) {
     if (sockets[mux % TINY_GSM_MUX_COUNT]->sock_connected == false) {
@@ -618,23 +693,19 @@ protected:
   }
 
 
-  size_t modemRead(size_t size, uint8_t mux) {
+  size_t modemRead(size_t size, uint8_t mux, uint8_t* dst = NULL, size_t dst_size = 0) {
     sendAT(GF("+SQNSRECV="), mux, ',', (uint16_t)size);
     if (waitResponse(GF("+SQNSRECV: ")) != 1) {
       return 0;
     }
     streamSkipUntil(','); // Skip mux
     int len = stream.readStringUntil('\n').toInt();
-    for (int i=0; i<len; i++) {
-      uint32_t startMillis = millis(); \
-      while (!stream.available() && ((millis() - startMillis) < sockets[mux % TINY_GSM_MUX_COUNT]->_timeout)) { TINY_GSM_YIELD(); } \
-      char c = stream.read(); \
-      sockets[mux % TINY_GSM_MUX_COUNT]->rx.put(c);
-    }
+    GsmClient* sock = sockets[mux % TINY_GSM_MUX_COUNT];
+    size_t len_read = TinyGsmStreamToFifo(stream, len, sock->rx, sock->_timeout, dst, dst_size);
     DBG("### Read:", len, "from", mux);
     waitResponse();
     sockets[mux % TINY_GSM_MUX_COUNT]->sock_available = modemGetAvailable(mux);
-    return len;
+    return len_read;
   }
 
   size_t modemGetAvailable(uint8_t mux) {
@@ -675,11 +746,18 @@ protected:
       // SOCK_LISTENING              = 4,
       // SOCK_INCOMING               = 5,
       // SOCK_OPENING                = 6,
-      sockets[muxNo % TINY_GSM_MUX_COUNT]->sock_connected = \
-        ((status != SOCK_CLOSED) && (status != SOCK_INCOMING) && (status != SOCK_OPENING));
+      GsmClient* sock = sockets[muxNo % TINY_GSM_MUX_COUNT];
+      if (sock) {
+        sock->sock_connected = \
+          ((status != SOCK_CLOSED) && (status != SOCK_INCOMING) && (status != SOCK_OPENING));
+        if (status != SOCK_OPENING) {
+          sock->connecting.finish(sock->sock_connected);
+        }
+      }
     }
     waitResponse();  // Should be an OK at the end
-    return sockets[mux % TINY_GSM_MUX_COUNT]->sock_connected;
+    GsmClient* sock = sockets[mux % TINY_GSM_MUX_COUNT];
+    return sock && sock->sock_connected;
   }
 
 public:
@@ -690,93 +768,115 @@ public:
 
 TINY_GSM_MODEM_STREAM_UTILITIES()
 
-  // TODO: Optimize this!
   uint8_t waitResponse(uint32_t timeout_ms, String& data,
                        GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
                        GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
   {
-    /*String r1s(r1); r1s.trim();
-    String r2s(r2); r2s.trim();
-    String r3s(r3); r3s.trim();
-    String r4s(r4); r4s.trim();
-    String r5s(r5); r5s.trim();
-    DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
     data.reserve(64);
-    int index = 0;
+    return waitResponseImpl(timeout_ms, &data, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(uint32_t timeout_ms,
+                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    return waitResponseImpl(timeout_ms, NULL, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    return waitResponse(1000, r1, r2, r3, r4, r5);
+  }
+
+protected:
+
+  // Built-in URC's, added to urcs in this order by the constructor
+  enum {
+    URC_RING = 1,
+    URC_CLOSED,
+    URC_BUILTIN = URC_CLOSED
+  };
+
+  // Collects the response into data only if the caller asked for it
+  uint8_t waitResponseImpl(uint32_t timeout_ms, String* data,
+                           GsmConstStr r1, GsmConstStr r2, GsmConstStr r3,
+                           GsmConstStr r4, GsmConstStr r5)
+  {
+    TINY_GSM_WAIT_RESPONSE_HOOK();
+    TinyGsmMatcher<5> match;
+    match.add(r1);
+    match.add(r2);
+    match.add(r3);
+    match.add(r4);
+    match.add(r5);
+    uint8_t index = 0;
     unsigned long startMillis = millis();
     do {
-      TINY_GSM_YIELD();
+      TINY_GSM_YIELD_FOR(TinyGsmRemaining(startMillis, timeout_ms), match.reason());
       while (stream.available() > 0) {
         TINY_GSM_YIELD();
         int a = stream.read();
         if (a <= 0) continue; // Skip 0x00 bytes, just in case
-        data += (char)a;
-        if (r1 && data.endsWith(r1)) {
-          index = 1;
+        if (data) *data += (char)a;
+        uint8_t hit = match.feed(a);
+        uint8_t urc = urcs.feed(a);
+        if (hit) {
+          index = hit;
           goto finish;
-        } else if (r2 && data.endsWith(r2)) {
-          index = 2;
-          goto finish;
-        } else if (r3 && data.endsWith(r3)) {
-          index = 3;
-          goto finish;
-        } else if (r4 && data.endsWith(r4)) {
-          index = 4;
-          goto finish;
-        } else if (r5 && data.endsWith(r5)) {
-          index = 5;
-          goto finish;
-        } else if (data.endsWith(GF(GSM_NL "+SQNSRING:"))) {
+        } else if (!urc) {
+          continue;
+        } else if (urc == URC_RING) {
           int mux = stream.readStringUntil(',').toInt();
           int len = stream.readStringUntil('\n').toInt();
           if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux % TINY_GSM_MUX_COUNT]) {
             sockets[mux % TINY_GSM_MUX_COUNT]->got_data = true;
             sockets[mux % TINY_GSM_MUX_COUNT]->sock_available = len;
           }
-          data = "";
+          if (data) *data = "";
           DBG("### URC Data Received:", len, "on", mux);
-        } else if (data.endsWith(GF("SQNSH: "))) {
+        } else if (urc == URC_CLOSED) {
           int mux = stream.readStringUntil('\n').toInt();
           if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux % TINY_GSM_MUX_COUNT]) {
             sockets[mux % TINY_GSM_MUX_COUNT]->sock_connected = false;
           }
-          data = "";
+          if (data) *data = "";
           DBG("### URC Sock Closed: ", mux);
+        } else {
+          urcs.dispatch(urc, stream);
+          if (data) *data = "";
         }
+        TINY_GSM_STATS_URC(urcs.prefix(urc));
+        match.reset();
+        urcs.lineStart();
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_STATS_RESPONSE(index);
     if (!index) {
-      data.trim();
-      if (data.length()) {
-        DBG("### Unhandled:", data);
+      if (data) {
+        data->trim();
+        if (data->length()) {
+          DBG("### Unhandled:", *data);
+        }
+        *data = "";
+      } else if (match.lineLength() > 2) {
+        DBG("### Unhandled:", match.line());
       }
-      data = "";
     }
-    //data.replace(GSM_NL, "/");
-    //DBG('<', index, '>', data);
     return index;
   }
 
-  uint8_t waitResponse(uint32_t timeout_ms,
-                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
-                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
-  {
-    String data;
-    return waitResponse(timeout_ms, data, r1, r2, r3, r4, r5);
-  }
-
-  uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
-                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
-  {
-    return waitResponse(1000, r1, r2, r3, r4, r5);
-  }
-
 public:
   Stream&       stream;
 
 protected:
   GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  TinyGsmUrcTable<URC_BUILTIN + TINY_GSM_URC_HANDLERS> urcs;
+  TINY_GSM_MODEM_RX_STAGING()
+#ifdef TINY_GSM_STATS
+  TinyGsmStats  stats;
+#endif
 };
 
 #endif
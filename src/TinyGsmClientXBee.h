@@ -12,13 +12,38 @@
 
 //#define TINY_GSM_DEBUG Serial
 
-// XBee's do not support multi-plexing in transparent/command mode
-// The much more complicated API mode is needed for multi-plexing
-#define TINY_GSM_MUX_COUNT 1
+#if !defined(TINY_GSM_RX_BUFFER)
+  #ifdef TINY_GSM_XBEE_API
+    // A socket's fifo takes a whole receive frame at a time
+    #define TINY_GSM_RX_BUFFER (TINY_GSM_XBEE_MAX_PAYLOAD + 1)
+  #else
+    #define TINY_GSM_RX_BUFFER 256
+  #endif
+#endif
+
+#ifdef TINY_GSM_XBEE_API
+  // In API mode every frame says which socket it's for
+  #define TINY_GSM_MUX_COUNT 4
+#else
+  // XBee's do not support multi-plexing in transparent/command mode
+  // The much more complicated API mode is needed for multi-plexing,
+  // define TINY_GSM_XBEE_API for it
+  #define TINY_GSM_MUX_COUNT 1
+#endif
 // XBee's have a default guard time of 1 second (1000ms, 10 extra for safety here)
 #define TINY_GSM_XBEE_GUARD_TIME 1010
+// XBee's need an IP address to connect, so keep at least the last host's
+#ifndef TINY_GSM_DNS_CACHE
+  #define TINY_GSM_DNS_CACHE 1
+#endif
 
 #include <TinyGsmCommon.h>
+#ifdef TINY_GSM_XBEE_API
+  #include <TinyGsmXBeeApi.h>
+  #if TINY_GSM_RX_BUFFER <= TINY_GSM_XBEE_MAX_PAYLOAD
+    #error "TINY_GSM_RX_BUFFER must be more than TINY_GSM_XBEE_MAX_PAYLOAD in API mode"
+  #endif
+#endif
 
 #define GSM_NL "\r"
 static const char GSM_OK[] TINY_GSM_PROGMEM = "OK" GSM_NL;
@@ -62,6 +87,22 @@ enum XBeeType {
   XBEE3_LTEM_ATT = 0xB08,  // Digi XBee3™ Cellular LTE-M
 };
 
+// The parameters the library sets over and over, shadowed in RAM so they're
+// only sent when they change (see setParam())
+enum XBeeParam {
+  XBEE_PARAM_AP = 0,  // API enable
+  XBEE_PARAM_GT,      // guard times
+  XBEE_PARAM_CT,      // command mode timeout
+  XBEE_PARAM_IP,      // IP protocol
+  XBEE_PARAM_DL,      // destination address
+  XBEE_PARAM_DE,      // destination port
+  XBEE_PARAM_TM,      // socket timeout
+  XBEE_PARAM_AN,      // access point name
+  XBEE_PARAM_AM,      // airplane mode
+  XBEE_PARAM_COUNT
+};
+static const char XBEE_PARAM_NAMES[] TINY_GSM_PROGMEM = "APGTCTIPDLDETMANAM";
+
 
 class TinyGsmXBee
 {
@@ -71,7 +112,7 @@ public:
 class GsmClient : public Client
 {
   friend class TinyGsmXBee;
-  // typedef TinyGsmFifo<uint8_t, TINY_GSM_RX_BUFFER> RxFifo;
+  typedef TinyGsmFifo<uint8_t, TINY_GSM_RX_BUFFER> RxFifo;
 
 public:
   GsmClient() {}
@@ -86,12 +127,52 @@ public:
     this->at = modem;
     this->mux = mux;
     sock_connected = false;
+#ifdef TINY_GSM_XBEE_API
+    sock_id = 0xFF;
+    sock_ip = IPAddress(0,0,0,0);
+#endif
+    sock_dropped = 0;
 
     at->sockets[mux] = this;
 
     return true;
   }
 
+#ifdef TINY_GSM_XBEE_API
+public:
+  // In API mode each client has a socket of the XBee's own, and its data
+  // comes in frames of its own, into rx
+  virtual int connect(const char *host, uint16_t port, int timeout_s) {
+    stop();
+    TINY_GSM_YIELD();
+    rx.clear();
+    sock_connected = at->modemConnect(host, port, mux, false, timeout_s);
+    return sock_connected;
+  }
+
+TINY_GSM_CLIENT_CONNECT_OVERLOADS()
+
+TINY_GSM_CLIENT_CONNECT_ASYNC_BLOCKING()
+
+  virtual void stop(uint32_t maxWaitMs) {
+    TINY_GSM_YIELD();
+    closeTx();
+    at->apiClose(mux, maxWaitMs);
+    sock_connected = false;
+    rx.clear();
+  }
+
+  virtual void stop() { stop(5000L); }
+
+TINY_GSM_CLIENT_WRITE()
+
+TINY_GSM_CLIENT_AVAILABLE_NO_MODEM_FIFO()
+
+TINY_GSM_CLIENT_READ_NO_MODEM_FIFO()
+
+TINY_GSM_CLIENT_FLUSH_CONNECTED()
+
+#else
 public:
   // NOTE:  The XBee saves all connection information (ssid/pwd or apn AND last used IP address)
   // in flash (NVM).  When you turn it on it immediately prepares to re-connect to whatever was
@@ -101,6 +182,8 @@ public:
   virtual int connect(const char *host, uint16_t port, int timeout_s) {
     // NOTE:  Not caling stop() or yeild() here
     at->streamClear();  // Empty anything in the buffer before starting
+    rx.clear();
+    sock_dropped = 0;
     sock_connected = at->modemConnect(host, port, mux, false, timeout_s);
     return sock_connected;
   }
@@ -114,6 +197,8 @@ public:
     }
     // NOTE:  Not caling stop() or yeild() here
     at->streamClear();  // Empty anything in the buffer before starting
+    rx.clear();
+    sock_dropped = 0;
     sock_connected = at->modemConnect(ip, port, mux, false);
     return sock_connected;
   }
@@ -126,6 +211,7 @@ public:
     // empty the saved currently-in-use destination address
     at->modemStop(maxWaitMs);
     at->streamClear();  // Empty anything in the buffer
+    rx.clear();
     sock_connected = false;
 
     // Note:  because settings are saved in flash, the XBEE will attempt to
@@ -139,7 +225,9 @@ public:
 
   virtual size_t write(const uint8_t *buf, size_t size) {
     TINY_GSM_YIELD();
-    return at->modemSend(buf, size, mux);
+    size_t sent = at->modemSend(buf, size, mux);
+    TINY_GSM_STATS_SOCKET(at, bytesSent, mux, sent);
+    return sent;
   }
 
   virtual size_t write(uint8_t c) {
@@ -151,53 +239,46 @@ public:
     return write((const uint8_t *)str, strlen(str));
   }
 
+  // What comes in outside of command mode is socket data, maintain() moves
+  // it into rx.  Entering command mode does the same first, so nothing that
+  // was on its way is lost.
   virtual int available() {
     TINY_GSM_YIELD();
-    return at->stream.available();
-    /*
     if (!rx.size() || at->stream.available()) {
       at->maintain();
     }
-    return at->stream.available() + rx.size();
-    */
+    return rx.size();
   }
 
+  // Doesn't wait for data, only takes in what has come
   virtual int read(uint8_t *buf, size_t size) {
     TINY_GSM_YIELD();
-    return at->stream.readBytes((char *)buf, size);
-    /*
-    size_t cnt = 0;
-    uint32_t _startMillis = millis();
-    while (cnt < size && millis() - _startMillis < _timeout) {
-      size_t chunk = TinyGsmMin(size-cnt, rx.size());
-      if (chunk > 0) {
-        rx.get(buf, chunk);
-        buf += chunk;
-        cnt += chunk;
-        continue;
-      }
-      // TODO: Read directly into user buffer?
-      if (!rx.size() || at->stream.available()) {
-        at->maintain();
-      }
+    if ((size_t)rx.size() < size) {
+      at->maintain();
     }
+    size_t cnt = rx.get(buf, size);
+    TINY_GSM_STATS_SOCKET(at, bytesReceived, mux, cnt);
     return cnt;
-    */
   }
 
   virtual int read() {
-    TINY_GSM_YIELD();
-    return at->stream.read();
-    /*
     uint8_t c;
     if (read(&c, 1) == 1) {
       return c;
     }
     return -1;
-    */
   }
 
-  virtual int peek() { return at->stream.peek(); }
+  virtual int peek() {
+    uint8_t c;
+    if (!rx.size()) {
+      at->maintain();
+    }
+    if (rx.peek(&c)) {
+      return c;
+    }
+    return -1;
+  }
   virtual void flush() { at->stream.flush(); }
 
   virtual uint8_t connected() {
@@ -214,6 +295,7 @@ public:
     // return at->modemGetConnected();
   }
   virtual operator bool() { return connected(); }
+#endif
 
   /*
    * Extended API
@@ -221,11 +303,28 @@ public:
 
   String remoteIP() TINY_GSM_ATTR_NOT_IMPLEMENTED;
 
+  // Bytes of socket data lost since connecting, because they came in while
+  // going into command mode and rx was full
+  uint32_t rxDropped() {
+    return sock_dropped;
+  }
+
 private:
   TinyGsmXBee*    at;
   uint8_t         mux;
   bool            sock_connected;
-  // RxFifo          rx;
+#ifdef TINY_GSM_XBEE_API
+  uint8_t         sock_id;     // the XBee's number for it, 0xFF for none
+  IPAddress       sock_ip;     // where it goes, with TX IPv4 frames
+  uint16_t        sock_port;
+  uint8_t         sock_proto;
+  TinyGsmConnectState connecting;
+  RxFifo          rx;
+  TinyGsmTxBuffer<TINY_GSM_TX_BUFFER> tx;
+#else
+  RxFifo          rx;
+#endif
+  uint32_t        sock_dropped;
 };
 
 
@@ -241,9 +340,20 @@ public:
   virtual ~GsmClientSecure(){}
 
 public:
+#ifdef TINY_GSM_XBEE_API
+  virtual int connect(const char *host, uint16_t port, int timeout_s) {
+    stop();
+    TINY_GSM_YIELD();
+    rx.clear();
+    sock_connected = at->modemConnect(host, port, mux, true, timeout_s);
+    return sock_connected;
+  }
+#else
   virtual int connect(const char *host, uint16_t port, int timeout_s) {
     // NOTE:  Not caling stop() or yeild() here
     at->streamClear();  // Empty anything in the buffer before starting
+    rx.clear();
+    sock_dropped = 0;
     sock_connected = at->modemConnect(host, port, mux, true, timeout_s);
     return sock_connected;
   }
@@ -254,9 +364,12 @@ public:
     }
     // NOTE:  Not caling stop() or yeild() here
     at->streamClear();  // Empty anything in the buffer before starting
+    rx.clear();
+    sock_dropped = 0;
     sock_connected = at->modemConnect(ip, port, mux, true);
     return sock_connected;
   }
+#endif
 };
 
 
@@ -270,9 +383,16 @@ public:
       resetPin = -1;
       savedIP = IPAddress(0,0,0,0);
       savedHost = "";
-      savedHostIP = IPAddress(0,0,0,0);
       inCommandMode = false;
+      apiMode = false;
+      forgetParams();
       memset(sockets, 0, sizeof(sockets));
+#ifdef TINY_GSM_XBEE_API
+      apiFrameId = 0;
+      apiPending = 0;
+      apiRxTo = NULL;
+      apiRxKept = 0;
+#endif
   }
 
   TinyGsmXBee(Stream& stream, int8_t resetPin)
@@ -283,9 +403,16 @@ public:
       this->resetPin = resetPin;
       savedIP = IPAddress(0,0,0,0);
       savedHost = "";
-      savedHostIP = IPAddress(0,0,0,0);
       inCommandMode = false;
+      apiMode = false;
+      forgetParams();
       memset(sockets, 0, sizeof(sockets));
+#ifdef TINY_GSM_XBEE_API
+      apiFrameId = 0;
+      apiPending = 0;
+      apiRxTo = NULL;
+      apiRxKept = 0;
+#endif
   }
 
   virtual ~TinyGsmXBee() {}
@@ -310,27 +437,35 @@ public:
       DBG("XBee's do not support SIMs that require an unlock pin!");
     }
 
+#ifdef TINY_GSM_XBEE_API
+    // Guard times and command mode only matter until the XBee is in API mode
+    if (!apiStart()) {
+      return false;
+    }
+    getSeries();  // Get the "Hardware Series";
+    return true;
+#else
     XBEE_COMMAND_START_DECORATOR(10, false)
 
-    sendAT(GF("AP0"));  // Put in transparent mode
-    bool ret_val = waitResponse() == 1;
+    bool ret_val = setParam(XBEE_PARAM_AP, "0");  // Put in transparent mode
 
-    sendAT(GF("GT64")); // shorten the guard time to 100ms
-    ret_val &= waitResponse() == 1;
+    ret_val &= setParam(XBEE_PARAM_GT, "64"); // shorten the guard time to 100ms
     if (ret_val) guardTime = 110;
 
    // Make sure the command mode drop-out time is long enough that we won't fall
    // out of command mode without intentionally leaving it.  This is the default
    // drop out time of 0x64 x 100ms (10 seconds)
-    sendAT(GF("CT64"));
-    ret_val &= waitResponse() == 1;
-    ret_val &= writeChanges();
+    ret_val &= setParam(XBEE_PARAM_CT, "64");
+    // A reset must not bring back the 1s guard time
+    ret_val &= saveChanges();
+    ret_val &= applyChanges();
 
     getSeries();  // Get the "Hardware Series";
 
     XBEE_COMMAND_END_DECORATOR
 
     return ret_val;
+#endif
   }
 
   String getModemName() {
@@ -365,6 +500,14 @@ public:
   bool testAT(unsigned long timeout_ms = 10000L) {
     unsigned long start = millis();
     bool success = false;
+    if (apiMode) {  // No command mode to enter, any command will do
+      while (!success && millis() - start < timeout_ms) {
+        sendAT(GF("AI"));
+        success = (waitResponse(200) == 1);
+        if (!success) delay(250);
+      }
+      return success;
+    }
     while (!success && millis() - start < timeout_ms) {
       if (!inCommandMode) {
         success = commandMode();
@@ -384,17 +527,23 @@ public:
   }
 
   void maintain() {
+#ifdef TINY_GSM_XBEE_API
+    if (apiMode) {
+      TINY_GSM_MODEM_SEND_IDLE_TX()
+      apiPoll();
+      return;
+    }
+#endif
     // this only happens OUTSIDE command mode, so if we're getting characters
     // they should be data received from the TCP connection
-    // TINY_GSM_YIELD();
-    // if (!inCommandMode) {
-    //   while (stream.available()) {
-    //     char c = stream.read();
-    //     if (c > 0) sockets[0]->rx.put(c);
-    //   }
-    // }
+    TINY_GSM_YIELD();
+    if (!inCommandMode) {
+      streamCapture(false);
+    }
   }
 
+TINY_GSM_MODEM_STATS()
+
   bool factoryDefault() {
     XBEE_COMMAND_START_DECORATOR(5, false)
     sendAT(GF("RE"));
@@ -404,6 +553,8 @@ public:
     // Make sure the guard time for the modem object is set back to default
     // otherwise communication would fail after the reset
     guardTime = 1010;
+    apiMode = false;  // RE also puts it back in transparent mode
+    forgetParams();
     return ret_val;
   }
 
@@ -453,6 +604,7 @@ public:
       digitalWrite(resetPin, LOW);
       delay(1);
       digitalWrite(resetPin, HIGH);
+      forgetParams();  // whatever wasn't saved is gone
     }
   }
 
@@ -463,28 +615,29 @@ public:
     if (beeType == XBEE_UNKNOWN) getSeries();  // how we restart depends on this
 
     if (beeType != XBEE_S6B_WIFI) {
-      sendAT(GF("AM1"));  // Digi suggests putting cellular modules into airplane mode before restarting
-                          // This allows the sockets and connections to close cleanly
-      if (waitResponse() != 1) return exitAndFail();
+      // Digi suggests putting cellular modules into airplane mode before restarting
+      // This allows the sockets and connections to close cleanly
+      if (!setParam(XBEE_PARAM_AM, "1", 1000L, true)) return exitAndFail();
       if (!writeChanges()) return exitAndFail();
     }
 
     sendAT(GF("FR"));
     if (waitResponse() != 1) return exitAndFail();
     else inCommandMode = false;  // Reset effectively exits command mode
+    forgetParams();  // whatever wasn't saved is gone
 
     if (beeType == XBEE_S6B_WIFI) delay(2000);  // Wifi module actually resets about 2 seconds later
     else delay(100);  // cellular modules wait 100ms before reset happens
 
     // Wait until reboot complete and responds to command mode call again
+    // (or, in API mode, to any command)
     for (unsigned long start = millis(); millis() - start < 60000L; ) {
-      if (commandMode(1)) break;
+      if (apiMode ? testAT(250) : commandMode(1)) break;
       delay(250);  // wait a litle before trying again
     }
 
     if (beeType != XBEE_S6B_WIFI) {
-      sendAT(GF("AM0"));  // Turn off airplane mode
-      if (waitResponse() != 1) return exitAndFail();
+      if (!setParam(XBEE_PARAM_AM, "0")) return exitAndFail();  // Turn off airplane mode
       if (!writeChanges()) return exitAndFail();
     }
 
@@ -616,14 +769,12 @@ public:
             stat = REG_DENIED;
             break;
           case  0x2A:  // 0x2A Airplane mode.
-            sendAT(GF("AM0"));  // Turn off airplane mode
-            waitResponse();
+            setParam(XBEE_PARAM_AM, "0", 1000L, true);  // Turn off airplane mode
             writeChanges();
             stat = REG_UNKNOWN;
             break;
           case 0x2F:  // 0x2F Bypass mode active.
-            sendAT(GF("AP0"));  // Set back to transparent mode
-            waitResponse();
+            setParam(XBEE_PARAM_AP, apiMode ? "1" : "0", 1000L, true);  // Set back to transparent (or API) mode
             writeChanges();
             stat = REG_UNKNOWN;
             break;
@@ -762,6 +913,8 @@ public:
     return TinyGsmIpFromString(getLocalIP());
   }
 
+TINY_GSM_MODEM_DNS()
+
   /*
    * GPRS functions
    */
@@ -775,20 +928,20 @@ public:
       DBG("XBee's do not support SIMs that a user name/password!");
     }
     XBEE_COMMAND_START_DECORATOR(5, false)
-    sendAT(GF("AN"), apn);  // Set the APN
-    bool success = waitResponse() == 1;
-    sendAT(GF("AM0"));  // Airplane mode off
-    waitResponse(5000);
-    writeChanges();
+    bool success = setParam(XBEE_PARAM_AN, apn);  // Set the APN
+    setParam(XBEE_PARAM_AM, "0", 5000L);  // Airplane mode off
+    saveChanges();
+    applyChanges();
     XBEE_COMMAND_END_DECORATOR
     return success;
   }
 
   bool gprsDisconnect() {
     XBEE_COMMAND_START_DECORATOR(5, false)
-    sendAT(GF("AM1"));  // Cheating and disconnecting by turning on airplane mode
-    int8_t res = (1 == waitResponse(5000));
-    writeChanges();
+    // Cheating and disconnecting by turning on airplane mode
+    int8_t res = setParam(XBEE_PARAM_AM, "1", 5000L);
+    saveChanges();
+    applyChanges();
     // sendAT(GF("AM0"));  // Airplane mode off
     // waitResponse(5000);
     // writeChanges();
@@ -807,10 +960,14 @@ public:
   String sendUSSD(const String& code) TINY_GSM_ATTR_NOT_IMPLEMENTED;
 
   bool sendSMS(const String& number, const String& text) {
+#ifdef TINY_GSM_XBEE_API
+    if (apiMode) {
+      return apiSendSMS(number, text);
+    }
+#endif
     if (!commandMode()) return false;  // Return immediately
 
-    sendAT(GF("IP"), 2);  // Put in text messaging mode
-    if (waitResponse() !=1) return exitAndFail();
+    if (!setParam(XBEE_PARAM_IP, "2")) return exitAndFail();  // Put in text messaging mode
     sendAT(GF("PH"), number);  // Set the phone number
     if (waitResponse() !=1) return exitAndFail();
     sendAT(GF("TDD"));  // Set the text delimiter to the standard 0x0D (carriage return)
@@ -892,8 +1049,7 @@ public:
 
     XBEE_COMMAND_START_DECORATOR(5, IPAddress(0, 0, 0, 0))
     sendAT(GF("OD"));
-    strIP = stream.readStringUntil('\r');  // read result
-    strIP.trim();
+    strIP = readResponseString();  // read result
     XBEE_COMMAND_END_DECORATOR
 
     if (strIP != "" && strIP != GF("ERROR")) {
@@ -902,7 +1058,7 @@ public:
       return IPAddress(0, 0, 0, 0);
   }
 
-  IPAddress lookupHostIP(const char* host, int timeout_s = 45) {
+  IPAddress modemLookup(const char* host, uint32_t& /*ttl_s*/, int timeout_s) {
     String strIP;
     strIP.reserve(16);
     unsigned long startMillis = millis();
@@ -914,9 +1070,7 @@ public:
     while ((millis() - startMillis) < timeout_ms)  // the lookup can take a while
     {
       sendAT(GF("LA"), host);
-      while (stream.available() < 4 && (millis() - startMillis < timeout_ms)) {TINY_GSM_YIELD()};
-      strIP = stream.readStringUntil('\r');  // read result
-      strIP.trim();
+      strIP = readResponseString(TinyGsmRemaining(startMillis, timeout_ms));  // read result
       if (strIP != "" && strIP != GF("ERROR")) {
         gotIP = true;
         break;
@@ -935,23 +1089,22 @@ public:
   bool modemConnect(const char* host, uint16_t port, uint8_t mux = 0,
                     bool ssl = false, int timeout_s = 75)
   {
+#ifdef TINY_GSM_XBEE_API
+    if (apiMode) {
+      return apiConnect(host, port, mux, ssl, timeout_s);
+    }
+#endif
     bool retVal = false;
     XBEE_COMMAND_START_DECORATOR(5, false)
 
-    // If this is a new host name, replace the saved host and wipe out the saved host IP
-    if (this->savedHost != String(host)) {
-      this->savedHost = String(host);
-      savedHostIP = IPAddress(0,0,0,0);
-    }
+    savedHost = host;
 
-    // If we don't have a good IP for the host, we need to do a DNS search
-    if (savedHostIP == IPAddress(0,0,0,0)) {
-      savedHostIP = lookupHostIP(host, timeout_s);  // This will return 0.0.0.0 if lookup fails
-    }
+    // Use the cached IP for the host, or do a DNS search if we don't have a good one
+    IPAddress hostIP = resolveHost(host, timeout_s);  // This will return 0.0.0.0 if lookup fails
 
     // If we now have a valid IP address, use it to connect
-    if (savedHostIP != IPAddress(0,0,0,0)) {  // Only re-set connection information if we have an IP address
-      retVal = modemConnect(savedHostIP, port, mux, ssl);
+    if (hostIP != IPAddress(0,0,0,0)) {  // Only re-set connection information if we have an IP address
+      retVal = modemConnect(hostIP, port, mux, ssl);
     }
 
     XBEE_COMMAND_END_DECORATOR
@@ -972,33 +1125,20 @@ public:
 
     XBEE_COMMAND_START_DECORATOR(5, false)
 
-    if (ip != savedIP) {  // Can skip almost everything if there's no
-                          // change in the IP address
-      savedIP = ip;  // Set the newly requested IP address
-      String host; host.reserve(16);
-      host += ip[0];
-      host += ".";
-      host += ip[1];
-      host += ".";
-      host += ip[2];
-      host += ".";
-      host += ip[3];
-
-      if (ssl) {
-        sendAT(GF("IP"), 4);  // Put in SSL over TCP communication mode
-        success &= (1 == waitResponse());
-      } else {
-        sendAT(GF("IP"), 1);  // Put in TCP mode
-        success &= (1 == waitResponse());
-      }
-
-      sendAT(GF("DL"), host);  // Set the "Destination Address Low"
-      success &= (1 == waitResponse());
-      sendAT(GF("DE"), String(port, HEX));  // Set the destination port
-      success &= (1 == waitResponse());
+    savedIP = ip;  // Set the newly requested IP address
+    char host[16];
+    TinyGsmIpToString(ip, host);
 
-      success &= writeChanges();
+    // Only what differs from the last connection is sent, and written
+    if (ssl) {
+      success &= setParam(XBEE_PARAM_IP, "4");  // Put in SSL over TCP communication mode
+    } else {
+      success &= setParam(XBEE_PARAM_IP, "1");  // Put in TCP mode
     }
+    success &= setParam(XBEE_PARAM_DL, host);  // Set the "Destination Address Low"
+    success &= setParam(XBEE_PARAM_DE, String(port, HEX));  // Set the destination port
+    success &= saveChanges();
+    success &= applyChanges();
 
     // we'll accept either unknown or connected
     if (beeType != XBEE_S6B_WIFI) {
@@ -1023,29 +1163,35 @@ public:
     XBEE_COMMAND_START_DECORATOR(5, false)
 
     // Get the current socket timeout
-    sendAT(GF("TM"));
-    String timeoutUsed = readResponseString(5000L);
+    String timeoutUsed = getParam(XBEE_PARAM_TM, 5000L);
 
     // For WiFi models, there's no direct way to close the socket.  This is a
-    // hack to shut the socket by setting the timeout to zero.
+    // hack to shut the socket by setting the timeout to zero.  That's only
+    // applied, the timeout in flash stays as it was.
     if (beeType == XBEE_S6B_WIFI) {
       sendAT(GF("TM0"));  // Set socket timeout to 0
       waitResponse(maxWaitMs);  // This response can be slow
-      writeChanges();
+      paramsUnapplied = true;
+      applyChanges();
     }
 
     // For cellular models, per documentation: If you write the TM (socket
     // timeout) value while in Transparent Mode, the current connection is
     // immediately closed - this works even if the TM values is unchanged
-    sendAT(GF("TM"), timeoutUsed);  // Re-set socket timeout
-    waitResponse(maxWaitMs);  // This response can be slow
-    writeChanges();
+    setParam(XBEE_PARAM_TM, timeoutUsed, maxWaitMs, true);  // Re-set socket timeout
+    saveChanges();
+    applyChanges();
 
     XBEE_COMMAND_END_DECORATOR
     return true;
   }
 
   int16_t modemSend(const void* buff, size_t len, uint8_t mux = 0) {
+#ifdef TINY_GSM_XBEE_API
+    if (apiMode) {
+      return apiSend(buff, len, mux);
+    }
+#endif
     if (mux != 0) {
       DBG("XBee only supports 1 IP channel in transparent mode!");
     }
@@ -1172,10 +1318,8 @@ public:
           // we force close so it can reopen
           case 0x21 :
           case 0x27 : {
-            sendAT(GF("TM"));  // Get socket timeout
-            String timeoutUsed = readResponseString(5000L);
-            sendAT(GF("TM"), timeoutUsed);  // Re-set socket timeout
-            waitResponse(5000L);  // This response can be slow
+            String timeoutUsed = getParam(XBEE_PARAM_TM, 5000L);  // Get socket timeout
+            setParam(XBEE_PARAM_TM, timeoutUsed, 5000L, true);  // Re-set socket timeout
           }
 
           // 0x02 = Invalid parameters (bad IP/host)
@@ -1186,6 +1330,7 @@ public:
           case 0x12:
           case 0x25: {
             savedIP = IPAddress(0, 0, 0, 0);  // force a lookup next time!
+            dns_cache.forget(savedHost.c_str());
           }
 
           // If it's anything else (inc 0x02, 0x12, and 0x25)...
@@ -1201,6 +1346,298 @@ public:
     }
   }
 
+#ifdef TINY_GSM_XBEE_API
+  /*
+   * API mode
+   */
+
+  // Puts the XBee in API mode (AP1).  That takes command mode, and its guard
+  // times, this once; an XBee that's already in API mode won't answer "+++",
+  // so then it's just asked in a frame.
+  bool apiStart() {
+    if (apiMode) {
+      return testAT(1000);
+    }
+    // Usually the bee is still in API mode from the last start, which an
+    // AT frame shows without waiting out any guard times
+    apiMode = true;
+    if (testAT(1000)) {
+      return true;
+    }
+    apiMode = false;
+    if (!commandMode(2)) {
+      return false;
+    }
+    bool ok = setParam(XBEE_PARAM_AP, "1", 1000L, true);  // API mode, without escapes
+    ok &= writeChanges();
+    exitCommand();
+    if (!ok) {
+      return false;
+    }
+    apiMode = true;
+    if (testAT(1000)) {
+      return true;
+    }
+    apiMode = false;
+    return false;
+  }
+
+  uint8_t apiNextId() {
+    if (++apiFrameId == 0) apiFrameId = 1;  // 0 would mean "no response"
+    return apiFrameId;
+  }
+
+  // The XBee3 cellular bees have sockets of their own, which take a host
+  // name.  The others (and the Wi-Fi bee) only send to an IP address and
+  // port, and receive with the source's address and port.
+  bool apiExtendedSockets() {
+    return beeType == XBEE3_LTE1_ATT || beeType == XBEE3_LTEM_ATT;
+  }
+
+  // The client whose data the frame being read is
+  GsmClient* apiSocketFor() {
+    const uint8_t* d = apiReader.data();
+    for (int mux = 0; mux < TINY_GSM_MUX_COUNT; mux++) {
+      GsmClient* sock = sockets[mux];
+      if (!sock) continue;
+      if (apiReader.type() == XBEE_FRAME_SOCKET_RECEIVE) {
+        if (sock->sock_id == d[1]) return sock;  // frame id, socket id
+      } else if (sock->sock_ip == IPAddress(d[0], d[1], d[2], d[3]) &&
+                 sock->sock_port == (((uint16_t)d[6] << 8) | d[7])) {
+        return sock;  // source address, destination port, source port
+      }
+    }
+    return NULL;
+  }
+
+  // Reads the frames that have come in, putting socket data straight into
+  // the clients' fifos.  Returns true (and stops) once a frame of the given
+  // type, for the given frame or socket id, is in apiReader.
+  // A socket data frame is only read once its client's fifo has room for
+  // all of it; until then the rest stays in the UART, and the XBee holds
+  // back more (with hardware flow control), so nothing is lost but frames
+  // behind it wait as well.
+  bool apiPoll(uint8_t type = 0, uint8_t id = 0) {
+    while (stream.available() > 0) {
+      if (apiReader.inPayload() && apiReader.payload() == 0) {
+        GsmClient* sock = apiSocketFor();
+        if (sock && sock->rx.free() < (int)apiReader.payloadLength()) {
+          return false;
+        }
+        apiRxTo = sock ? &sock->rx : NULL;
+        apiRxKept = 0;
+      }
+      int a = stream.read();
+      if (a < 0) break;
+      switch (apiReader.feed(a)) {
+      case TinyGsmXBeeFrameReader::XBEE_FEED_PAYLOAD:
+        if (apiRxTo && apiRxTo->putAt(a, apiRxKept)) {
+          apiRxKept++;
+        }
+        break;
+      case TinyGsmXBeeFrameReader::XBEE_FEED_FRAME: {
+        const uint8_t* d = apiReader.data();
+        switch (apiReader.type()) {
+        case XBEE_FRAME_SOCKET_RECEIVE:
+        case XBEE_FRAME_RX_IPV4:
+          if (apiRxTo) {
+            apiRxTo->commitWrite(apiRxKept);
+          }
+          if (apiRxKept < (int)apiReader.payload()) {
+            DBG("### Socket data dropped:", apiReader.payload() - apiRxKept);
+          }
+          break;
+        case XBEE_FRAME_SOCKET_STATUS:  // socket id, status
+          if (d[1] != 0) {
+            for (int mux = 0; mux < TINY_GSM_MUX_COUNT; mux++) {
+              if (sockets[mux] && sockets[mux]->sock_id == d[0]) {
+                sockets[mux]->sock_connected = false;
+                sockets[mux]->sock_id = 0xFF;
+              }
+            }
+          }
+          break;
+        case XBEE_FRAME_MODEM_STATUS:
+          DBG("### Modem status:", d[0]);
+          break;
+        }
+        apiRxTo = NULL;
+        apiRxKept = 0;
+        if (type && apiReader.type() == type && apiReader.length() && d[0] == id) {
+          return true;
+        }
+        break;
+      }
+      case TinyGsmXBeeFrameReader::XBEE_FEED_BAD:
+        DBG("### Bad frame checksum");
+        apiRxTo = NULL;
+        apiRxKept = 0;
+        break;
+      default:
+        break;
+      }
+    }
+    return false;
+  }
+
+  bool apiWait(uint8_t type, uint8_t id, uint32_t timeout_ms) {
+    unsigned long startMillis = millis();
+    do {
+      if (apiPoll(type, id)) {
+        return true;
+      }
+      TINY_GSM_YIELD_FOR(TinyGsmRemaining(startMillis, timeout_ms), TINY_GSM_WAIT_RESPONSE);
+    } while (millis() - startMillis < timeout_ms);
+    return false;
+  }
+
+  // Waits for the response to the last sendAT(), 1 for OK, 2 for ERROR;
+  // data gets the value as command mode would have printed it
+  uint8_t apiWaitAT(uint32_t timeout_ms, String* data) {
+    if (!apiPending) {
+      return 2;  // the command wasn't sent
+    }
+    if (!apiWait(XBEE_FRAME_AT_RESPONSE, apiPending, timeout_ms)) {
+      DBG("### NO RESPONSE FROM MODEM!\r\n");
+      return 0;
+    }
+    const uint8_t* d = apiReader.data();  // frame id, command, status, value
+    if (apiReader.length() < 4 || d[3] != 0) {
+      return 2;
+    }
+    if (data) {
+      TinyGsmXBeeAtFrame::responseText(apiCmd, d + 4, apiReader.length() - 4, *data);
+    }
+    return 1;
+  }
+
+  bool apiConnect(const char* host, uint16_t port, uint8_t mux, bool ssl,
+                  int timeout_s) {
+    GsmClient* sock = sockets[mux];
+    uint8_t    proto = ssl ? 4 : 1;  // TLS or TCP
+    if (beeType == XBEE_UNKNOWN) getSeries();
+
+    if (!apiExtendedSockets()) {
+      // Every TX IPv4 frame carries the destination, the XBee opens the
+      // connection when the first one goes out
+      IPAddress ip = TinyGsmIsIp(host) ? TinyGsmIpFromString(host)
+                                       : resolveHost(host, timeout_s);
+      if (ip == IPAddress(0, 0, 0, 0)) return false;
+      sock->sock_ip    = ip;
+      sock->sock_port  = port;
+      sock->sock_proto = proto;
+      return true;
+    }
+
+    uint32_t timeout_ms = ((uint32_t)timeout_s) * 1000;
+    unsigned long startMillis = millis();
+    uint8_t create[3] = { XBEE_FRAME_SOCKET_CREATE, apiNextId(), proto };
+    TinyGsmXBeeSendFrame(stream, create, sizeof(create));
+    // frame id, socket id, status
+    if (!apiWait(XBEE_FRAME_SOCKET_CREATED, create[1], 5000L) ||
+        apiReader.data()[2] != 0) {
+      return false;
+    }
+    sock->sock_id = apiReader.data()[1];
+
+    // The XBee looks the host up itself (address type 1, a name)
+    uint8_t connect[6] = { XBEE_FRAME_SOCKET_CONNECT, apiNextId(),
+                           sock->sock_id, (uint8_t)(port >> 8), (uint8_t)port, 1 };
+    TinyGsmXBeeSendFrame(stream, connect, sizeof(connect),
+                         (const uint8_t*)host, strlen(host));
+    bool ok = apiWait(XBEE_FRAME_SOCKET_CONNECT_RESPONSE, connect[1], 5000L) &&
+              apiReader.data()[2] == 0;
+    // Then the socket status says whether it did connect
+    ok = ok && apiWait(XBEE_FRAME_SOCKET_STATUS, sock->sock_id,
+                       TinyGsmRemaining(startMillis, timeout_ms)) &&
+         apiReader.data()[1] == 0;
+    if (!ok) {
+      apiClose(mux, 5000L);
+    }
+    return ok;
+  }
+
+  void apiClose(uint8_t mux, uint32_t maxWaitMs) {
+    GsmClient* sock = sockets[mux];
+    if (!apiMode) return;
+    if (sock->sock_id != 0xFF) {
+      uint8_t frame[3] = { XBEE_FRAME_SOCKET_CLOSE, apiNextId(), sock->sock_id };
+      TinyGsmXBeeSendFrame(stream, frame, sizeof(frame));
+      apiWait(XBEE_FRAME_SOCKET_CLOSED, frame[1], maxWaitMs);
+      sock->sock_id = 0xFF;
+    } else if (sock->sock_ip != IPAddress(0, 0, 0, 0)) {
+      if (sock->sock_connected) {
+        // Nothing to send, but option 0x02: close the connection after it
+        uint8_t frame[12];
+        apiIPv4Header(frame, sock, 0x02);
+        TinyGsmXBeeSendFrame(stream, frame, sizeof(frame));
+        apiWait(XBEE_FRAME_TX_STATUS, frame[1], maxWaitMs);
+      }
+      sock->sock_ip = IPAddress(0, 0, 0, 0);
+    }
+  }
+
+  // Type, frame id, destination address and port, source port, protocol,
+  // transmit options
+  void apiIPv4Header(uint8_t frame[12], GsmClient* sock, uint8_t options) {
+    frame[0]  = XBEE_FRAME_TX_IPV4;
+    frame[1]  = apiNextId();
+    for (uint8_t i = 0; i < 4; i++) {
+      frame[2 + i] = sock->sock_ip[i];
+    }
+    frame[6]  = sock->sock_port >> 8;
+    frame[7]  = sock->sock_port;
+    frame[8]  = 0;  // any source port
+    frame[9]  = 0;
+    frame[10] = sock->sock_proto;
+    frame[11] = options;
+  }
+
+  int16_t apiSend(const void* buff, size_t len, uint8_t mux) {
+    GsmClient* sock = sockets[mux];
+    const uint8_t* data = (const uint8_t*)buff;
+    size_t sent = 0;
+    while (sent < len) {
+      size_t  n = TinyGsmMin(len - sent, (size_t)TINY_GSM_XBEE_MAX_PAYLOAD);
+      uint8_t head[12];
+      size_t  head_len = 4;
+      if (sock->sock_id != 0xFF) {
+        head[0] = XBEE_FRAME_SOCKET_SEND;
+        head[1] = apiNextId();
+        head[2] = sock->sock_id;
+        head[3] = 0;
+      } else if (sock->sock_ip != IPAddress(0, 0, 0, 0)) {
+        apiIPv4Header(head, sock, 0);
+        head_len = sizeof(head);
+      } else {
+        sock->sock_connected = false;
+        break;
+      }
+      TinyGsmXBeeSendFrame(stream, head, head_len, data + sent, n);
+      // frame id, delivery status
+      if (!apiWait(XBEE_FRAME_TX_STATUS, head[1], 10000L) ||
+          apiReader.data()[1] != 0) {
+        sock->sock_connected = false;
+        break;
+      }
+      sent += n;
+    }
+    return sent;
+  }
+
+  bool apiSendSMS(const String& number, const String& text) {
+    // Type, frame id, options, the number in 20 bytes padded with zeros
+    uint8_t head[23] = { XBEE_FRAME_TX_SMS, apiNextId(), 0 };
+    for (unsigned int i = 0; i < 20 && i < number.length(); i++) {
+      head[3 + i] = number[i];
+    }
+    TinyGsmXBeeSendFrame(stream, head, sizeof(head),
+                         (const uint8_t*)text.c_str(), text.length());
+    return apiWait(XBEE_FRAME_TX_STATUS, head[1], 60000L) &&
+           apiReader.data()[1] == 0;
+  }
+#endif
+
 public:
 
   /*
@@ -1214,78 +1651,65 @@ public:
     }
   }
 
-TINY_GSM_MODEM_STREAM_UTILITIES()
+  // Moves what's on the stream into the socket's fifo, if the socket is
+  // open; otherwise, with all, it's thrown away.  Socket data that doesn't
+  // fit in the fifo stays on the stream, then it returns false.
+  bool streamCapture(bool all) {
+    GsmClient* sock = sockets[0];
+    if (!sock || !sock->sock_connected) {
+      if (all) streamClear();
+      return true;
+    }
+    while (stream.available() > 0 && sock->rx.free()) {
+      sock->rx.put(stream.read());
+    }
+    return stream.available() <= 0;
+  }
+
+TINY_GSM_MODEM_STREAM_WRITE()
+
+  void streamPrint(Print&) {}
+
+  // In API mode the same command goes out as a local AT command frame, and
+  // its response comes back as a frame as well
+  template<typename... Args>
+  void sendAT(Args... cmd) {
+#ifdef TINY_GSM_XBEE_API
+    if (apiMode) {
+      TinyGsmXBeeAtFrame frame;
+      streamPrint(frame, cmd...);
+      apiPending = apiNextId();
+      apiCmd[0] = frame.command()[0];
+      apiCmd[1] = frame.command()[1];
+      if (!frame.send(stream, apiPending)) {
+        DBG("### AT command too long:", cmd...);
+        apiPending = 0;  // answered with ERROR right away
+      }
+      TINY_GSM_STATS_COMMAND(cmd...);
+      TINY_GSM_YIELD();
+      return;
+    }
+#endif
+    streamWrite("AT", cmd..., GSM_NL);
+    stream.flush();
+    TINY_GSM_STATS_COMMAND(cmd...);
+    TINY_GSM_YIELD();
+    /* DBG("### AT:", cmd...); */
+  }
 
-  // TODO: Optimize this!
-  // NOTE:  This function is used while INSIDE command mode, so we're only
-  // waiting for requested responses.  The XBee has no unsoliliced responses
-  // (URC's) when in command mode.
   uint8_t waitResponse(uint32_t timeout_ms, String& data,
                        GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
                        GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
   {
-    /*String r1s(r1); r1s.trim();
-    String r2s(r2); r2s.trim();
-    String r3s(r3); r3s.trim();
-    String r4s(r4); r4s.trim();
-    String r5s(r5); r5s.trim();
-    DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
-    data.reserve(16);  // Should never be getting much here for the XBee
-    int8_t index = 0;
-    unsigned long startMillis = millis();
-    do {
-      TINY_GSM_YIELD();
-      while (stream.available() > 0) {
-        TINY_GSM_YIELD();
-        int a = stream.read();
-        if (a <= 0) continue; // Skip 0x00 bytes, just in case
-        data += (char)a;
-        if (r1 && data.endsWith(r1)) {
-          index = 1;
-          goto finish;
-        } else if (r2 && data.endsWith(r2)) {
-          index = 2;
-          goto finish;
-        } else if (r3 && data.endsWith(r3)) {
-          index = 3;
-          goto finish;
-        } else if (r4 && data.endsWith(r4)) {
-          index = 4;
-          goto finish;
-        } else if (r5 && data.endsWith(r5)) {
-          index = 5;
-          goto finish;
-        }
-      }
-    } while (millis() - startMillis < timeout_ms);
-finish:
-    if (!index) {
-      data.trim();
-      data.replace(GSM_NL GSM_NL, GSM_NL);
-      data.replace(GSM_NL, "\r\n    ");
-      if (data.length()) {
-        DBG("### Unhandled:", data, "\r\n");
-      } else {
-        DBG("### NO RESPONSE FROM MODEM!\r\n");
-      }
-    } else {
-      data.trim();
-      data.replace(GSM_NL GSM_NL, GSM_NL);
-      data.replace(GSM_NL, "\r\n    ");
-      if (data.length()) {
-      }
-    }
-    //data.replace(GSM_NL, "/");
-    //DBG('<', index, '>', data);
-    return index;
+    data.reserve(16);
+    return waitResponseImpl(timeout_ms, &data, r1, r2, r3, r4, r5);
   }
 
   uint8_t waitResponse(uint32_t timeout_ms,
                        GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
                        GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
   {
-    String data;
-    return waitResponse(timeout_ms, data, r1, r2, r3, r4, r5);
+    return waitResponseImpl(timeout_ms, NULL, r1, r2, r3, r4, r5);
   }
 
   uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
@@ -1296,20 +1720,32 @@ finish:
 
   bool commandMode(uint8_t retries = 5) {
 
+    // In API mode commands go in frames, there's no mode to switch to
+    if (apiMode) {
+      inCommandMode = true;
+      return true;
+    }
+
     // If we're already in command mode, move on
     if (inCommandMode && (millis() - lastCommandModeMillis) < 10000L) return true;
 
     uint8_t triesMade = 0;
     uint8_t triesUntilReset = 4;  // only reset after 4 failures
     bool success = false;
-    streamClear();  // Empty everything in the buffer before starting
+    // Keep the socket data that's already here, anything else is left over
+    // from earlier commands.  While it doesn't fit, commands wait.
+    if (!streamCapture(true)) {
+      DBG("### Socket rx full, not entering command mode");
+      return false;
+    }
 
     while (!success and triesMade < retries) {
       // Cannot send anything for 1 "guard time" before entering command mode
       // Default guard time is 1s, but the init fxn decreases it to 100 ms
       delay(guardTime + 10);
       streamWrite(GF("+++"));  // enter command mode
-      int res = waitResponse(guardTime*2);
+      // Data can still be arriving until the XBee answers
+      int res = waitCommandMode(guardTime*2);
       success = (1 == res);
       if (0 == res) {
         triesUntilReset--;
@@ -1333,12 +1769,90 @@ finish:
   bool writeChanges(void) {
     sendAT(GF("WR"));  // Write changes to flash
     if (1 != waitResponse()) return false;
+    paramsUnsaved = false;
+    sendAT(GF("AC"));  // Apply changes
+    if (1 != waitResponse()) return false;
+    paramsUnapplied = false;
+    return true;
+  }
+
+  // Writes the parameters set since the last time to flash, if there are
+  // any, so they survive a reset.
+  bool saveChanges(void) {
+    if (!paramsUnsaved) return true;
+    XBEE_COMMAND_START_DECORATOR(5, false)
+    sendAT(GF("WR"));  // Write changes to flash
+    bool ret_val = (1 == waitResponse());
+    if (ret_val) paramsUnsaved = false;
+    XBEE_COMMAND_END_DECORATOR
+    return ret_val;
+  }
+
+  // Applies the parameters set since the last time, if there are any.
+  // Frames in API mode apply theirs right away.
+  bool applyChanges(void) {
+    if (!paramsUnapplied || apiMode) {
+      paramsUnapplied = false;
+      return true;
+    }
     sendAT(GF("AC"));  // Apply changes
     if (1 != waitResponse()) return false;
+    paramsUnapplied = false;
     return true;
   }
 
+  // The value of a parameter, from the shadow if it's there
+  String getParam(XBeeParam param, uint32_t timeout_ms = 1000) {
+    if (paramsKnown & (1 << param)) {
+      return params[param];
+    }
+    char cmd[3];
+    paramName(param, cmd);
+    sendAT(cmd);
+    String res = readResponseString(timeout_ms);
+    if (res != "" && res != GF("ERROR")) {
+      params[param] = res;
+      paramsKnown |= (1 << param);
+    }
+    return res;
+  }
+
+  // Sets a parameter, unless the shadow says the XBee has that value
+  // already, or with force in any case.  It still needs applyChanges(), and
+  // saveChanges() to keep it.
+  bool setParam(XBeeParam param, const String& value,
+                uint32_t timeout_ms = 1000, bool force = false) {
+    bool same = (paramsKnown & (1 << param)) &&
+                params[param].equalsIgnoreCase(value);
+    if (same && !force) {
+      return true;
+    }
+    char cmd[3];
+    paramName(param, cmd);
+    sendAT(cmd, value);
+    if (1 != waitResponse(timeout_ms)) {
+      paramsKnown &= ~(1 << param);
+      return false;
+    }
+    params[param] = value;
+    paramsKnown |= (1 << param);
+    paramsUnapplied = true;
+    if (!same) paramsUnsaved = true;
+    return true;
+  }
+
+  // Forgets the shadowed values, i.e. after a reset
+  void forgetParams(void) {
+    paramsKnown = 0;
+    paramsUnapplied = false;
+    paramsUnsaved = false;
+  }
+
   void exitCommand(void) {
+    if (apiMode) {
+      inCommandMode = false;
+      return;
+    }
     // NOTE:  Here we explicitely try to exit command mode
     // even if the internal flag inCommandMode was already false
     sendAT(GF("CN"));  // Exit command mode
@@ -1346,6 +1860,53 @@ finish:
     inCommandMode = false;
   }
 
+  // Waits for the "OK\r" that answers "+++".  Peeking a byte at a time, so
+  // only an "OK\r" is taken for the answer; any socket data that comes first
+  // goes into the socket's fifo, or is counted in rxDropped() if it's full.
+  uint8_t waitCommandMode(uint32_t timeout_ms) {
+    static const char ok[] = "OK" GSM_NL;
+    GsmClient* sock = sockets[0];
+    bool keep = sock && sock->sock_connected;
+    uint8_t matched = 0;
+    uint8_t index = 0;
+    size_t dropped = 0;
+    unsigned long startMillis = millis();
+    while (millis() - startMillis < timeout_ms) {
+      if (stream.available() <= 0) {
+        TINY_GSM_YIELD_FOR(TinyGsmRemaining(startMillis, timeout_ms), TINY_GSM_WAIT_RESPONSE);
+        continue;
+      }
+      int c = stream.peek();
+      if (c == ok[matched]) {
+        stream.read();
+        if (++matched == 3) {
+          index = 1;
+          break;
+        }
+        continue;
+      }
+      // Not the answer after all: what looked like it was data, and so is
+      // c, unless it starts the answer over
+      for (uint8_t i = 0; i < matched; i++) {
+        if (keep && !sock->rx.put(ok[i])) dropped++;
+      }
+      if (matched == 0) {
+        stream.read();
+        if (keep && !sock->rx.put(c)) dropped++;
+      }
+      matched = 0;
+    }
+    if (dropped) {
+      sock->sock_dropped += dropped;
+      DBG("### Socket data dropped:", dropped);
+    }
+    TINY_GSM_STATS_RESPONSE(index);
+    if (!index) {
+      DBG("### NO RESPONSE FROM MODEM!\r\n");
+    }
+    return index;
+  }
+
   bool exitAndFail(void) {
     exitCommand();  // Exit command mode
     return false;
@@ -1359,9 +1920,18 @@ finish:
   }
 
   String readResponseString(uint32_t timeout_ms = 1000) {
+#ifdef TINY_GSM_XBEE_API
+    if (apiMode) {
+      String res;
+      if (apiWaitAT(timeout_ms, &res) == 2) res = GF("ERROR");
+      return res;
+    }
+#endif
     TINY_GSM_YIELD();
     unsigned long startMillis = millis();
-    while (!stream.available() && millis() - startMillis < timeout_ms) {};
+    while (!stream.available() && millis() - startMillis < timeout_ms) {
+      TINY_GSM_YIELD_FOR(TinyGsmRemaining(startMillis, timeout_ms), TINY_GSM_WAIT_RESPONSE);
+    }
     String res = stream.readStringUntil('\r');  // lines end with carriage returns
     res.trim();
     return res;
@@ -1384,11 +1954,90 @@ finish:
     return res;
   }
 
+  static void paramName(XBeeParam param, char cmd[3]) {
+    cmd[0] = TINY_GSM_PGM_BYTE(&XBEE_PARAM_NAMES[2 * param]);
+    cmd[1] = TINY_GSM_PGM_BYTE(&XBEE_PARAM_NAMES[2 * param + 1]);
+    cmd[2] = '\0';
+  }
+
   bool gotIPforSavedHost() {
-    if (savedHost != "" && savedHostIP != IPAddress(0,0,0,0)) return true;
+    IPAddress ip;
+    if (savedHost != "" && dns_cache.lookup(savedHost.c_str(), ip)) return true;
     else return false;
   }
 
+protected:
+
+  // Collects the response into data only if the caller asked for it
+  // NOTE:  This function is used while INSIDE command mode, so we're only
+  // waiting for requested responses.  The XBee has no unsoliliced responses
+  // (URC's) when in command mode.
+  uint8_t waitResponseImpl(uint32_t timeout_ms, String* data,
+                           GsmConstStr r1, GsmConstStr r2, GsmConstStr r3,
+                           GsmConstStr r4, GsmConstStr r5)
+  {
+    TINY_GSM_WAIT_RESPONSE_HOOK();
+    TinyGsmMatcher<5> match;
+    match.add(r1);
+    match.add(r2);
+    match.add(r3);
+    match.add(r4);
+    match.add(r5);
+    uint8_t index = 0;
+#ifdef TINY_GSM_XBEE_API
+    // An AT response frame is matched as its value (if it has one) then
+    // "OK" or "ERROR", each on a line of its own
+    if (apiMode) {
+      String text;
+      uint8_t status = apiWaitAT(timeout_ms, &text);
+      if (status) {
+        if (text.length()) text += GSM_NL;
+        text += (status == 1) ? GF("OK" GSM_NL) : GF("ERROR" GSM_NL);
+        for (unsigned i = 0; i < text.length() && !index; i++) {
+          index = match.feed(text[i]);
+        }
+      }
+      TINY_GSM_STATS_RESPONSE(index);
+      if (data) {
+        *data = text;
+        data->trim();
+      }
+      return index;
+    }
+#endif
+    unsigned long startMillis = millis();
+    do {
+      TINY_GSM_YIELD_FOR(TinyGsmRemaining(startMillis, timeout_ms), match.reason());
+      while (stream.available() > 0) {
+        TINY_GSM_YIELD();
+        int a = stream.read();
+        if (a <= 0) continue; // Skip 0x00 bytes, just in case
+        if (data) *data += (char)a;
+        index = match.feed(a);
+        if (index) {
+          goto finish;
+        }
+      }
+    } while (millis() - startMillis < timeout_ms);
+finish:
+    TINY_GSM_STATS_RESPONSE(index);
+    if (data) {
+      data->trim();
+      data->replace(GSM_NL GSM_NL, GSM_NL);
+      data->replace(GSM_NL, "\r\n    ");
+    }
+    if (!index) {
+      if (data && data->length()) {
+        DBG("### Unhandled:", *data, "\r\n");
+      } else if (!data && match.lineLength()) {
+        DBG("### Unhandled:", match.line(), "\r\n");
+      } else {
+        DBG("### NO RESPONSE FROM MODEM!\r\n");
+      }
+    }
+    return index;
+  }
+
 public:
   Stream&       stream;
 
@@ -1398,11 +2047,27 @@ protected:
   XBeeType      beeType;
   IPAddress     savedIP;
   String        savedHost;
-  IPAddress     savedHostIP;
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE> dns_cache;
   IPAddress     savedOperatingIP;
   bool          inCommandMode;
   uint32_t      lastCommandModeMillis;
+  bool          apiMode;
+  String        params[XBEE_PARAM_COUNT];  // what the XBee has, as far as we know
+  uint16_t      paramsKnown;
+  bool          paramsUnapplied;
+  bool          paramsUnsaved;
   GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+#ifdef TINY_GSM_XBEE_API
+  uint8_t       apiFrameId;
+  uint8_t       apiPending;  // frame id of the AT command sent last
+  char          apiCmd[2];
+  TinyGsmXBeeFrameReader apiReader;
+  GsmClient::RxFifo* apiRxTo;  // where the payload being read goes
+  int           apiRxKept;
+#endif
+#ifdef TINY_GSM_STATS
+  TinyGsmStats  stats;
+#endif
 };
 
 #endif
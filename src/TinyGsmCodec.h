@@ -0,0 +1,506 @@
+/**
+ * @file       TinyGsmCodec.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef TinyGsmCodec_h
+#define TinyGsmCodec_h
+
+// Text codecs for SMS and USSD: hex, GSM 7 bit default alphabet
+// (3GPP TS 23.038) and UCS-2 / UTF-16, to and from UTF-8.
+//
+// Everything works on caller's buffers, or writes into a Print, so nothing
+// here touches the heap.  Included by TinyGsmCommon.h.
+
+#if defined(__AVR__)
+  #define TINY_GSM_PGM_BYTE(p) pgm_read_byte(p)
+  #define TINY_GSM_PGM_WORD(p) pgm_read_word(p)
+#else
+  #define TINY_GSM_PGM_BYTE(p) (*(p))
+  #define TINY_GSM_PGM_WORD(p) (*(p))
+#endif
+
+/*
+ * Hex
+ */
+
+// Value of each hex digit, 0xFF for anything that isn't one
+#define TINY_GSM_HEX_NONE_16 \
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, \
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+static const uint8_t TinyGsmHexNibbles[256] TINY_GSM_PROGMEM = {
+  TINY_GSM_HEX_NONE_16,
+  TINY_GSM_HEX_NONE_16,
+  TINY_GSM_HEX_NONE_16,
+     0,    1,    2,    3,    4,    5,    6,    7,    // '0' to '9'
+     8,    9, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF,   10,   11,   12,   13,   14,   15, 0xFF,    // 'A' to 'F'
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  TINY_GSM_HEX_NONE_16,
+  0xFF,   10,   11,   12,   13,   14,   15, 0xFF,    // 'a' to 'f'
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  TINY_GSM_HEX_NONE_16,
+  TINY_GSM_HEX_NONE_16,
+  TINY_GSM_HEX_NONE_16,
+  TINY_GSM_HEX_NONE_16,
+  TINY_GSM_HEX_NONE_16,
+  TINY_GSM_HEX_NONE_16,
+  TINY_GSM_HEX_NONE_16,
+  TINY_GSM_HEX_NONE_16,
+  TINY_GSM_HEX_NONE_16
+};
+#undef TINY_GSM_HEX_NONE_16
+
+static const char TinyGsmHexDigits[16] TINY_GSM_PROGMEM = {
+  '0', '1', '2', '3', '4', '5', '6', '7',
+  '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'
+};
+
+static inline
+uint8_t TinyGsmHexNibble(char c) {
+  return TINY_GSM_PGM_BYTE(&TinyGsmHexNibbles[(uint8_t)c]);
+}
+
+// Decodes n bytes from 2*n hex digits.  Returns the number of bytes with a
+// digit that isn't one, those are still written (as garbage).
+// out may be the same buffer as hex.
+static inline
+size_t TinyGsmDecodeHex(const char* hex, uint8_t* out, size_t n) {
+  size_t bad = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint8_t hi = TinyGsmHexNibble(hex[2*i]);
+    uint8_t lo = TinyGsmHexNibble(hex[2*i+1]);
+    bad += (hi | lo) >> 7;
+    out[i] = (hi << 4) | (lo & 0x0F);
+  }
+  return bad;
+}
+
+// Encodes n bytes as 2*n upper case hex digits (not terminated)
+static inline
+void TinyGsmEncodeHex(const uint8_t* in, size_t n, char* hex) {
+  for (size_t i = 0; i < n; i++) {
+    hex[2*i]   = TINY_GSM_PGM_BYTE(&TinyGsmHexDigits[in[i] >> 4]);
+    hex[2*i+1] = TINY_GSM_PGM_BYTE(&TinyGsmHexDigits[in[i] & 0x0F]);
+  }
+}
+
+// Writes n bytes as hex digits, a few dozen at a time
+static inline
+size_t TinyGsmPrintHex(Print& out, const uint8_t* in, size_t n) {
+  char   hex[32];
+  size_t written = 0;
+  while (n > 0) {
+    size_t chunk = TinyGsmMin(n, sizeof(hex) / 2);
+    TinyGsmEncodeHex(in, chunk, hex);
+    written += out.write((const uint8_t*)hex, chunk * 2);
+    in += chunk;
+    n  -= chunk;
+  }
+  return written;
+}
+
+// Writes len UTF-16 code units (in native byte order) as big endian hex,
+// the way the modems take UCS-2 text with +CSCS="HEX"
+static inline
+size_t TinyGsmPrintHexUcs2(Print& out, const uint16_t* in, size_t len) {
+  uint8_t be[16];
+  size_t  written = 0;
+  while (len > 0) {
+    size_t chunk = TinyGsmMin(len, sizeof(be) / 2);
+    for (size_t i = 0; i < chunk; i++) {
+      be[2*i]   = in[i] >> 8;
+      be[2*i+1] = in[i] & 0xFF;
+    }
+    written += TinyGsmPrintHex(out, be, chunk * 2);
+    in  += chunk;
+    len -= chunk;
+  }
+  return written;
+}
+
+/*
+ * UTF-8
+ */
+
+#define TINY_GSM_REPLACEMENT_CHAR 0xFFFD
+
+// Writes one code point as UTF-8
+static inline
+size_t TinyGsmPrintUtf8(Print& out, uint32_t cp) {
+  uint8_t buf[4];
+  size_t  n;
+  if (cp < 0x80) {
+    return out.write((uint8_t)cp);
+  } else if (cp < 0x800) {
+    buf[0] = 0xC0 | (cp >> 6);
+    n = 2;
+  } else if (cp < 0x10000) {
+    buf[0] = 0xE0 | (cp >> 12);
+    n = 3;
+  } else {
+    buf[0] = 0xF0 | (cp >> 18);
+    n = 4;
+  }
+  for (size_t i = n - 1; i > 0; i--) {
+    buf[i] = 0x80 | (cp & 0x3F);
+    cp >>= 6;
+  }
+  return out.write(buf, n);
+}
+
+// Reads one code point from UTF-8 text at s (len bytes left), and sets used
+// to the number of bytes it took.  Broken sequences read as U+FFFD, one
+// byte at a time.
+static inline
+uint32_t TinyGsmReadUtf8(const char* s, size_t len, size_t& used) {
+  uint8_t  c = s[0];
+  uint32_t cp;
+  size_t   n;
+  used = 1;
+  if (c < 0x80) {
+    return c;
+  } else if ((c & 0xE0) == 0xC0) {
+    cp = c & 0x1F;
+    n = 2;
+  } else if ((c & 0xF0) == 0xE0) {
+    cp = c & 0x0F;
+    n = 3;
+  } else if ((c & 0xF8) == 0xF0) {
+    cp = c & 0x07;
+    n = 4;
+  } else {
+    return TINY_GSM_REPLACEMENT_CHAR;
+  }
+  if (n > len) {
+    return TINY_GSM_REPLACEMENT_CHAR;
+  }
+  for (size_t i = 1; i < n; i++) {
+    if (((uint8_t)s[i] & 0xC0) != 0x80) {
+      return TINY_GSM_REPLACEMENT_CHAR;
+    }
+    cp = (cp << 6) | (s[i] & 0x3F);
+  }
+  // Over-long forms, surrogates and anything past U+10FFFF
+  static const uint32_t minimum[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+  if (cp < minimum[n] || (cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) {
+    return TINY_GSM_REPLACEMENT_CHAR;
+  }
+  used = n;
+  return cp;
+}
+
+/*
+ * UCS-2 / UTF-16
+ */
+
+// Writes n bytes of big endian UTF-16 (UCS-2 plus surrogate pairs) as
+// UTF-8.  Unpaired surrogates come out as U+FFFD.  With
+// TINY_GSM_UNICODE_TO_HEX the output stays what it always was: anything
+// past Latin-1 is written as "\xHHHH" escapes of its code units, and
+// Latin-1 as single bytes.
+static inline
+size_t TinyGsmPrintUcs2(Print& out, const uint8_t* be, size_t n) {
+  size_t written = 0;
+  for (size_t i = 0; i + 1 < n; i += 2) {
+    uint32_t cp = ((uint16_t)be[i] << 8) | be[i+1];
+#if defined(TINY_GSM_UNICODE_TO_HEX)
+    if (cp >= 0x100) {
+      written += out.write((const uint8_t*)"\\x", 2);
+      written += TinyGsmPrintHex(out, be + i, 2);
+    } else {
+      written += out.write((uint8_t)cp);
+    }
+    continue;
+#endif
+    if (cp >= 0xD800 && cp <= 0xDBFF && i + 3 < n) {
+      uint16_t lo = ((uint16_t)be[i+2] << 8) | be[i+3];
+      if (lo >= 0xDC00 && lo <= 0xDFFF) {
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+        i += 2;
+      }
+    }
+    if (cp >= 0xD800 && cp <= 0xDFFF) {
+      cp = TINY_GSM_REPLACEMENT_CHAR;
+    }
+    written += TinyGsmPrintUtf8(out, cp);
+  }
+  return written;
+}
+
+// Converts UTF-8 text to UTF-16 code units (native byte order, ready for
+// sendSMS_UTF16).  Stops before a character that doesn't fit in size
+// units.  Returns the number of units written.
+static inline
+size_t TinyGsmUtf8ToUcs2(const char* utf8, size_t len, uint16_t* out, size_t size) {
+  size_t count = 0;
+  while (len > 0) {
+    size_t   used;
+    uint32_t cp = TinyGsmReadUtf8(utf8, len, used);
+    if (cp >= 0x10000) {
+      if (count + 2 > size) break;
+      cp -= 0x10000;
+      out[count++] = 0xD800 + (cp >> 10);
+      out[count++] = 0xDC00 + (cp & 0x3FF);
+    } else {
+      if (count + 1 > size) break;
+      out[count++] = cp;
+    }
+    utf8 += used;
+    len  -= used;
+  }
+  return count;
+}
+
+/*
+ * GSM 7 bit default alphabet
+ */
+
+#define TINY_GSM_GSM7_ESCAPE 0x1B
+
+// Unicode code point of each septet of the default alphabet
+static const uint16_t TinyGsmGsm7Chars[128] TINY_GSM_PROGMEM = {
+  0x0040, 0x00A3, 0x0024, 0x00A5, 0x00E8, 0x00E9, 0x00F9, 0x00EC,
+  0x00F2, 0x00C7, 0x000A, 0x00D8, 0x00F8, 0x000D, 0x00C5, 0x00E5,
+  0x0394, 0x005F, 0x03A6, 0x0393, 0x039B, 0x03A9, 0x03A0, 0x03A8,
+  0x03A3, 0x0398, 0x039E, 0x00A0, 0x00C6, 0x00E6, 0x00DF, 0x00C9,
+  0x0020, 0x0021, 0x0022, 0x0023, 0x00A4, 0x0025, 0x0026, 0x0027,
+  0x0028, 0x0029, 0x002A, 0x002B, 0x002C, 0x002D, 0x002E, 0x002F,
+  0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037,
+  0x0038, 0x0039, 0x003A, 0x003B, 0x003C, 0x003D, 0x003E, 0x003F,
+  0x00A1, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047,
+  0x0048, 0x0049, 0x004A, 0x004B, 0x004C, 0x004D, 0x004E, 0x004F,
+  0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057,
+  0x0058, 0x0059, 0x005A, 0x00C4, 0x00D6, 0x00D1, 0x00DC, 0x00A7,
+  0x00BF, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067,
+  0x0068, 0x0069, 0x006A, 0x006B, 0x006C, 0x006D, 0x006E, 0x006F,
+  0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077,
+  0x0078, 0x0079, 0x007A, 0x00E4, 0x00F6, 0x00F1, 0x00FC, 0x00E0
+};
+
+// The extension table: septets that follow an escape, and their characters
+static const uint8_t TinyGsmGsm7ExtSeptets[10] TINY_GSM_PROGMEM = {
+  0x0A, 0x14, 0x28, 0x29, 0x2F, 0x3C, 0x3D, 0x3E, 0x40, 0x65
+};
+static const uint16_t TinyGsmGsm7ExtChars[10] TINY_GSM_PROGMEM = {
+  0x000C, 0x005E, 0x007B, 0x007D, 0x005C, 0x005B, 0x007E, 0x005D, 0x007C, 0x20AC
+};
+
+// Septet for each ASCII character: 0x80 set for the extension table,
+// 0xFF if there is none
+static const uint8_t TinyGsmGsm7FromAscii[128] TINY_GSM_PROGMEM = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x0A, 0xFF, 0x8A, 0x0D, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0x20, 0x21, 0x22, 0x23, 0x02, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F,
+  0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0x3E, 0x3F,
+  0x00, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x4B, 0x4C, 0x4D, 0x4E, 0x4F,
+  0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0xBC, 0xAF, 0xBE, 0x94, 0x11,
+  0xFF, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x6B, 0x6C, 0x6D, 0x6E, 0x6F,
+  0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0xA8, 0xC0, 0xA9, 0xBD, 0xFF
+};
+
+// Code point of a septet, after an escape if escaped.  An escape followed
+// by something not in the extension table reads as the plain character.
+static inline
+uint32_t TinyGsmGsm7ToUnicode(uint8_t septet, bool escaped) {
+  septet &= 0x7F;
+  if (escaped) {
+    for (uint8_t i = 0; i < sizeof(TinyGsmGsm7ExtSeptets); i++) {
+      if (TINY_GSM_PGM_BYTE(&TinyGsmGsm7ExtSeptets[i]) == septet) {
+        return TINY_GSM_PGM_WORD(&TinyGsmGsm7ExtChars[i]);
+      }
+    }
+  }
+  return TINY_GSM_PGM_WORD(&TinyGsmGsm7Chars[septet]);
+}
+
+// Septet(s) for a code point: returns 1, or 2 for an escape followed by
+// septets[1].  Characters the alphabet doesn't have become '?'.
+static inline
+uint8_t TinyGsmUnicodeToGsm7(uint32_t cp, uint8_t* septets) {
+  uint8_t s = 0xFF;
+  if (cp < 0x80) {
+    s = TINY_GSM_PGM_BYTE(&TinyGsmGsm7FromAscii[cp]);
+  } else {
+    for (uint8_t i = 0; i < 128; i++) {
+      if (i != TINY_GSM_GSM7_ESCAPE && TINY_GSM_PGM_WORD(&TinyGsmGsm7Chars[i]) == cp) {
+        s = i;
+        break;
+      }
+    }
+    for (uint8_t i = 0; s == 0xFF && i < sizeof(TinyGsmGsm7ExtSeptets); i++) {
+      if (TINY_GSM_PGM_WORD(&TinyGsmGsm7ExtChars[i]) == cp) {
+        s = 0x80 | TINY_GSM_PGM_BYTE(&TinyGsmGsm7ExtSeptets[i]);
+      }
+    }
+  }
+  if (s == 0xFF) {
+    s = '?';
+  }
+  if (s & 0x80) {
+    septets[0] = TINY_GSM_GSM7_ESCAPE;
+    septets[1] = s & 0x7F;
+    return 2;
+  }
+  septets[0] = s;
+  return 1;
+}
+
+// Converts UTF-8 text to unpacked septets.  Stops before a character that
+// doesn't fit in size septets.  Returns the number of septets written.
+static inline
+size_t TinyGsmUtf8ToGsm7(const char* utf8, size_t len, uint8_t* septets, size_t size) {
+  size_t count = 0;
+  while (len > 0) {
+    size_t  used;
+    uint8_t s[2];
+    uint8_t n = TinyGsmUnicodeToGsm7(TinyGsmReadUtf8(utf8, len, used), s);
+    if (count + n > size) break;
+    septets[count++] = s[0];
+    if (n > 1) septets[count++] = s[1];
+    utf8 += used;
+    len  -= used;
+  }
+  return count;
+}
+
+// Packs n septets into (n * 7 + 7) / 8 octets, returns that number
+static inline
+size_t TinyGsmPackGsm7(const uint8_t* septets, size_t n, uint8_t* octets) {
+  size_t   count = 0;
+  uint16_t bits = 0;
+  uint8_t  nbits = 0;
+  for (size_t i = 0; i < n; i++) {
+    bits |= (uint16_t)(septets[i] & 0x7F) << nbits;
+    nbits += 7;
+    if (nbits >= 8) {
+      octets[count++] = bits & 0xFF;
+      bits >>= 8;
+      nbits -= 8;
+    }
+  }
+  if (nbits > 0) {
+    octets[count++] = bits & 0xFF;
+  }
+  return count;
+}
+
+// Unpacks n octets into n * 8 / 7 septets, returns that number.
+// When the last 7 bits of a multiple of 7 octets are all zero, they are
+// padding, not an '@', and are dropped.
+static inline
+size_t TinyGsmUnpackGsm7(const uint8_t* octets, size_t n, uint8_t* septets) {
+  size_t   count = 0;
+  uint16_t bits = 0;
+  uint8_t  nbits = 0;
+  for (size_t i = 0; i < n; i++) {
+    bits |= (uint16_t)octets[i] << nbits;
+    nbits += 8;
+    while (nbits >= 7) {
+      septets[count++] = bits & 0x7F;
+      bits >>= 7;
+      nbits -= 7;
+    }
+  }
+  if (n % 7 == 0 && count > 0 && septets[count-1] == 0) {
+    count--;
+  }
+  return count;
+}
+
+// Writes n octets of packed GSM 7 bit text as UTF-8, unpacking on the fly
+static inline
+size_t TinyGsmPrintGsm7(Print& out, const uint8_t* octets, size_t n) {
+  size_t   written = 0;
+  size_t   total = n * 8 / 7;
+  size_t   index = 0;
+  uint16_t bits = 0;
+  uint8_t  nbits = 0;
+  bool     escaped = false;
+  if (n % 7 == 0 && n > 0 && (octets[n-1] >> 1) == 0) {
+    total--;  // padding, see TinyGsmUnpackGsm7
+  }
+  for (size_t i = 0; i < n; i++) {
+    bits |= (uint16_t)octets[i] << nbits;
+    nbits += 8;
+    while (nbits >= 7 && index < total) {
+      uint8_t s = bits & 0x7F;
+      bits >>= 7;
+      nbits -= 7;
+      index++;
+      if (s == TINY_GSM_GSM7_ESCAPE && !escaped && index < total) {
+        escaped = true;
+        continue;
+      }
+      written += TinyGsmPrintUtf8(out, TinyGsmGsm7ToUnicode(s, escaped));
+      escaped = false;
+    }
+  }
+  return written;
+}
+
+/*
+ * Sinks
+ */
+
+// A Print into a caller's char buffer, always zero-terminated.
+// What doesn't fit is dropped and counted in overflow().
+class TinyGsmBufferSink : public Print
+{
+public:
+  TinyGsmBufferSink(char* buf, size_t size)
+    : _buf(buf), _size(size), _len(0), _overflow(0)
+  {
+    if (_size) _buf[0] = '\0';
+  }
+
+  virtual size_t write(uint8_t c) {
+    if (_len + 1 >= _size) {
+      _overflow++;
+      return 0;
+    }
+    _buf[_len++] = c;
+    _buf[_len] = '\0';
+    return 1;
+  }
+
+  using Print::write;
+
+  size_t length() const {
+    return _len;
+  }
+
+  size_t overflow() const {
+    return _overflow;
+  }
+
+private:
+  char*  _buf;
+  size_t _size;
+  size_t _len;
+  size_t _overflow;
+};
+
+// A Print that appends to a String, for the String based API
+class TinyGsmStringSink : public Print
+{
+public:
+  explicit TinyGsmStringSink(String& str)
+    : _str(str)
+  {}
+
+  virtual size_t write(uint8_t c) {
+    _str += (char)c;
+    return 1;
+  }
+
+  using Print::write;
+
+private:
+  String& _str;
+};
+
+#endif
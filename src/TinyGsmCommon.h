@@ -34,8 +34,73 @@
   #define TINY_GSM_YIELD_MS 0
 #endif
 
-#ifndef TINY_GSM_YIELD
-  #define TINY_GSM_YIELD() { delay(TINY_GSM_YIELD_MS); }
+#ifdef TINY_GSM_STATS
+// Time spent in the default TINY_GSM_YIELD(), shared by all modems
+inline uint32_t& TinyGsmYieldMicros() {
+  static uint32_t us = 0;
+  return us;
+}
+#endif
+
+// What the library is waiting for when it yields
+enum TinyGsmWaitReason {
+  TINY_GSM_WAIT_ANY      = 0,  // nothing in particular, just giving a turn
+  TINY_GSM_WAIT_RESPONSE = 1,  // the response to an AT command
+  TINY_GSM_WAIT_DATA     = 2,  // socket data coming in over the UART
+  TINY_GSM_WAIT_PROMPT   = 3,  // the '>' before data can be sent
+};
+
+// Called instead of delay(TINY_GSM_YIELD_MS) every time the library waits
+// for the modem, with the longest it may still wait (0 when it isn't waiting
+// for anything in particular).  This is where other work gets its turn: a
+// FreeRTOS vTaskDelay(), one pass of an event loop, or resuming coroutines.
+// It must not use the modem itself, and should return well within
+// remaining_ms, since the modem is only checked again after it returns.
+typedef void (*TinyGsmYieldCallback)(uint32_t remaining_ms, TinyGsmWaitReason reason);
+
+inline TinyGsmYieldCallback& TinyGsmYieldHook() {
+  static TinyGsmYieldCallback cb = NULL;
+  return cb;
+}
+
+// Sets the callback for all modems, NULL goes back to delay()
+inline void TinyGsmSetYield(TinyGsmYieldCallback cb) {
+  TinyGsmYieldHook() = cb;
+}
+
+inline void TinyGsmYield(uint32_t remaining_ms, TinyGsmWaitReason reason) {
+#ifdef TINY_GSM_STATS
+  uint32_t start = micros();
+#endif
+  TinyGsmYieldCallback cb = TinyGsmYieldHook();
+  if (cb) {
+    cb(remaining_ms, reason);
+  } else {
+    delay(TINY_GSM_YIELD_MS);
+  }
+#ifdef TINY_GSM_STATS
+  TinyGsmYieldMicros() += micros() - start;
+#endif
+}
+
+// Time left of a timeout_ms wait that started at start
+inline uint32_t TinyGsmRemaining(uint32_t start, uint32_t timeout_ms) {
+  uint32_t elapsed = millis() - start;
+  return (elapsed < timeout_ms) ? timeout_ms - elapsed : 0;
+}
+
+// Waits that know their deadline yield with TINY_GSM_YIELD_FOR().  An
+// application's own TINY_GSM_YIELD() still replaces all of them.
+#ifdef TINY_GSM_YIELD
+  #define TINY_GSM_YIELD_FOR(remaining_ms, reason) TINY_GSM_YIELD()
+#else
+  #define TINY_GSM_YIELD() { TinyGsmYield(0, TINY_GSM_WAIT_ANY); }
+  #define TINY_GSM_YIELD_FOR(remaining_ms, reason) { TinyGsmYield(remaining_ms, reason); }
+#endif
+
+// Runs at the start of every waitResponse(), e.g. to count them
+#ifndef TINY_GSM_WAIT_RESPONSE_HOOK
+  #define TINY_GSM_WAIT_RESPONSE_HOOK()
 #endif
 
 #define TINY_GSM_ATTR_NOT_AVAILABLE __attribute__((error("Not available on this modem type")))
@@ -46,11 +111,30 @@
   typedef const __FlashStringHelper* GsmConstStr;
   #define GFP(x) (reinterpret_cast<GsmConstStr>(x))
   #define GF(x)  F(x)
+  #define GSM_CONST_STR_CHAR(s, i) ((char)pgm_read_byte(reinterpret_cast<const char*>(s) + (i)))
+  #define GSM_CONST_STR_LEN(s)     strlen_P(reinterpret_cast<const char*>(s))
 #else
   #define TINY_GSM_PROGMEM
   typedef const char* GsmConstStr;
   #define GFP(x) x
   #define GF(x)  x
+  #define GSM_CONST_STR_CHAR(s, i) ((s)[i])
+  #define GSM_CONST_STR_LEN(s)     strlen(s)
+#endif
+
+// Size of the line window kept by TinyGsmMatcher for URC parsing
+#ifndef TINY_GSM_RESPONSE_WINDOW
+  #define TINY_GSM_RESPONSE_WINDOW 32
+#endif
+
+// Pattern length TinyGsmMatcher keeps a failure table for, per pattern
+#ifndef TINY_GSM_PATTERN_TABLE
+  #define TINY_GSM_PATTERN_TABLE 24
+#endif
+
+// Number of URC handlers the application can add on top of the built-in ones
+#ifndef TINY_GSM_URC_HANDLERS
+  #define TINY_GSM_URC_HANDLERS 4
 #endif
 
 #ifdef TINY_GSM_DEBUG
@@ -92,6 +176,1074 @@ const T& TinyGsmMax(const T& a, const T& b)
     return (b < a) ? a : b;
 }
 
+#include <TinyGsmCodec.h>
+#include <TinyGsmCert.h>
+
+// Matches the incoming modem byte stream against up to N patterns at once
+// (final result codes and URC prefixes), without touching the heap.
+// For each pattern we only keep how many of its leading characters match the
+// end of the input, so a byte usually costs one compare per pattern.  On a
+// mismatch the KMP failure table, built by add(), gives the next shorter
+// prefix to try, so a byte costs amortized constant work.  The patterns
+// arrive at run time, so the tables are built in RAM, not in flash.  Past
+// TINY_GSM_PATTERN_TABLE characters the pattern is compared with itself.
+// The current line is kept in a small fixed window for handlers that need
+// to look back at what came before the match (i.e. "0, CLOSED").
+template<uint8_t N>
+class TinyGsmMatcher
+{
+public:
+  TinyGsmMatcher() {
+    _count = 0;
+    reset();
+  }
+
+  // Returns the 1-based index of the pattern, or 0 if there's no room.
+  // NULL patterns still take a slot, so indexes match r1...rN of waitResponse.
+  uint8_t add(GsmConstStr pattern) {
+    if (_count >= N) return 0;
+    _pat[_count] = pattern;
+    _len[_count] = pattern ? GSM_CONST_STR_LEN(pattern) : 0;
+    _state[_count] = 0;
+    // _fail[q] is the longest proper prefix of pattern[0..q] that is also
+    // its suffix
+    uint8_t* fail = _fail[_count];
+    uint8_t  k = 0;
+    fail[0] = 0;
+    for (uint8_t q = 1; q < _len[_count] && q < TINY_GSM_PATTERN_TABLE; q++) {
+      char c = GSM_CONST_STR_CHAR(pattern, q);
+      while (k && GSM_CONST_STR_CHAR(pattern, k) != c) {
+        k = fail[k - 1];
+      }
+      if (GSM_CONST_STR_CHAR(pattern, k) == c) k++;
+      fail[q] = k;
+    }
+    return ++_count;
+  }
+
+  // A wait for a '>' is a wait for a data prompt
+  TinyGsmWaitReason reason() const {
+    if (_count && _pat[0] && GSM_CONST_STR_CHAR(_pat[0], 0) == '>') {
+      return TINY_GSM_WAIT_PROMPT;
+    }
+    return TINY_GSM_WAIT_RESPONSE;
+  }
+
+  // Forget partial matches, i.e. after a handler read from the stream directly
+  void reset() {
+    memset(_state, 0, sizeof(_state));
+    _lineLen = 0;
+    _line[0] = '\0';
+    _lineDone = false;
+  }
+
+  // Returns the index of the first pattern completed by this byte, or 0
+  uint8_t feed(char c) {
+    if (_lineDone) {
+      _lineLen = 0;
+      _lineDone = false;
+    }
+    if (_lineLen < TINY_GSM_RESPONSE_WINDOW - 1) {
+      _line[_lineLen++] = c;
+      _line[_lineLen] = '\0';
+    }
+    if (c == '\n') {
+      _lineDone = true;
+    }
+
+    uint8_t hit = 0;
+    for (uint8_t i = 0; i < _count; i++) {
+      if (!_len[i]) continue;
+      _state[i] = next(i, _state[i], c);
+      if (_state[i] == _len[i] && !hit) {
+        hit = i + 1;
+      }
+    }
+    return hit;
+  }
+
+  // The current line, up to TINY_GSM_RESPONSE_WINDOW-1 characters
+  const char* line() const { return _line; }
+  uint8_t lineLength() const { return _lineLen; }
+
+private:
+  uint8_t next(uint8_t i, uint8_t s, char c) const {
+    GsmConstStr p = _pat[i];
+    for (;;) {
+      // After a full match p[s] is the terminating '\0', which never matches
+      if (GSM_CONST_STR_CHAR(p, s) == c) {
+        return s + 1;
+      }
+      if (!s) return 0;
+      s = border(i, s);
+    }
+  }
+
+  // Longest proper prefix of p[0..s) that is also its suffix
+  uint8_t border(uint8_t i, uint8_t s) const {
+    if (s <= TINY_GSM_PATTERN_TABLE) {
+      return _fail[i][s - 1];
+    }
+    GsmConstStr p = _pat[i];
+    for (uint8_t k = s - 1; k > 0; k--) {
+      uint8_t j = 0;
+      while (j < k && GSM_CONST_STR_CHAR(p, j) == GSM_CONST_STR_CHAR(p, s - k + j)) {
+        j++;
+      }
+      if (j == k) return k;
+    }
+    return 0;
+  }
+
+  GsmConstStr _pat[N];
+  uint8_t     _len[N];
+  uint8_t     _state[N];
+  uint8_t     _fail[N][TINY_GSM_PATTERN_TABLE];
+  uint8_t     _count;
+  char        _line[TINY_GSM_RESPONSE_WINDOW];
+  uint8_t     _lineLen;
+  bool        _lineDone;
+};
+
+// Called with the rest of the URC line (after the prefix, without CR/LF).
+// Runs from inside waitResponse(), so it must not send AT commands itself.
+typedef void (*TinyGsmUrcCallback)(const char* args, void* ctx);
+
+// Looks up unsolicited result codes by the prefix they start their line
+// with.  A leading connection number (i.e. "0, CLOSED") is skipped.
+// The prefix is only compared once per line: the first character picks the
+// candidates and every following one only checks those still in the race,
+// so most bytes cost nothing at all.  Built-in entries have no callback and
+// are handled by the modem by their index, application entries are called
+// through dispatch().  Holds up to N (at most 16) entries.
+template<uint8_t N>
+class TinyGsmUrcTable
+{
+public:
+  TinyGsmUrcTable() {
+    _count = 0;
+    lineStart();
+  }
+
+  // Returns the 1-based index of the entry, or 0 if there's no room.
+  // Adding a prefix that's already there replaces its callback.
+  uint8_t add(GsmConstStr prefix, TinyGsmUrcCallback cb = NULL, void* ctx = NULL) {
+    uint8_t i = indexOf(prefix);
+    if (!i) {
+      for (i = 1; i <= _count && _len[i - 1]; i++) {}
+      if (i > N) return 0;
+      if (i > _count) _count = i;
+    }
+    _prefix[i - 1] = prefix;
+    _len[i - 1] = GSM_CONST_STR_LEN(prefix);
+    _cb[i - 1] = cb;
+    _ctx[i - 1] = ctx;
+    return i;
+  }
+
+  bool remove(GsmConstStr prefix) {
+    uint8_t i = indexOf(prefix);
+    if (!i) return false;
+    _len[i - 1] = 0;
+    _cb[i - 1] = NULL;
+    _cand &= ~(1U << (i - 1));
+    return true;
+  }
+
+  // Call whenever the stream is known to be at the start of a line
+  void lineStart() {
+    _cand = 0;
+    _pos = 0;
+    _atStart = true;
+  }
+
+  // Returns the index of the entry whose prefix this byte completes, or 0
+  uint8_t feed(char c) {
+    if (c == '\n') {
+      lineStart();
+      return 0;
+    }
+    if (_atStart) {
+      if ((c >= '0' && c <= '9') || c == ',' || c == ' ' || c == '\r') {
+        return 0;
+      }
+      _atStart = false;
+      for (uint8_t i = 0; i < _count; i++) {
+        if (_len[i] && GSM_CONST_STR_CHAR(_prefix[i], 0) == c) {
+          _cand |= 1U << i;
+        }
+      }
+    } else if (_cand) {
+      for (uint8_t i = 0; i < _count; i++) {
+        if ((_cand & (1U << i)) && GSM_CONST_STR_CHAR(_prefix[i], _pos) != c) {
+          _cand &= ~(1U << i);
+        }
+      }
+    }
+    if (!_cand) return 0;
+    _pos++;
+    for (uint8_t i = 0; i < _count; i++) {
+      if ((_cand & (1U << i)) && _len[i] == _pos) {
+        _cand = 0;
+        return i + 1;
+      }
+    }
+    return 0;
+  }
+
+  // Reads the rest of the line and hands it to the entry's callback.
+  // Returns false for entries without one.
+  bool dispatch(uint8_t i, Stream& stream) {
+    if (!i || i > _count || !_cb[i - 1]) return false;
+    char args[TINY_GSM_RESPONSE_WINDOW];
+    size_t n = stream.readBytesUntil('\n', args, sizeof(args) - 1);
+    while (n && args[n - 1] == '\r') n--;
+    args[n] = '\0';
+    _cb[i - 1](args, _ctx[i - 1]);
+    return true;
+  }
+
+  // Returns the 1-based index of the entry for this prefix, or 0
+  uint8_t indexOf(GsmConstStr prefix) const {
+    for (uint8_t i = 0; i < _count; i++) {
+      if (!_len[i]) continue;
+      if (_prefix[i] == prefix) return i + 1;
+      uint8_t k = 0;
+      while (GSM_CONST_STR_CHAR(_prefix[i], k) == GSM_CONST_STR_CHAR(prefix, k)) {
+        if (!GSM_CONST_STR_CHAR(prefix, k)) return i + 1;
+        k++;
+      }
+    }
+    return 0;
+  }
+
+  GsmConstStr prefix(uint8_t i) const {
+    return (i && i <= _count) ? _prefix[i - 1] : NULL;
+  }
+
+private:
+  static_assert(N <= 16, "TinyGsmUrcTable holds at most 16 entries");
+
+  GsmConstStr        _prefix[N];
+  uint8_t            _len[N];
+  TinyGsmUrcCallback _cb[N];
+  void*              _ctx[N];
+  uint8_t            _count;
+  uint16_t           _cand;
+  uint8_t            _pos;
+  bool               _atStart;
+};
+
+// Size of an optional per-client transmit buffer.  With the default of 0
+// every write() is its own modem send (+CIPSEND, +QISEND, +USOWR...), so
+// Print-style code that writes a few bytes at a time pays a full round trip
+// for each.  With a buffer, writes are collected and sent when the buffer
+// is full, on flush(), available(), read() or stop(), or by maintain()
+// once they've waited TINY_GSM_TX_IDLE_MS.
+#ifndef TINY_GSM_TX_BUFFER
+  #define TINY_GSM_TX_BUFFER 0
+#endif
+#ifndef TINY_GSM_TX_IDLE_MS
+  #define TINY_GSM_TX_IDLE_MS 20
+#endif
+// Without a transmit buffer, scatter/gather writes still put segments of
+// up to this many bytes together in one modem send, from the stack
+#ifndef TINY_GSM_TX_GATHER
+  #define TINY_GSM_TX_GATHER 128
+#endif
+
+// One piece of a scatter/gather client write
+struct TinyGsmTxSegment {
+  const void* data;
+  size_t      len;
+};
+
+template<size_t N>
+class TinyGsmTxBuffer
+{
+public:
+  TinyGsmTxBuffer() {
+    clear();
+  }
+
+  void clear() {
+    _len = 0;
+  }
+
+  size_t capacity() const {
+    return N;
+  }
+
+  size_t size() const {
+    return _len;
+  }
+
+  size_t free() const {
+    return N - _len;
+  }
+
+  const uint8_t* data() const {
+    return _buf;
+  }
+
+  // Copies as much as fits, returns how much that was
+  size_t append(const uint8_t* p, size_t n) {
+    n = TinyGsmMin(n, free());
+    if (n && !_len) _started = millis();
+    memcpy(_buf + _len, p, n);
+    _len += n;
+    return n;
+  }
+
+  bool idle() const {
+    return _len && millis() - _started >= TINY_GSM_TX_IDLE_MS;
+  }
+
+private:
+  uint8_t  _buf[N];
+  size_t   _len;
+  uint32_t _started;
+};
+
+// Without a buffer everything goes straight out
+template<>
+class TinyGsmTxBuffer<0>
+{
+public:
+  void clear() {}
+  size_t capacity() const { return 0; }
+  size_t size() const { return 0; }
+  size_t free() const { return 0; }
+  const uint8_t* data() const { return NULL; }
+  size_t append(const uint8_t*, size_t) { return 0; }
+  bool idle() const { return false; }
+};
+
+// Size of the stack buffer AT commands are rendered into before they're
+// written to the modem.  Longer commands go out in several writes.
+#ifndef TINY_GSM_AT_BUFFER
+  #define TINY_GSM_AT_BUFFER 64
+#endif
+
+// Collects what's printed to it and passes it on to the stream in blocks
+// of up to N bytes.  Writes that don't fit the buffer at all go straight
+// through, after whatever was buffered before them.
+template<size_t N>
+class TinyGsmPrintBuffer : public Print
+{
+public:
+  explicit TinyGsmPrintBuffer(Stream& stream)
+    : _stream(stream), _len(0)
+  {}
+
+  ~TinyGsmPrintBuffer() {
+    send();
+  }
+
+  virtual size_t write(uint8_t c) {
+    if (_len >= N) send();
+    _buf[_len++] = c;
+    return 1;
+  }
+
+  virtual size_t write(const uint8_t* buf, size_t size) {
+    if (_len + size > N) {
+      send();
+      if (size > N) return _stream.write(buf, size);
+    }
+    memcpy(_buf + _len, buf, size);
+    _len += size;
+    return size;
+  }
+
+  using Print::write;
+
+  void send() {
+    if (_len) _stream.write(_buf, _len);
+    _len = 0;
+  }
+
+private:
+  Stream&  _stream;
+  size_t   _len;
+  uint8_t  _buf[N];
+};
+
+// Size of the batches that carry user strings (APN, user name, password),
+// they live on the stack only while being sent
+#ifndef TINY_GSM_BATCH_BUFFER
+  #define TINY_GSM_BATCH_BUFFER 256
+#endif
+
+// Collects several AT commands into one "AT<cmd1>;S3?;<cmd2>;..." line, so
+// a setup sequence costs one round trip instead of one per command.  The
+// modem runs them in order and stops at the first failure.  Set commands
+// print nothing of their own, so an "S3?" (the line terminator, "013")
+// goes after each one: sendBatch() counts those before the final OK or
+// ERROR and knows which command failed without running any of them twice.
+// Only put commands in a batch that leave the modem where a failed batch
+// can be retried from, i.e. settings, and send state changes like +CSTT or
+// +CIICR on their own.  Queries answer with lines of their own, a batch of
+// them can do without the markers.  Holds up to N chars.
+template<uint16_t N>
+class TinyGsmAtBatch
+{
+public:
+  explicit TinyGsmAtBatch(bool markers = true)
+    : _markers(markers)
+  {
+    clear();
+  }
+
+  void clear() {
+    _len = 0;
+    _count = 0;
+    _full = false;
+    _buf[0] = '\0';
+  }
+
+  // Adds one command, built from its parts, i.e.
+  //   batch.add(GF("+SAPBR=3,1,\"APN\",\""), apn, '"');
+  // Returns false (and leaves the batch alone) if it doesn't fit.
+  template<typename... Args>
+  bool add(Args... parts) {
+    if (_full || _count == 0xFF) {
+      _full = true;
+      return false;
+    }
+    uint16_t start = _len;
+    if (_count) append(_markers ? GF(";S3?;") : GF(";"));
+    append(parts...);
+    if (_len >= N) {
+      _len = start;
+      _buf[_len] = '\0';
+      _full = true;
+      return false;
+    }
+    _count++;
+    return true;
+  }
+
+  // True if a command didn't fit and was left out
+  bool overflow() const {
+    return _full;
+  }
+
+  uint8_t count() const {
+    return _count;
+  }
+
+  // The whole batch, without the leading "AT"
+  const char* c_str() const {
+    return _buf;
+  }
+
+private:
+  void append() {}
+
+  template<typename T, typename... Args>
+  void append(T head, Args... tail) {
+    put(head);
+    append(tail...);
+  }
+
+  void put(char c) {
+    if (_len < N) _buf[_len] = c;
+    _len++;
+    if (_len < N) _buf[_len] = '\0';
+  }
+
+  void put(const char* s) {
+    while (s && *s) put(*s++);
+  }
+
+  void put(int n) {
+    if (n < 0) {
+      put('-');
+      n = -n;
+    }
+    if (n >= 10) put(n / 10);
+    put((char)('0' + n % 10));
+  }
+
+#if defined(__AVR__)
+  void put(const __FlashStringHelper* s) {
+    for (uint16_t i = 0; s && GSM_CONST_STR_CHAR(s, i); i++) {
+      put((char)GSM_CONST_STR_CHAR(s, i));
+    }
+  }
+#endif
+
+  char     _buf[N + 1];
+  uint16_t _len;
+  uint8_t  _count;
+  bool     _full;
+  bool     _markers;
+};
+
+// Bounds of the interval at which a socket asks the modem for data it may
+// have forgotten to announce with a URC.  Polls start at the minimum, and
+// the interval doubles after every poll that finds nothing, up to the
+// maximum.  Data coming in, by URC or by poll, brings it back down.
+#ifndef TINY_GSM_POLL_MIN_MS
+  #define TINY_GSM_POLL_MIN_MS 100
+#endif
+#ifndef TINY_GSM_POLL_MAX_MS
+  #define TINY_GSM_POLL_MAX_MS 5000
+#endif
+
+class TinyGsmPollTimer
+{
+public:
+  TinyGsmPollTimer() {
+    _last = 0;
+    setInterval(TINY_GSM_POLL_MIN_MS, TINY_GSM_POLL_MAX_MS);
+  }
+
+  // A max_ms of 0 turns polling off, the socket then relies on URCs only
+  void setInterval(uint32_t min_ms, uint32_t max_ms) {
+    _max = TinyGsmMin(max_ms, (uint32_t)0xFFFF);
+    _min = TinyGsmMin(min_ms, (uint32_t)_max);
+    _interval = _min;
+  }
+
+  // True (once) when it's time for the next poll
+  bool due() {
+    if (!_max || millis() - _last < _interval) return false;
+    _last = millis();
+    return true;
+  }
+
+  // Call with the outcome of every check of the socket's data
+  void checked(bool found) {
+    if (found) {
+      _interval = _min;
+    } else if (_interval < _max) {
+      _interval = TinyGsmMin((uint32_t)_interval * 2 + 1, (uint32_t)_max);
+    }
+  }
+
+private:
+  uint32_t _last;
+  uint16_t _interval;
+  uint16_t _min;
+  uint16_t _max;
+};
+
+enum ConnectStatus {
+  CONNECT_IDLE    = 0,
+  CONNECT_PENDING = 1,
+  CONNECT_DONE    = 2,
+  CONNECT_FAILED  = 3,
+};
+
+// How often maintain() asks about a pending connect on modems that don't
+// tell when it's done
+#ifndef TINY_GSM_CONNECT_POLL_MS
+  #define TINY_GSM_CONNECT_POLL_MS 250
+#endif
+
+// Progress of a socket's connectAsync().  The modem finishes it from its
+// URC, or from maintain() on modems without one, and maintain() fails it
+// once it runs out of time.
+class TinyGsmConnectState
+{
+public:
+  TinyGsmConnectState() {
+    status = CONNECT_IDLE;
+    _started = 0;
+    _checked = 0;
+    _timeout = 0;
+  }
+
+  void start(uint32_t timeout_ms) {
+    status = CONNECT_PENDING;
+    _started = _checked = millis();
+    _timeout = timeout_ms;
+  }
+
+  bool pending() const {
+    return status == CONNECT_PENDING;
+  }
+
+  // Returns false if there was nothing pending to finish
+  bool finish(bool ok) {
+    if (!pending()) return false;
+    status = ok ? CONNECT_DONE : CONNECT_FAILED;
+    return true;
+  }
+
+  // The socket was stopped, forget about a pending connect
+  void cancel() {
+    if (pending()) status = CONNECT_IDLE;
+  }
+
+  bool expired() const {
+    return pending() && millis() - _started >= _timeout;
+  }
+
+  // True (once per TINY_GSM_CONNECT_POLL_MS) when it's time to ask again
+  bool due() {
+    if (!pending() || millis() - _checked < TINY_GSM_CONNECT_POLL_MS) return false;
+    _checked = millis();
+    return true;
+  }
+
+  ConnectStatus status;
+
+private:
+  uint32_t _started;
+  uint32_t _checked;
+  uint32_t _timeout;
+};
+
+#ifdef TINY_GSM_STATS
+
+// Number of different AT commands that get their own statistics
+#ifndef TINY_GSM_STATS_COMMANDS
+  #define TINY_GSM_STATS_COMMANDS 12
+#endif
+
+// Latency histogram buckets, the last one counts everything slower
+#define TINY_GSM_STATS_BUCKETS 8
+
+struct TinyGsmCommandStats {
+  char     prefix[12];  // i.e. "+CIPSTATUS", "" for a plain AT
+  uint16_t count;
+  uint16_t timeouts;
+  uint32_t min_ms;
+  uint32_t max_ms;
+  uint32_t total_ms;
+  uint16_t histogram[TINY_GSM_STATS_BUCKETS];
+};
+
+// Where the time and the bytes on the modem link go.  Enabled by defining
+// TINY_GSM_STATS before including TinyGsmClient.h.  A command's latency
+// runs from sendAT() to the first waitResponse() result after it.
+class TinyGsmStats
+{
+public:
+  TinyGsmStats() {
+    clear();
+  }
+
+  void clear() {
+    memset(this, 0, sizeof(*this));
+  }
+
+  void commandSent() {
+    startCommand("", 0);
+  }
+#if defined(__AVR__)
+  template<typename... Args>
+  void commandSent(const __FlashStringHelper* cmd, Args...) {
+    startCommand(reinterpret_cast<const char*>(cmd), 1);
+  }
+#endif
+  template<typename... Args>
+  void commandSent(const char* cmd, Args...) {
+    startCommand(cmd, 0);
+  }
+  template<typename T, typename... Args>
+  void commandSent(T, Args...) {
+    startCommand("", 0);
+  }
+
+  void responseReceived(uint8_t index) {
+    if (!pending) return;
+    TinyGsmCommandStats& c = commands[pending - 1];
+    pending = 0;
+    uint32_t ms = millis() - started;
+    if (!index) {
+      c.timeouts++;
+      timeouts++;
+      return;
+    }
+    static const uint16_t limits[TINY_GSM_STATS_BUCKETS - 1] =
+      { 10, 30, 100, 300, 1000, 3000, 10000 };
+    uint8_t b = 0;
+    while (b < TINY_GSM_STATS_BUCKETS - 1 && ms >= limits[b]) b++;
+    c.histogram[b]++;
+    if (!c.count || ms < c.min_ms) c.min_ms = ms;
+    if (ms > c.max_ms) c.max_ms = ms;
+    c.total_ms += ms;
+    c.count++;
+  }
+
+  void urcReceived(GsmConstStr prefix) {
+    for (uint8_t i = 0; i < 16; i++) {
+      if (!urcs[i] || urcs[i] == prefix) {
+        urcs[i] = prefix;
+        urcCounts[i]++;
+        return;
+      }
+    }
+  }
+
+  void printTo(Print& out) const {
+    out.println(F("AT command    count  min  avg  max  t/o | <10 <30 <100 <300 <1s <3s <10s more"));
+    for (uint8_t i = 0; i < commandCount; i++) {
+      const TinyGsmCommandStats& c = commands[i];
+      out.print(F("AT"));
+      out.print(c.prefix);
+      for (uint8_t n = strlen(c.prefix) + 2; n < 14; n++) out.print(' ');
+      out.print(c.count);
+      out.print(' ');
+      out.print(c.min_ms);
+      out.print(' ');
+      out.print(c.count ? c.total_ms / c.count : 0);
+      out.print(' ');
+      out.print(c.max_ms);
+      out.print(' ');
+      out.print(c.timeouts);
+      out.print(F(" |"));
+      for (uint8_t b = 0; b < TINY_GSM_STATS_BUCKETS; b++) {
+        out.print(' ');
+        out.print(c.histogram[b]);
+      }
+      out.println();
+    }
+    out.print(F("Socket bytes sent/received:"));
+    for (uint8_t mux = 0; mux < TINY_GSM_MUX_COUNT; mux++) {
+      if (!bytesSent[mux] && !bytesReceived[mux]) continue;
+      out.print(' ');
+      out.print(mux);
+      out.print(':');
+      out.print(bytesSent[mux]);
+      out.print('/');
+      out.print(bytesReceived[mux]);
+    }
+    out.println();
+    out.print(F("URCs:"));
+    for (uint8_t i = 0; i < 16 && urcs[i]; i++) {
+      out.print(' ');
+      out.print(urcs[i]);
+      out.print('x');
+      out.print(urcCounts[i]);
+    }
+    out.println();
+    out.print(F("Timeouts: "));
+    out.print(timeouts);
+    out.print(F(", yield: "));
+    out.print(TinyGsmYieldMicros() / 1000);
+    out.println(F(" ms"));
+  }
+
+  TinyGsmCommandStats commands[TINY_GSM_STATS_COMMANDS];
+  uint8_t             commandCount;
+  uint32_t            bytesSent[TINY_GSM_MUX_COUNT];
+  uint32_t            bytesReceived[TINY_GSM_MUX_COUNT];
+  GsmConstStr         urcs[16];
+  uint16_t            urcCounts[16];
+  uint32_t            timeouts;
+
+private:
+  // Copies the command up to its parameters, finds or adds its entry
+  void startCommand(const char* cmd, bool progmem) {
+    char prefix[sizeof(commands[0].prefix)];
+    uint8_t n = 0;
+    while (n < sizeof(prefix) - 1) {
+#if defined(__AVR__)
+      char ch = progmem ? pgm_read_byte(cmd + n) : cmd[n];
+#else
+      (void)progmem;
+      char ch = cmd[n];
+#endif
+      if (!ch || ch == '=' || ch == '?' || ch == ';') break;
+      prefix[n++] = ch;
+    }
+    prefix[n] = '\0';
+    pending = 0;
+    for (uint8_t i = 0; i < commandCount; i++) {
+      if (!strcmp(commands[i].prefix, prefix)) {
+        pending = i + 1;
+        break;
+      }
+    }
+    if (!pending) {
+      if (commandCount >= TINY_GSM_STATS_COMMANDS) return;
+      strcpy(commands[commandCount].prefix, prefix);
+      pending = ++commandCount;
+    }
+    started = millis();
+  }
+
+  uint8_t             pending;
+  uint32_t            started;
+};
+
+  #define TINY_GSM_STATS_COMMAND(...)             stats.commandSent(__VA_ARGS__)
+  #define TINY_GSM_STATS_RESPONSE(index)          stats.responseReceived(index)
+  #define TINY_GSM_STATS_URC(prefix)              stats.urcReceived(prefix)
+  #define TINY_GSM_STATS_SOCKET(modem, dir, mux, n) (modem)->stats.dir[mux] += (n)
+#else
+  #define TINY_GSM_STATS_COMMAND(...)
+  #define TINY_GSM_STATS_RESPONSE(index)
+  #define TINY_GSM_STATS_URC(prefix)
+  #define TINY_GSM_STATS_SOCKET(modem, dir, mux, n)
+#endif
+
+// Moves a len byte payload from the stream: the first dst_size bytes go
+// straight into dst, the rest into the fifo.  Everything that's already in
+// the UART buffer is taken with a single readBytes() per contiguous span,
+// and the time-out only runs while no data comes in at all (the payload
+// of a 1460 byte read takes longer than a second at 9600 baud).
+// Bytes that don't fit anywhere are still read out, to keep the stream in
+// sync, but dropped.  Returns the number of bytes stored.
+template<class F>
+size_t TinyGsmStreamToFifo(Stream& stream, size_t len, F& fifo, uint32_t timeout_ms,
+                           uint8_t* dst = NULL, size_t dst_size = 0)
+{
+  uint8_t  overflow[16];
+  size_t   stored = 0;
+  uint32_t startMillis = millis();
+  while (len > 0 && millis() - startMillis < timeout_ms) {
+    int avail = stream.available();
+    if (avail <= 0) {
+      TINY_GSM_YIELD_FOR(TinyGsmRemaining(startMillis, timeout_ms), TINY_GSM_WAIT_DATA);
+      continue;
+    }
+    uint8_t* p;
+    size_t   n;
+    if (dst_size > 0) {
+      p = dst;
+      n = dst_size;
+    } else {
+      int span;
+      p = fifo.writeSpan(span);
+      n = span;
+      if (n == 0) {
+        p = overflow;
+        n = sizeof(overflow);
+      }
+    }
+    n = TinyGsmMin(n, TinyGsmMin(len, (size_t)avail));
+    n = stream.readBytes((char*)p, n);
+    if (p == dst) {
+      dst += n;
+      dst_size -= n;
+      stored += n;
+    } else if (p != overflow) {
+      fifo.commitWrite(n);
+      stored += n;
+    }
+    len -= n;
+    startMillis = millis();
+  }
+  return stored;
+}
+
+// Like TinyGsmStreamToFifo, for a payload sent as hex digits (i.e. what
+// +CIPRXGET=3 returns): len is the number of decoded bytes, so 2*len chars
+// are read from the stream.  Whole spans are read and decoded in place of
+// a strtol() per byte.  If malformed isn't NULL, it's set to the number of
+// bytes that had a non-hex digit.
+template<class F>
+size_t TinyGsmHexToFifo(Stream& stream, size_t len, F& fifo, uint32_t timeout_ms,
+                        uint8_t* dst = NULL, size_t dst_size = 0,
+                        size_t* malformed = NULL)
+{
+  char     hex[64];
+  uint8_t  overflow[sizeof(hex) / 2];
+  size_t   held = 0;  // a digit read without its partner, kept in hex[0]
+  size_t   stored = 0;
+  size_t   bad = 0;
+  uint32_t startMillis = millis();
+  while (len > 0 && millis() - startMillis < timeout_ms) {
+    // Only whole pairs, an odd digit waits for its partner
+    int avail = (stream.available() + held) / 2;
+    if (avail <= 0) {
+      TINY_GSM_YIELD_FOR(TinyGsmRemaining(startMillis, timeout_ms), TINY_GSM_WAIT_DATA);
+      continue;
+    }
+    uint8_t* p;
+    size_t   n;
+    if (dst_size > 0) {
+      p = dst;
+      n = dst_size;
+    } else {
+      int span;
+      p = fifo.writeSpan(span);
+      n = span;
+      if (n == 0) {
+        p = overflow;
+        n = sizeof(overflow);
+      }
+    }
+    n = TinyGsmMin(n, TinyGsmMin(len, (size_t)avail));
+    n = TinyGsmMin(n, sizeof(hex) / 2);
+    // A short read can end between the digits of a pair, the odd one is
+    // kept for the next read
+    size_t got = held + stream.readBytes(hex + held, n * 2 - held);
+    n = got / 2;
+    bad += TinyGsmDecodeHex(hex, p, n);
+    held = got % 2;
+    if (held) hex[0] = hex[got - 1];
+    if (p == dst) {
+      dst += n;
+      dst_size -= n;
+      stored += n;
+    } else if (p != overflow) {
+      fifo.commitWrite(n);
+      stored += n;
+    }
+    len -= n;
+    startMillis = millis();
+  }
+  if (malformed) {
+    *malformed = bad;
+  }
+  return stored;
+}
+
+// Size of the modem-wide receive staging area, 0 (off) by default.
+// Without it a read from the modem can't be larger than what fits in the
+// socket's rx fifo (TINY_GSM_RX_BUFFER), so a single 1460 byte TCP segment
+// takes some 23 round trips with the default 64 byte fifo.  With it a read
+// asks for up to the modem's full chunk (TINY_GSM_MAX_READ_CHUNK) and what
+// doesn't fit the fifo waits here.  It takes its size in RAM, once per
+// modem, on top of the sockets' fifos: the modem's TINY_GSM_MAX_READ_CHUNK
+// (1024 to 1500) takes a whole chunk in one read, smaller sizes take less.
+#ifndef TINY_GSM_RX_STAGING
+  #define TINY_GSM_RX_STAGING 0
+#endif
+
+#if TINY_GSM_RX_STAGING
+
+// Holds the overflow of one socket at a time.  Its data is always newer
+// than what's in that socket's rx fifo, so it's read after the fifo.
+template<unsigned N>
+class TinyGsmRxStaging
+{
+public:
+  TinyGsmRxStaging() {
+    _mux = -1;
+  }
+
+  int size(uint8_t mux) {
+    return (_mux == mux) ? _fifo.size() : 0;
+  }
+
+  // Room for this socket's data, none while another socket's data waits
+  int free(uint8_t mux) {
+    return (_mux == mux || !_fifo.size()) ? _fifo.free() : 0;
+  }
+
+  bool put(uint8_t mux, uint8_t c) {
+    if (!free(mux)) return false;
+    _mux = mux;
+    return _fifo.put(c);
+  }
+
+  int get(uint8_t mux, uint8_t* p, int n) {
+    return size(mux) ? _fifo.get(p, n) : 0;
+  }
+
+  bool peek(uint8_t mux, uint8_t* p) {
+    return size(mux) && _fifo.peek(p);
+  }
+
+  void clear(uint8_t mux) {
+    if (_mux == mux) _fifo.clear();
+  }
+
+  uint8_t* writeSpan(uint8_t mux, int& n) {
+    n = 0;
+    if (!free(mux)) return NULL;
+    _mux = mux;
+    return _fifo.writeSpan(n);
+  }
+
+  void commitWrite(int n) {
+    _fifo.commitWrite(n);
+  }
+
+private:
+  TinyGsmFifo<uint8_t, N> _fifo;
+  int8_t                  _mux;
+};
+
+// A socket's rx fifo followed by the staging area, as one fifo
+template<class F, class S>
+class TinyGsmRxChain
+{
+public:
+  TinyGsmRxChain(F& rx, S& staging, uint8_t mux)
+    : _rx(rx), _staging(staging), _mux(mux), _staged(false)
+  {}
+
+  uint8_t* writeSpan(int& n) {
+    uint8_t* p = NULL;
+    n = 0;
+    // Once something is staged, the rest must follow it, not the fifo
+    if (!_staging.size(_mux)) {
+      p = _rx.writeSpan(n);
+    }
+    _staged = (n == 0);
+    if (_staged) {
+      p = _staging.writeSpan(_mux, n);
+    }
+    return p;
+  }
+
+  void commitWrite(int n) {
+    if (_staged) {
+      _staging.commitWrite(n);
+    } else {
+      _rx.commitWrite(n);
+    }
+  }
+
+private:
+  F&      _rx;
+  S&      _staging;
+  uint8_t _mux;
+  bool    _staged;
+};
+
+template<class F, class S>
+size_t TinyGsmStreamToRx(Stream& stream, size_t len, F& rx, S& staging, uint8_t mux,
+                         uint32_t timeout_ms, uint8_t* dst, size_t dst_size)
+{
+  TinyGsmRxChain<F, S> chain(rx, staging, mux);
+  return TinyGsmStreamToFifo(stream, len, chain, timeout_ms, dst, dst_size);
+}
+
+template<class F, class S>
+size_t TinyGsmHexToRx(Stream& stream, size_t len, F& rx, S& staging, uint8_t mux,
+                      uint32_t timeout_ms, uint8_t* dst, size_t dst_size,
+                      size_t* malformed)
+{
+  TinyGsmRxChain<F, S> chain(rx, staging, mux);
+  return TinyGsmHexToFifo(stream, len, chain, timeout_ms, dst, dst_size, malformed);
+}
+
+  #define TINY_GSM_CLIENT_STAGED()        at->staging.size(mux)
+  #define TINY_GSM_CLIENT_STAGING_FREE()  at->staging.free(mux)
+  #define TINY_GSM_CLIENT_CLEAR_STAGED()  at->staging.clear(mux);
+  #define TINY_GSM_CLIENT_PEEK_STAGED() \
+    if (at->staging.peek(mux, &c)) { \
+      return c; \
+    }
+  #define TINY_GSM_CLIENT_READ_STAGED() \
+      chunk = TinyGsmMin(size-cnt, (size_t)at->staging.size(mux)); \
+      if (chunk > 0) { \
+        at->staging.get(mux, buf, chunk); \
+        buf += chunk; \
+        cnt += chunk; \
+        continue; \
+      }
+  #define TINY_GSM_MODEM_RX_STAGING() \
+    TinyGsmRxStaging<TINY_GSM_RX_STAGING> staging;
+#else
+  #define TINY_GSM_CLIENT_STAGED()        0
+  #define TINY_GSM_CLIENT_STAGING_FREE()  0
+  #define TINY_GSM_CLIENT_CLEAR_STAGED()
+  #define TINY_GSM_CLIENT_PEEK_STAGED()
+  #define TINY_GSM_CLIENT_READ_STAGED()
+  #define TINY_GSM_MODEM_RX_STAGING()
+#endif
+
 template<class T>
 uint32_t TinyGsmAutoBaud(T& SerialAT, uint32_t minimum = 9600, uint32_t maximum = 115200)
 {
@@ -138,68 +1290,176 @@ IPAddress TinyGsmIpFromString(const String& strIP) {
   return IPAddress(Parts[0], Parts[1], Parts[2], Parts[3]);
 }
 
+// Writes ip as "a.b.c.d" into buf, which needs room for 16 chars
+static inline
+char* TinyGsmIpToString(IPAddress ip, char* buf) {
+  char* p = buf;
+  for (uint8_t i = 0; i < 4; i++) {
+    uint8_t b = ip[i];
+    if (i) *p++ = '.';
+    if (b >= 100) *p++ = '0' + b / 100;
+    if (b >= 10)  *p++ = '0' + (b / 10) % 10;
+    *p++ = '0' + b % 10;
+  }
+  *p = '\0';
+  return buf;
+}
+
+// True if host is a dotted IPv4 address, that needs no lookup
+static inline
+bool TinyGsmIsIp(const char* host) {
+  uint8_t dots = 0;
+  for (; *host; host++) {
+    if (*host == '.') {
+      dots++;
+    } else if (*host < '0' || *host > '9') {
+      return false;
+    }
+  }
+  return dots == 3;
+}
+
+// Number of host names the modem keeps the address of, so connecting to
+// the same host again goes straight to its IP address.  With 0, host
+// names are left to the modem's connect command, as before.
+#ifndef TINY_GSM_DNS_CACHE
+  #define TINY_GSM_DNS_CACHE 0
+#endif
+
+// How long a looked up address is used, if the modem doesn't tell
+#ifndef TINY_GSM_DNS_TTL_S
+  #define TINY_GSM_DNS_TTL_S 300
+#endif
+
+// Longest host name that's kept, longer ones are looked up every time
+#ifndef TINY_GSM_DNS_HOST_LEN
+  #define TINY_GSM_DNS_HOST_LEN 48
+#endif
+
+// Host name to IP address entries with a time to live.  When it's full the
+// least recently used one makes room.
+template <uint8_t N>
+class TinyGsmDnsCache
+{
+public:
+  TinyGsmDnsCache() {
+    clear();
+  }
+
+  void clear() {
+    for (uint8_t i = 0; i < N; i++) {
+      _e[i].host[0] = '\0';
+    }
+    _uses = 0;
+  }
+
+  // The address of host, if it's there and still fresh
+  bool lookup(const char* host, IPAddress& ip) {
+    Entry* e = find(host);
+    if (!e) return false;
+    if (millis() - e->stored >= e->ttl_ms) {
+      e->host[0] = '\0';
+      return false;
+    }
+    e->used = ++_uses;
+    ip = IPAddress(e->ip[0], e->ip[1], e->ip[2], e->ip[3]);
+    return true;
+  }
+
+  void store(const char* host, IPAddress ip, uint32_t ttl_s) {
+    if (!N || !ttl_s || strlen(host) >= TINY_GSM_DNS_HOST_LEN) return;
+    Entry* e = find(host);
+    if (!e) {
+      e = &_e[0];
+      for (uint8_t i = 1; i < N && e->host[0]; i++) {
+        if (!_e[i].host[0] || _e[i].used < e->used) e = &_e[i];
+      }
+      strcpy(e->host, host);
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+      e->ip[i] = ip[i];
+    }
+    if (ttl_s > 86400L) ttl_s = 86400L;
+    e->ttl_ms = ttl_s * 1000;
+    e->stored = millis();
+    e->used = ++_uses;
+  }
+
+  // Drops host, i.e. after connecting to its address failed
+  void forget(const char* host) {
+    Entry* e = find(host);
+    if (e) e->host[0] = '\0';
+  }
+
+private:
+  struct Entry {
+    char     host[TINY_GSM_DNS_HOST_LEN];
+    uint8_t  ip[4];
+    uint32_t stored;
+    uint32_t ttl_ms;
+    uint32_t used;
+  };
+
+  Entry* find(const char* host) {
+    for (uint8_t i = 0; i < N; i++) {
+      if (_e[i].host[0] && !strcasecmp(_e[i].host, host)) return &_e[i];
+    }
+    return NULL;
+  }
+
+  Entry    _e[N ? N : 1];
+  uint32_t _uses;
+};
+
+// Longest hex text of a USSD response that's kept, see TinyGsmDecodeUssd
+#ifndef TINY_GSM_USSD_BUFFER
+  #define TINY_GSM_USSD_BUFFER 368
+#endif
+
+// Decodes the "<text>",<dcs> of a +CUSD: response, read with +CSCS="HEX"
+// into hex (len digits, decoded in place).  dcs 15 is GSM 7 bit text, that
+// some modems hand out still packed, 72 is UCS-2.  Anything else is
+// returned as it came.
+static inline
+String TinyGsmDecodeUssd(char* hex, size_t len, int dcs, bool packed = false) {
+  String res;
+  res.reserve(len);
+  TinyGsmStringSink out(res);
+  uint8_t* data = (uint8_t*)hex;
+  size_t   n = len / 2;
+  if (dcs == 15 && packed) {
+    TinyGsmDecodeHex(hex, data, n);
+    TinyGsmPrintGsm7(out, data, n);
+  } else if (dcs == 15) {
+    TinyGsmDecodeHex(hex, data, n);
+    out.write(data, n);
+  } else if (dcs == 72) {
+    TinyGsmDecodeHex(hex, data, n);
+    TinyGsmPrintUcs2(out, data, n);
+  } else {
+    out.write(data, len);
+  }
+  return res;
+}
+
+// The String based decoders TinyGSM had before TinyGsmCodec.h, for the
+// sketches that call them.  instr holds the hex digits and is left alone.
 static inline
 String TinyGsmDecodeHex7bit(String &instr) {
-  String result;
-  byte reminder = 0;
-  int bitstate = 7;
-  for (unsigned i=0; i<instr.length(); i+=2) {
-    char buf[4] = { 0, };
-    buf[0] = instr[i];
-    buf[1] = instr[i+1];
-    byte b = strtol(buf, NULL, 16);
-
-    byte bb = b << (7 - bitstate);
-    char c = (bb + reminder) & 0x7F;
-    result += c;
-    reminder = b >> bitstate;
-    bitstate--;
-    if (bitstate == 0) {
-      char c = reminder;
-      result += c;
-      reminder = 0;
-      bitstate = 7;
-    }
-  }
-  return result;
+  String hex = instr;
+  return TinyGsmDecodeUssd((char*)hex.c_str(), hex.length(), 15, true);
 }
 
 static inline
 String TinyGsmDecodeHex8bit(String &instr) {
-  String result;
-  for (unsigned i=0; i<instr.length(); i+=2) {
-    char buf[4] = { 0, };
-    buf[0] = instr[i];
-    buf[1] = instr[i+1];
-    char b = strtol(buf, NULL, 16);
-    result += b;
-  }
-  return result;
+  String hex = instr;
+  return TinyGsmDecodeUssd((char*)hex.c_str(), hex.length(), 15);
 }
 
 static inline
 String TinyGsmDecodeHex16bit(String &instr) {
-  String result;
-  for (unsigned i=0; i<instr.length(); i+=4) {
-    char buf[4] = { 0, };
-    buf[0] = instr[i];
-    buf[1] = instr[i+1];
-    char b = strtol(buf, NULL, 16);
-    if (b) { // If high byte is non-zero, we can't handle it ;(
-#if defined(TINY_GSM_UNICODE_TO_HEX)
-      result += "\\x";
-      result += instr.substring(i, i+4);
-#else
-      result += "?";
-#endif
-    } else {
-      buf[0] = instr[i+2];
-      buf[1] = instr[i+3];
-      b = strtol(buf, NULL, 16);
-      result += b;
-    }
-  }
-  return result;
+  String hex = instr;
+  return TinyGsmDecodeUssd((char*)hex.c_str(), hex.length(), 72);
 }
 
 
@@ -225,12 +1485,139 @@ String TinyGsmDecodeHex16bit(String &instr) {
   }
 
 
+// Status of a connect started with connectAsync().  Drives the modem while
+// one is pending, so calling this from loop() is all it takes.
+#define TINY_GSM_CLIENT_POLL_CONNECT() \
+  ConnectStatus pollConnect() { \
+    if (connecting.pending()) { \
+      at->maintain(); \
+    } \
+    return connecting.status; \
+  }
+
+
+// For modems without a non-blocking connect: connectAsync() just connects,
+// and pollConnect() has the outcome right away.
+#define TINY_GSM_CLIENT_CONNECT_ASYNC_BLOCKING() \
+  virtual bool connectAsync(const char *host, uint16_t port, int timeout_s = 75) { \
+    bool ok = connect(host, port, timeout_s); \
+    connecting.start(0); \
+    connecting.finish(ok); \
+    return true; \
+  } \
+  \
+  ConnectStatus pollConnect() { \
+    return connecting.status; \
+  }
+
+
 // Writes data out on the client using the modem send functionality
+// When there's a transmit buffer, small writes are collected in it, and
+// writes that are at least as large as the buffer skip it.
+// A send that fails, also one of buffered data whose write() already
+// returned, sets the write error (getWriteError()).  From then on write()
+// returns 0, until the socket is stopped or clearWriteError() is called.
 #define TINY_GSM_CLIENT_WRITE() \
   virtual size_t write(const uint8_t *buf, size_t size) { \
     TINY_GSM_YIELD(); \
     at->maintain(); \
-    return at->modemSend(buf, size, mux); \
+    if (getWriteError()) return 0; \
+    size_t cnt = 0; \
+    while (cnt < size) { \
+      if (!tx.size() && size - cnt >= tx.capacity()) { \
+        return cnt + sendNow(buf + cnt, size - cnt); \
+      } \
+      size_t n = tx.append(buf + cnt, size - cnt); \
+      if (tx.free()) { \
+        cnt += n; \
+        continue; \
+      } \
+      size_t held = tx.size() - n;  /* left there by earlier writes */ \
+      size_t sent = flushTx(); \
+      if (sent < held + n) { \
+        /* What didn't go out of this write is dropped with the buffer */ \
+        if (sent > held) cnt += sent - held; \
+        break; \
+      } \
+      cnt += n; \
+    } \
+    return cnt; \
+  } \
+  \
+  /* Sends the segments through the transmit buffer, so i.e. a header and
+  a body go out together in as few modem sends as possible.  Without a
+  transmit buffer, the segments that fit go through one on the stack. */ \
+  size_t write(const TinyGsmTxSegment* segments, uint8_t count) { \
+    if (!tx.capacity()) { \
+      TinyGsmTxBuffer<TINY_GSM_TX_GATHER> gather; \
+      return writeGathered(gather, segments, count); \
+    } \
+    size_t cnt = 0; \
+    for (uint8_t i = 0; i < count; i++) { \
+      size_t n = write((const uint8_t*)segments[i].data, segments[i].len); \
+      cnt += n; \
+      if (n < segments[i].len) break; \
+    } \
+    sendTx(); \
+    return cnt; \
+  } \
+  \
+  template<class B> \
+  size_t writeGathered(B& gather, const TinyGsmTxSegment* segments, uint8_t count) { \
+    TINY_GSM_YIELD(); \
+    at->maintain(); \
+    if (getWriteError()) return 0; \
+    size_t cnt = 0; \
+    for (uint8_t i = 0; i <= count; i++) { \
+      size_t len = (i < count) ? segments[i].len : 0; \
+      if (gather.size() && (i == count || len > gather.free())) { \
+        size_t size = gather.size(); \
+        size_t sent = sendNow(gather.data(), size); \
+        gather.clear(); \
+        cnt += sent; \
+        if (sent < size) break; \
+      } \
+      if (i == count) break; \
+      if (len > gather.capacity()) { \
+        size_t sent = sendNow((const uint8_t*)segments[i].data, len); \
+        cnt += sent; \
+        if (sent < len) break; \
+      } else { \
+        gather.append((const uint8_t*)segments[i].data, len); \
+      } \
+    } \
+    return cnt; \
+  } \
+  \
+  /* Sends what's waiting in the transmit buffer */ \
+  bool sendTx() { \
+    size_t size = tx.size(); \
+    return flushTx() == size; \
+  } \
+  \
+  /* Sends what's left before the socket closes, the next connection
+  starts without the write error */ \
+  void closeTx() { \
+    sendTx(); \
+    clearWriteError(); \
+  } \
+  \
+  /* Sends and empties the transmit buffer, returning the bytes sent */ \
+  size_t flushTx() { \
+    if (!tx.size()) return 0; \
+    size_t sent = sendNow(tx.data(), tx.size()); \
+    tx.clear(); \
+    return sent; \
+  } \
+  \
+  size_t sendNow(const uint8_t* buf, size_t size) { \
+    size_t sent = at->modemSend(buf, size, mux); \
+    TINY_GSM_STATS_SOCKET(at, bytesSent, mux, sent); \
+    if (sent < size) { \
+      DBG("### Send failed:", mux, sent, "of", size); \
+      setWriteError(); \
+    } \
+    return sent; \
   } \
   \
   virtual size_t write(uint8_t c) {\
@@ -246,20 +1633,24 @@ String TinyGsmDecodeHex16bit(String &instr) {
 // Returns the combined number of characters available in the TinyGSM fifo
 // and the modem chips internal fifo, doing an extra check-in with the
 // modem to see if anything has arrived without a UURC.
+// How often that happens is tuned with setPollInterval(), see
+// TinyGsmPollTimer.
 #define TINY_GSM_CLIENT_AVAILABLE_WITH_BUFFER_CHECK() \
   virtual int available() { \
     TINY_GSM_YIELD(); \
-    if (!rx.size()) { \
-      /* Workaround: sometimes module forgets to notify about data arrival.
-      TODO: Currently we ping the module periodically,
-      but maybe there's a better indicator that we need to poll */ \
-      if (millis() - prev_check > 500) { \
+    sendTx(); \
+    if (!rx.size() && !TINY_GSM_CLIENT_STAGED()) { \
+      /* Workaround: sometimes module forgets to notify about data arrival */ \
+      if (poll.due()) { \
         got_data = true; \
-        prev_check = millis(); \
       } \
       at->maintain(); \
     } \
-    return rx.size() + sock_available; \
+    return rx.size() + TINY_GSM_CLIENT_STAGED() + sock_available; \
+  } \
+  \
+  void setPollInterval(uint32_t min_ms, uint32_t max_ms) { \
+    poll.setInterval(min_ms, max_ms); \
   }
 
 
@@ -268,10 +1659,11 @@ String TinyGsmDecodeHex16bit(String &instr) {
 #define TINY_GSM_CLIENT_AVAILABLE_NO_BUFFER_CHECK() \
   virtual int available() { \
     TINY_GSM_YIELD(); \
-    if (!rx.size()) { \
+    sendTx(); \
+    if (!rx.size() && !TINY_GSM_CLIENT_STAGED()) { \
       at->maintain(); \
     } \
-    return rx.size() + sock_available; \
+    return rx.size() + TINY_GSM_CLIENT_STAGED() + sock_available; \
   }
 
 
@@ -280,6 +1672,7 @@ String TinyGsmDecodeHex16bit(String &instr) {
 #define TINY_GSM_CLIENT_AVAILABLE_NO_MODEM_FIFO() \
   virtual int available() { \
     TINY_GSM_YIELD(); \
+    sendTx(); \
     if (!rx.size() && sock_connected) { \
       at->maintain(); \
     } \
@@ -296,12 +1689,33 @@ String TinyGsmDecodeHex16bit(String &instr) {
     return -1; \
   }
 
+// Peeks at the TinyGSM fifo, first pulling what fits from the modem chips
+// internal fifo if there's nothing in it
+#define TINY_GSM_CLIENT_PEEK_MODEM_FIFO() \
+  virtual int peek() { \
+    uint8_t c; \
+    if (!rx.size() && !TINY_GSM_CLIENT_STAGED()) { \
+      at->maintain(); \
+      if (sock_available > 0) { \
+        size_t want = rx.free() + TINY_GSM_CLIENT_STAGING_FREE(); \
+        want = TinyGsmMin(want, (size_t)sock_available); \
+        at->modemRead(TinyGsmMin(want, (size_t)TINY_GSM_MAX_READ_CHUNK), mux); \
+      } \
+    } \
+    if (rx.peek(&c)) { \
+      return c; \
+    } \
+    TINY_GSM_CLIENT_PEEK_STAGED() \
+    return -1; \
+  }
+
 // Reads characters out of the TinyGSM fifo, and from the modem chips internal
 // fifo if avaiable, also double checking with the modem if data has arrived
 // without issuing a UURC.
 #define TINY_GSM_CLIENT_READ_WITH_BUFFER_CHECK() \
   virtual int read(uint8_t *buf, size_t size) { \
     TINY_GSM_YIELD(); \
+    sendTx(); \
     at->maintain(); \
     size_t cnt = 0; \
     while (cnt < size) { \
@@ -312,25 +1726,34 @@ String TinyGsmDecodeHex16bit(String &instr) {
         cnt += chunk; \
         continue; \
       } \
-      /* Workaround: sometimes module forgets to notify about data arrival.
-      TODO: Currently we ping the module periodically,
-      but maybe there's a better indicator that we need to poll */ \
-      if (millis() - prev_check > 500) { \
+      TINY_GSM_CLIENT_READ_STAGED() \
+      /* Workaround: sometimes module forgets to notify about data arrival */ \
+      if (poll.due()) { \
         got_data = true; \
-        prev_check = millis(); \
       } \
-      /* TODO: Read directly into user buffer? */ \
       at->maintain(); \
       if (sock_available > 0) { \
-        int n = at->modemRead(TinyGsmMin((uint16_t)rx.free(), sock_available), mux); \
+        /* Ask for what the caller still wants plus what fits in rx and
+        the staging area: the first part goes straight into buf, only the
+        leftovers into rx */ \
+        size_t want = size - cnt + rx.free() + TINY_GSM_CLIENT_STAGING_FREE(); \
+        want = TinyGsmMin(want, (size_t)sock_available); \
+        want = TinyGsmMin(want, (size_t)TINY_GSM_MAX_READ_CHUNK); \
+        size_t n = at->modemRead(want, mux, buf, size - cnt); \
         if (n == 0) break; \
+        poll.checked(true); \
+        n = TinyGsmMin(n, size - cnt); \
+        buf += n; \
+        cnt += n; \
       } else { \
         break; \
       } \
     } \
+    TINY_GSM_STATS_SOCKET(at, bytesReceived, mux, cnt); \
     return cnt; \
   } \
-  TINY_GSM_CLIENT_READ_OVERLOAD()
+  TINY_GSM_CLIENT_READ_OVERLOAD() \
+  TINY_GSM_CLIENT_PEEK_MODEM_FIFO()
 
 
 // Reads characters out of the TinyGSM fifo, and from the modem chips internal
@@ -338,6 +1761,7 @@ String TinyGsmDecodeHex16bit(String &instr) {
 #define TINY_GSM_CLIENT_READ_NO_BUFFER_CHECK() \
   virtual int read(uint8_t *buf, size_t size) { \
     TINY_GSM_YIELD(); \
+    sendTx(); \
     at->maintain(); \
     size_t cnt = 0; \
     while (cnt < size) { \
@@ -348,18 +1772,29 @@ String TinyGsmDecodeHex16bit(String &instr) {
         cnt += chunk; \
         continue; \
       } \
-      /* TODO: Read directly into user buffer? */ \
+      TINY_GSM_CLIENT_READ_STAGED() \
       at->maintain(); \
       if (sock_available > 0) { \
-        int n = at->modemRead(TinyGsmMin((uint16_t)rx.free(), sock_available), mux); \
+        /* Ask for what the caller still wants plus what fits in rx and
+        the staging area: the first part goes straight into buf, only the
+        leftovers into rx */ \
+        size_t want = size - cnt + rx.free() + TINY_GSM_CLIENT_STAGING_FREE(); \
+        want = TinyGsmMin(want, (size_t)sock_available); \
+        want = TinyGsmMin(want, (size_t)TINY_GSM_MAX_READ_CHUNK); \
+        size_t n = at->modemRead(want, mux, buf, size - cnt); \
         if (n == 0) break; \
+        n = TinyGsmMin(n, size - cnt); \
+        buf += n; \
+        cnt += n; \
       } else { \
         break; \
       } \
     } \
+    TINY_GSM_STATS_SOCKET(at, bytesReceived, mux, cnt); \
     return cnt; \
   } \
-  TINY_GSM_CLIENT_READ_OVERLOAD()
+  TINY_GSM_CLIENT_READ_OVERLOAD() \
+  TINY_GSM_CLIENT_PEEK_MODEM_FIFO()
 
 
 // Reads characters out of the TinyGSM fifo, waiting for any URC's from the
@@ -368,6 +1803,7 @@ String TinyGsmDecodeHex16bit(String &instr) {
 #define TINY_GSM_CLIENT_READ_NO_MODEM_FIFO() \
   virtual int read(uint8_t *buf, size_t size) { \
     TINY_GSM_YIELD(); \
+    sendTx(); \
     size_t cnt = 0; \
     uint32_t _startMillis = millis(); \
     while (cnt < size && millis() - _startMillis < _timeout) { \
@@ -383,6 +1819,7 @@ String TinyGsmDecodeHex16bit(String &instr) {
         at->maintain(); \
       } \
     } \
+    TINY_GSM_STATS_SOCKET(at, bytesReceived, mux, cnt); \
     return cnt; \
   } \
   \
@@ -392,6 +1829,17 @@ String TinyGsmDecodeHex16bit(String &instr) {
       return c; \
     } \
     return -1; \
+  } \
+  \
+  virtual int peek() { \
+    uint8_t c; \
+    if (!rx.size() && sock_connected) { \
+      at->maintain(); \
+    } \
+    if (rx.peek(&c)) { \
+      return c; \
+    } \
+    return -1; \
   }
 
 
@@ -403,21 +1851,27 @@ String TinyGsmDecodeHex16bit(String &instr) {
 // that it wants from the socket even if it was closed externally.
 #define TINY_GSM_CLIENT_DUMP_MODEM_BUFFER() \
     TINY_GSM_YIELD(); \
+    closeTx(); \
     rx.clear(); \
+    TINY_GSM_CLIENT_CLEAR_STAGED() \
     at->maintain(); \
     unsigned long startMillis = millis(); \
     while (sock_available > 0 && (millis() - startMillis < maxWaitMs)) { \
-      at->modemRead(TinyGsmMin((uint16_t)rx.free(), sock_available), mux); \
+      size_t want = rx.free() + TINY_GSM_CLIENT_STAGING_FREE(); \
+      want = TinyGsmMin(want, (size_t)TINY_GSM_MAX_READ_CHUNK); \
+      at->modemRead(TinyGsmMin(want, (size_t)sock_available), mux); \
       rx.clear(); \
+      TINY_GSM_CLIENT_CLEAR_STAGED() \
       at->maintain(); \
     }
 
 
-// The peek, flush, and connected functions
-#define TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED() \
-  virtual int peek() { return -1; } /* TODO */ \
-  \
-  virtual void flush() { at->stream.flush(); } \
+// The flush and connected functions
+#define TINY_GSM_CLIENT_FLUSH_CONNECTED() \
+  virtual void flush() { \
+    sendTx(); \
+    at->stream.flush(); \
+  } \
   \
   virtual uint8_t connected() { \
     if (available()) { \
@@ -449,18 +1903,120 @@ String TinyGsmDecodeHex16bit(String &instr) {
 
 // Keeps listening for modem URC's and iterates through sockets
 // to see if any data is avaiable
+// Sends the transmit buffers whose data has waited long enough
+#if TINY_GSM_TX_BUFFER
+  #define TINY_GSM_MODEM_SEND_IDLE_TX() \
+    for (int i = 0; i < TINY_GSM_MUX_COUNT; i++) { \
+      if (sockets[i] && sockets[i]->tx.idle()) { \
+        sockets[i]->sendTx(); \
+      } \
+    }
+#else
+  #define TINY_GSM_MODEM_SEND_IDLE_TX()
+#endif
+
+// Fails the connects started with connectAsync() that ran out of time
+#define TINY_GSM_MODEM_CHECK_CONNECTS() \
+    for (int mux = 0; mux < TINY_GSM_MUX_COUNT; mux++) { \
+      if (sockets[mux] && sockets[mux]->connecting.expired()) { \
+        DBG("### Connect timed out:", mux); \
+        sockets[mux]->connecting.finish(false); \
+        sockets[mux]->stop(); \
+      } \
+    }
+
+
+// Finishes a connect started with connectAsync(), from its URC.  Returns
+// false if the socket had none pending, a blocking connect is then waiting
+// for the URC itself.
+#define TINY_GSM_MODEM_CONNECT_DONE() \
+  bool modemConnectDone(int mux, bool ok) { \
+    if (mux < 0 || mux >= TINY_GSM_MUX_COUNT || !sockets[mux]) { \
+      return false; \
+    } \
+    if (!sockets[mux]->connecting.finish(ok)) { \
+      return false; \
+    } \
+    sockets[mux]->sock_connected = ok; \
+    DBG(ok ? "### Connected:" : "### Connect failed:", mux); \
+    return true; \
+  }
+
+
+// The sockets that were told about new data get their available bytes
+// with a single modemUpdateAvailable() call.  Those that turn out to have
+// no data left get their connection state refreshed, all with a single
+// modemUpdateConnected() call.
 #define TINY_GSM_MODEM_MAINTAIN_CHECK_SOCKS() \
   void maintain() { \
+    uint16_t flagged = 0; \
+    uint16_t drained = 0; \
     for (int mux = 0; mux < TINY_GSM_MUX_COUNT; mux++) { \
       GsmClient* sock = sockets[mux]; \
-      if (sock && sock->got_data) { \
+      if (sock && sock->got_data && !sock->connecting.pending()) { \
         sock->got_data = false; \
-        sock->sock_available = modemGetAvailable(mux); \
+        flagged |= 1U << mux; \
+      } \
+    } \
+    if (flagged) { \
+      modemUpdateAvailable(flagged); \
+    } \
+    for (int mux = 0; mux < TINY_GSM_MUX_COUNT; mux++) { \
+      GsmClient* sock = sockets[mux]; \
+      if ((flagged & (1U << mux)) && sock) { \
+        sock->poll.checked(sock->sock_available > 0); \
+        if (!sock->sock_available) drained |= 1U << mux; \
       } \
     } \
+    if (drained) { \
+      modemUpdateConnected(drained); \
+    } \
+    TINY_GSM_MODEM_SEND_IDLE_TX() \
     while (stream.available()) { \
       waitResponse(15, NULL, NULL); \
     } \
+    TINY_GSM_MODEM_CHECK_CONNECTS() \
+  }
+
+
+// Asks for the bytes waiting on every socket in muxes with one command
+// line, "AT<query><mux><tail>;<query><mux><tail>;...", instead of one line
+// per socket.  The answers come in the order asked, each as rsp followed
+// by skip fields before the length.  The modem stops at the first query
+// that fails, i.e. for a socket it has already closed, so the sockets from
+// that one on are asked one by one.
+#define TINY_GSM_MODEM_UPDATE_AVAILABLE(query, tail, rsp, skip) \
+  void modemUpdateAvailable(uint16_t muxes) { \
+    TinyGsmAtBatch<TINY_GSM_MUX_COUNT * 16> batch(false); \
+    for (int mux = 0; mux < TINY_GSM_MUX_COUNT; mux++) { \
+      if ((muxes & (1U << mux)) && sockets[mux]) { \
+        batch.add(GF(query), mux, GF(tail)); \
+      } \
+    } \
+    int mux = 0; \
+    if (batch.count() > 1) { \
+      sendAT(batch.c_str()); \
+      for (; mux < TINY_GSM_MUX_COUNT; mux++) { \
+        if (!(muxes & (1U << mux)) || !sockets[mux]) { \
+          continue; \
+        } \
+        if (waitResponse(GF(rsp), GFP(GSM_OK), GFP(GSM_ERROR)) != 1) { \
+          break; \
+        } \
+        for (int i = 0; i < (skip); i++) { \
+          streamSkipUntil(','); \
+        } \
+        sockets[mux]->sock_available = stream.readStringUntil('\n').toInt(); \
+      } \
+      if (mux == TINY_GSM_MUX_COUNT) { \
+        waitResponse(); \
+      } \
+    } \
+    for (; mux < TINY_GSM_MUX_COUNT; mux++) { \
+      if ((muxes & (1U << mux)) && sockets[mux]) { \
+        sockets[mux]->sock_available = modemGetAvailable(mux); \
+      } \
+    } \
   }
 
 
@@ -468,6 +2024,7 @@ String TinyGsmDecodeHex16bit(String &instr) {
 // modem has no internal fifo
 #define TINY_GSM_MODEM_MAINTAIN_LISTEN() \
   void maintain() { \
+    TINY_GSM_MODEM_SEND_IDLE_TX() \
     waitResponse(100, NULL, NULL); \
   }
 
@@ -587,6 +2144,191 @@ String TinyGsmDecodeHex16bit(String &instr) {
   }
 
 
+// Host name lookups by the modem's own DNS command, modemLookup(), kept in
+// dns_cache for up to the record's time to live
+#define TINY_GSM_MODEM_DNS() \
+  IPAddress lookupHostIP(const char* host, int timeout_s = 45) { \
+    uint32_t ttl_s = TINY_GSM_DNS_TTL_S; \
+    return modemLookup(host, ttl_s, timeout_s); \
+  } \
+  \
+  /* Like lookupHostIP(), but answers from the cache while it can */ \
+  IPAddress resolveHost(const char* host, int timeout_s = 45) { \
+    IPAddress ip(0,0,0,0); \
+    if (dns_cache.lookup(host, ip)) { \
+      return ip; \
+    } \
+    uint32_t ttl_s = TINY_GSM_DNS_TTL_S; \
+    ip = modemLookup(host, ttl_s, timeout_s); \
+    if (ip != IPAddress(0,0,0,0)) { \
+      dns_cache.store(host, ip, ttl_s); \
+    } \
+    return ip; \
+  } \
+  \
+  void clearDnsCache() { \
+    dns_cache.clear(); \
+  }
+
+
+// The DNS servers the modem looks names up with, instead of the network's
+// ones (0.0.0.0 for those).  Set right away, which some modems only take
+// with the data connection up, and again by every gprsConnect().
+#define TINY_GSM_MODEM_DNS_SERVERS() \
+  bool setDnsServers(IPAddress primary, IPAddress secondary = IPAddress(0,0,0,0)) { \
+    dns_primary = primary; \
+    dns_secondary = secondary; \
+    return modemSetDns(); \
+  }
+
+
+// What a connect to host is sent to: its address from resolveHost(), as
+// text in addr (16 chars), when there's a DNS cache.  Secure connections
+// keep the name, the modem needs it for the certificate check and SNI, and
+// so does a host the modem couldn't look up, it may still manage itself.
+#define TINY_GSM_MODEM_HOST_ADDRESS() \
+  const char* modemHostAddress(const char* host, char* addr, bool ssl) { \
+    if (!TINY_GSM_DNS_CACHE || ssl || TinyGsmIsIp(host)) { \
+      return host; \
+    } \
+    IPAddress ip = resolveHost(host); \
+    if (ip == IPAddress(0,0,0,0)) { \
+      return host; \
+    } \
+    return TinyGsmIpToString(ip, addr); \
+  }
+
+
+// Looks host up with AT+CDNSGIP, the first address of its
+// +CDNSGIP: 1,"<host>","<IP1>"[,"<IP2>"] is used.  Some modems send that
+// after the OK, as a URC.
+#define TINY_GSM_MODEM_LOOKUP_CDNSGIP() \
+  IPAddress modemLookup(const char* host, uint32_t& /*ttl_s*/, int timeout_s) { \
+    sendAT(GF("+CDNSGIP=\""), host, '"'); \
+    if (waitResponse(((uint32_t)timeout_s)*1000, GF("+CDNSGIP:")) != 1) { \
+      return IPAddress(0,0,0,0); \
+    } \
+    if (stream.readStringUntil(',').toInt() != 1) { \
+      streamSkipUntil('\n');  /* <err> */ \
+      return IPAddress(0,0,0,0); \
+    } \
+    streamSkipUntil(',');  /* "<host>" */ \
+    streamSkipUntil('"'); \
+    String ip = stream.readStringUntil('"'); \
+    streamSkipUntil('\n'); \
+    return TinyGsmIpFromString(ip); \
+  }
+
+
+// Sets the DNS servers with AT+CDNSCFG
+#define TINY_GSM_MODEM_SET_DNS_CDNSCFG() \
+  bool modemSetDns() { \
+    if (dns_primary == IPAddress(0,0,0,0)) { \
+      return true; \
+    } \
+    char primary[16]; \
+    char secondary[16]; \
+    TinyGsmIpToString(dns_primary, primary); \
+    if (dns_secondary == IPAddress(0,0,0,0)) { \
+      sendAT(GF("+CDNSCFG=\""), primary, '"'); \
+    } else { \
+      sendAT(GF("+CDNSCFG=\""), primary, GF("\",\""), TinyGsmIpToString(dns_secondary, secondary), '"'); \
+    } \
+    return waitResponse() == 1; \
+  }
+
+
+// The APN of PDP context 1, from +CGDCONT: 1,"<PDP_type>","<APN>",...
+#define TINY_GSM_MODEM_GET_APN_CGDCONT() \
+  String modemGetApn() { \
+    sendAT(GF("+CGDCONT?")); \
+    if (waitResponse(GF(GSM_NL "+CGDCONT: 1,")) != 1) { \
+      return ""; \
+    } \
+    streamSkipUntil(',');  /* "<PDP_type>" */ \
+    streamSkipUntil('"'); \
+    String apn = stream.readStringUntil('"'); \
+    waitResponse(); \
+    return apn; \
+  }
+
+
+// Certificates for u-blox's security manager, +USECMNG.  It keeps the MD5
+// of every certificate it holds, so provisionCertificate() only imports
+// one when that's different, and checks the MD5 of what it imported.
+// These MD5's are of the certificate as stored, in DER, so it should also
+// be given in DER.  Secure sockets use security profile 0, which is set to
+// use the certificate (and, for a CA, to check servers against it).
+#define TINY_GSM_MODEM_CERT_USECMNG() \
+  bool provisionCertificate(const char* name, const TinyGsmCertSource& cert, \
+                            TinyGsmCertType type = TINY_GSM_CERT_CA) { \
+    uint8_t digest[16]; \
+    char    want[33]; \
+    if (!TinyGsmCertDigest(cert, digest)) { \
+      return false; \
+    } \
+    TinyGsmEncodeHex(digest, sizeof(digest), want); \
+    want[32] = '\0'; \
+    if (!modemCertMd5(name, type).equalsIgnoreCase(want)) { \
+      DBG("### Importing certificate", name); \
+      sendAT(GF("+USECMNG=0,"), type, ",\"", name, "\",", (uint32_t)cert.length()); \
+      if (waitResponse(GF(">")) != 1) { \
+        return false; \
+      } \
+      if (!TinyGsmCertWrite(stream, cert, 0, cert.length())) { \
+        return false; \
+      } \
+      /* +USECMNG: 0,<type>,"<name>","<md5>" */ \
+      if (waitResponse(10000L, GF(GSM_NL "+USECMNG: 0,")) != 1) { \
+        return false; \
+      } \
+      if (!modemReadCertMd5().equalsIgnoreCase(want)) { \
+        DBG("### Certificate check failed", name); \
+        sendAT(GF("+USECMNG=2,"), type, ",\"", name, '"'); \
+        waitResponse(); \
+        return false; \
+      } \
+    } \
+    /* Profile 0: 3 trusted root, 5 client certificate, 6 client key */ \
+    uint8_t op = (type == TINY_GSM_CERT_CA) ? 3 : (type == TINY_GSM_CERT_CLIENT) ? 5 : 6; \
+    sendAT(GF("+USECPRF=0,"), op, ",\"", name, '"'); \
+    if (waitResponse() != 1) { \
+      return false; \
+    } \
+    if (type == TINY_GSM_CERT_CA) { \
+      sendAT(GF("+USECPRF=0,0,1"));  /* Validate against the root */ \
+      return waitResponse() == 1; \
+    } \
+    return true; \
+  } \
+  \
+  bool removeCertificate(const char* name, TinyGsmCertType type = TINY_GSM_CERT_CA) { \
+    sendAT(GF("+USECMNG=2,"), type, ",\"", name, '"'); \
+    return waitResponse() == 1; \
+  }
+
+
+// The MD5 +USECMNG has for a certificate, "" when it doesn't have it
+#define TINY_GSM_MODEM_CERT_MD5_USECMNG() \
+  String modemCertMd5(const char* name, TinyGsmCertType type) { \
+    sendAT(GF("+USECMNG=4,"), type, ",\"", name, '"'); \
+    if (waitResponse(GF(GSM_NL "+USECMNG: 4,")) != 1) { \
+      return ""; \
+    } \
+    return modemReadCertMd5(); \
+  } \
+  \
+  /* The rest of a +USECMNG: <op>,<type>,"<name>","<md5>" */ \
+  String modemReadCertMd5() { \
+    streamSkipUntil(',');  /* <type> */ \
+    streamSkipUntil(',');  /* "<name>" */ \
+    streamSkipUntil('"'); \
+    String md5 = stream.readStringUntil('"'); \
+    waitResponse(); \
+    return md5; \
+  }
+
+
 // Gets signal quality report according to 3GPP TS command AT+CSQ
 #define TINY_GSM_MODEM_GET_CSQ() \
   int16_t getSignalQuality() { \
@@ -600,42 +2342,128 @@ String TinyGsmDecodeHex16bit(String &instr) {
   }
 
 
-// Yields up to a time-out period and then reads a character from the stream into the mux FIFO
-// TODO:  Do we need to wait two _timeout periods for no character return?  Will wait once in the first
-// "while !stream.available()" and then will wait again in the stream.read() function.
-#define TINY_GSM_MODEM_STREAM_TO_MUX_FIFO_WITH_DOUBLE_TIMEOUT \
-  uint32_t startMillis = millis(); \
-  while (!stream.available() && (millis() - startMillis < sockets[mux]->_timeout)) { TINY_GSM_YIELD(); } \
-  char c = stream.read(); \
-  sockets[mux]->rx.put(c);
+// Moves a len byte payload from the stream into the caller's buffer and the
+// mux FIFO (and the staging area), see TinyGsmStreamToFifo
+#if TINY_GSM_RX_STAGING
+  #define TINY_GSM_MODEM_STREAM_TO_MUX(len) \
+  TinyGsmStreamToRx(stream, len, sockets[mux]->rx, staging, mux, sockets[mux]->_timeout, dst, dst_size)
+#else
+  #define TINY_GSM_MODEM_STREAM_TO_MUX(len) \
+  TinyGsmStreamToFifo(stream, len, sockets[mux]->rx, sockets[mux]->_timeout, dst, dst_size)
+#endif
 
 
-// Utility templates for writing/skipping characters on a stream
-#define TINY_GSM_MODEM_STREAM_UTILITIES() \
-  template<typename T> \
-  void streamWrite(T last) { \
-    stream.print(last); \
+// Same for a payload sent as hex digits, see TinyGsmHexToFifo
+#if TINY_GSM_RX_STAGING
+  #define TINY_GSM_MODEM_HEX_TO_MUX(len, malformed) \
+  TinyGsmHexToRx(stream, len, sockets[mux]->rx, staging, mux, sockets[mux]->_timeout, dst, dst_size, malformed)
+#else
+  #define TINY_GSM_MODEM_HEX_TO_MUX(len, malformed) \
+  TinyGsmHexToFifo(stream, len, sockets[mux]->rx, sockets[mux]->_timeout, dst, dst_size, malformed)
+#endif
+
+
+// Lets the application handle URC's the driver doesn't know about, i.e.
+//   modem.setUrcHandler(GF("+CMTI:"), onNewSms);
+#define TINY_GSM_MODEM_URC_HANDLERS() \
+  bool setUrcHandler(GsmConstStr prefix, TinyGsmUrcCallback cb, void* ctx = NULL) { \
+    uint8_t i = urcs.indexOf(prefix); \
+    if (!cb || (i && i <= URC_BUILTIN)) return false; \
+    return urcs.add(prefix, cb, ctx) != 0; \
   } \
   \
-  template<typename T, typename... Args> \
-  void streamWrite(T head, Args... tail) { \
-    stream.print(head); \
-    streamWrite(tail...); \
+  bool removeUrcHandler(GsmConstStr prefix) { \
+    if (urcs.indexOf(prefix) <= URC_BUILTIN) return false; \
+    return urcs.remove(prefix); \
+  }
+
+
+// Command latencies and traffic counters, see TinyGsmStats
+#ifdef TINY_GSM_STATS
+  #define TINY_GSM_MODEM_STATS() \
+  const TinyGsmStats& getStats() const { \
+    return stats; \
+  } \
+  \
+  void clearStats() { \
+    stats.clear(); \
+    TinyGsmYieldMicros() = 0; \
   } \
   \
+  void printStats(Print& out) { \
+    stats.printTo(out); \
+  }
+#else
+  #define TINY_GSM_MODEM_STATS()
+#endif
+
+
+// Sends a TinyGsmAtBatch as one command line.  Returns how many of its
+// commands succeeded, counting from the first one, so count() means all of
+// them.  The modem stops at the first failure, and the "013" it printed for
+// each command before it says which one that was.  Nothing is sent again.
+#define TINY_GSM_MODEM_SEND_BATCH() \
+  template<uint16_t N> \
+  uint8_t sendBatch(TinyGsmAtBatch<N>& batch, uint32_t timeout_ms = 1000L) { \
+    if (!batch.count()) return 0; \
+    sendAT(batch.c_str()); \
+    uint8_t done = 0; \
+    for (;;) { \
+      switch (waitResponse(timeout_ms, GF(GSM_NL "013" GSM_NL), GFP(GSM_OK), GFP(GSM_ERROR))) { \
+      case 1: \
+        done++; \
+        break; \
+      case 2: \
+        return batch.count(); \
+      default: \
+        DBG("### Batch failed at command", done + 1, "of", batch.count()); \
+        return done; \
+      } \
+    } \
+  }
+
+
+// Utility templates for writing/skipping characters on a stream.
+// streamWrite() renders all of its arguments into a TinyGsmPrintBuffer, so
+// a command goes out with a single stream.write().
+#define TINY_GSM_MODEM_STREAM_UTILITIES() \
+  TINY_GSM_MODEM_STREAM_WRITE() \
+  \
   template<typename... Args> \
   void sendAT(Args... cmd) { \
     streamWrite("AT", cmd..., GSM_NL); \
     stream.flush(); \
+    TINY_GSM_STATS_COMMAND(cmd...); \
     TINY_GSM_YIELD(); \
     /* DBG("### AT:", cmd...); */ \
+  }
+
+
+// The same, without sendAT(), for a modem that sends commands its own way
+#define TINY_GSM_MODEM_STREAM_WRITE() \
+  template<typename T> \
+  void streamPrint(Print& out, T last) { \
+    out.print(last); \
+  } \
+  \
+  template<typename T, typename... Args> \
+  void streamPrint(Print& out, T head, Args... tail) { \
+    out.print(head); \
+    streamPrint(out, tail...); \
+  } \
+  \
+  template<typename... Args> \
+  void streamWrite(Args... args) { \
+    TinyGsmPrintBuffer<TINY_GSM_AT_BUFFER> out(stream); \
+    streamPrint(out, args...); \
+    out.send(); \
   } \
   \
   bool streamSkipUntil(const char c, const unsigned long timeout_ms = 1000L) { \
     unsigned long startMillis = millis(); \
     while (millis() - startMillis < timeout_ms) { \
       while (millis() - startMillis < timeout_ms && !stream.available()) { \
-        TINY_GSM_YIELD(); \
+        TINY_GSM_YIELD_FOR(TinyGsmRemaining(startMillis, timeout_ms), TINY_GSM_WAIT_RESPONSE); \
       } \
       if (stream.read() == c) { \
         return true; \
@@ -1,6 +1,30 @@
 #ifndef TinyGsmFifo_h
 #define TinyGsmFifo_h
 
+// Index wrapping for the ring buffer.  Both indexes and increments are
+// always below N, so a compare and subtract is enough in general, and
+// a power of two size (like the default buffer sizes) only needs a mask.
+template <unsigned N, bool P = ((N & (N - 1)) == 0)>
+struct TinyGsmFifoIndex
+{
+    static int inc(int i, int n)
+    {
+        i += n;
+        if (i >= (int)N)
+            i -= N;
+        return i;
+    }
+};
+
+template <unsigned N>
+struct TinyGsmFifoIndex<N, true>
+{
+    static int inc(int i, int n)
+    {
+        return (i + n) & (N - 1);
+    }
+};
+
 template <class T, unsigned N>
 class TinyGsmFifo
 {
@@ -61,7 +85,7 @@ public:
             int m = N - w;
             // check wrap
             if (f > m) f = m;
-            memcpy(&_b[w], p, f);
+            memcpy(&_b[w], p, f * sizeof(T));
             _w = _inc(w, f);
             c -= f;
             p += f;
@@ -69,6 +93,35 @@ public:
         return n - c;
     }
 
+    // Contiguous free space at the write position, n is set to its length.
+    // Fill it in place and then publish the bytes with commitWrite().
+    T* writeSpan(int& n)
+    {
+        int w = _w;
+        int r = _r;
+        if (r > w)
+            n = r - w - 1;
+        else
+            n = N - w - (r == 0 ? 1 : 0);
+        return &_b[w];
+    }
+
+    void commitWrite(int n)
+    {
+        _w = _inc(_w, n);
+    }
+
+    // Stores c offset places after the write position, without publishing
+    // it; commitWrite() publishes all that was stored this way.  Returns
+    // false if it doesn't fit.
+    bool putAt(const T& c, int offset)
+    {
+        if (offset >= free())
+            return false;
+        _b[_inc(_w, offset)] = c;
+        return true;
+    }
+
     // reading thread/context API
     // --------------------------------------------------------
 
@@ -114,7 +167,7 @@ public:
             int m = N - r;
             // check wrap
             if (f > m) f = m;
-            memcpy(p, &_b[r], f);
+            memcpy(p, &_b[r], f * sizeof(T));
             _r = _inc(r, f);
             c -= f;
             p += f;
@@ -122,10 +175,51 @@ public:
         return n - c;
     }
 
+    // Contiguous data at the read position, n is set to its length.
+    // Use it in place and then release it with consume().
+    T* readSpan(int& n)
+    {
+        int r = _r;
+        int w = _w;
+        if (w >= r)
+            n = w - r;
+        else
+            n = N - r;
+        return &_b[r];
+    }
+
+    void consume(int n)
+    {
+        _r = _inc(_r, n);
+    }
+
+    // Like get(), but leaves the element in the fifo
+    bool peek(T* p, int offset = 0)
+    {
+        if (offset < 0 || offset >= (int)size())
+            return false;
+        *p = _b[_inc(_r, offset)];
+        return true;
+    }
+
+    // Position of the first element equal to c, or -1
+    int find(const T& c)
+    {
+        int s = size();
+        int r = _r;
+        for (int i = 0; i < s; i++)
+        {
+            if (_b[r] == c)
+                return i;
+            r = _inc(r);
+        }
+        return -1;
+    }
+
 private:
     int _inc(int i, int n = 1)
     {
-        return (i + n) % N;
+        return TinyGsmFifoIndex<N>::inc(i, n);
     }
 
     T    _b[N];
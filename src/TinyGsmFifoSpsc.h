@@ -0,0 +1,278 @@
+#ifndef TinyGsmFifoSpsc_h
+#define TinyGsmFifoSpsc_h
+
+#include <TinyGsmFifo.h>
+
+// Single producer / single consumer variant of TinyGsmFifo.
+//
+// One side (i.e. a UART RX interrupt, a DMA-completion callback or the
+// other core on ESP32/RP2040) may put() while the other side get()s,
+// without any locking.  Each index is only ever written by its own side:
+// the producer publishes _w with release semantics after the data is in
+// place, and the consumer reads it with acquire semantics before touching
+// the data (and the other way around for _r).
+//
+// Not included by TinyGsmClient.h, include it where you need it:
+//
+//   TinyGsmFifoSpsc<uint8_t, 256> uartRx;
+//   void onUartRx(uint8_t c) { uartRx.put(c); }   // ISR
+//   ...
+//   uint8_t c;
+//   while (uartRx.get(&c)) { ... }                // loop()
+//
+// The drivers themselves don't use it: they read the modem through an
+// Arduino Stream, and the core already buffers the UART in its own RX
+// interrupt.  It's for a Stream of your own, i.e. one fed by DMA or by
+// the other core, that you then hand to the modem.
+
+#if defined(__AVR__)
+
+#include <util/atomic.h>
+
+// 8-bit AVRs don't reorder memory accesses, but an int index takes two
+// instructions to load or store, so keep interrupts out while doing it.
+// ATOMIC_BLOCK also acts as a compiler barrier.
+class TinyGsmFifoSpscIndex
+{
+public:
+    int relaxed() const
+    {
+        return _i;
+    }
+
+    int acquire() const
+    {
+        int i;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { i = _i; }
+        return i;
+    }
+
+    void release(int i)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { _i = i; }
+    }
+
+private:
+    volatile int _i;
+};
+
+#else
+
+#include <atomic>
+
+class TinyGsmFifoSpscIndex
+{
+public:
+    int relaxed() const
+    {
+        return _i.load(std::memory_order_relaxed);
+    }
+
+    int acquire() const
+    {
+        return _i.load(std::memory_order_acquire);
+    }
+
+    void release(int i)
+    {
+        _i.store(i, std::memory_order_release);
+    }
+
+private:
+    std::atomic<int> _i;
+};
+
+#endif
+
+template <class T, unsigned N>
+class TinyGsmFifoSpsc
+{
+public:
+    TinyGsmFifoSpsc()
+    {
+        clear();
+    }
+
+    // Only safe while neither side is running
+    void clear()
+    {
+        _r.release(0);
+        _w.release(0);
+    }
+
+    // writing thread/context API
+    //-------------------------------------------------------------
+
+    bool writeable(void)
+    {
+        return free() > 0;
+    }
+
+    int free(void)
+    {
+        int s = _r.acquire() - _w.relaxed();
+        if (s <= 0)
+            s += N;
+        return s - 1;
+    }
+
+    bool put(const T& c)
+    {
+        int j = _w.relaxed();
+        int i = _inc(j);
+        if (i == _r.acquire()) // !writeable()
+            return false;
+        _b[j] = c;
+        _w.release(i);
+        return true;
+    }
+
+    int put(const T* p, int n, bool t = false)
+    {
+        int c = n;
+        while (c)
+        {
+            int f;
+            while ((f = free()) == 0) // wait for space
+            {
+                if (!t) return n - c; // no more space and not blocking
+                /* nothing / just wait for the consumer */;
+            }
+            // check free space
+            if (c < f) f = c;
+            int w = _w.relaxed();
+            int m = N - w;
+            // check wrap
+            if (f > m) f = m;
+            memcpy(&_b[w], p, f * sizeof(T));
+            _w.release(_inc(w, f));
+            c -= f;
+            p += f;
+        }
+        return n - c;
+    }
+
+    // Contiguous free space at the write position, n is set to its length.
+    // Fill it in place and then publish the elements with commitWrite().
+    T* writeSpan(int& n)
+    {
+        int w = _w.relaxed();
+        int r = _r.acquire();
+        if (r > w)
+            n = r - w - 1;
+        else
+            n = N - w - (r == 0 ? 1 : 0);
+        return &_b[w];
+    }
+
+    void commitWrite(int n)
+    {
+        _w.release(_inc(_w.relaxed(), n));
+    }
+
+    // reading thread/context API
+    // --------------------------------------------------------
+
+    bool readable(void)
+    {
+        return (_r.relaxed() != _w.acquire());
+    }
+
+    size_t size(void)
+    {
+        int s = _w.acquire() - _r.relaxed();
+        if (s < 0)
+            s += N;
+        return s;
+    }
+
+    bool get(T* p)
+    {
+        int r = _r.relaxed();
+        if (r == _w.acquire()) // !readable()
+            return false;
+        *p = _b[r];
+        _r.release(_inc(r));
+        return true;
+    }
+
+    int get(T* p, int n, bool t = false)
+    {
+        int c = n;
+        while (c)
+        {
+            int f;
+            for (;;) // wait for data
+            {
+                f = size();
+                if (f)  break;        // free space
+                if (!t) return n - c; // no space and not blocking
+                /* nothing / just wait for the producer */;
+            }
+            // check available data
+            if (c < f) f = c;
+            int r = _r.relaxed();
+            int m = N - r;
+            // check wrap
+            if (f > m) f = m;
+            memcpy(p, &_b[r], f * sizeof(T));
+            _r.release(_inc(r, f));
+            c -= f;
+            p += f;
+        }
+        return n - c;
+    }
+
+    // Contiguous data at the read position, n is set to its length.
+    // Use it in place and then release it with consume().
+    T* readSpan(int& n)
+    {
+        int r = _r.relaxed();
+        int w = _w.acquire();
+        if (w >= r)
+            n = w - r;
+        else
+            n = N - r;
+        return &_b[r];
+    }
+
+    void consume(int n)
+    {
+        _r.release(_inc(_r.relaxed(), n));
+    }
+
+    // Like get(), but leaves the element in the fifo
+    bool peek(T* p, int offset = 0)
+    {
+        if (offset < 0 || offset >= (int)size())
+            return false;
+        *p = _b[_inc(_r.relaxed(), offset)];
+        return true;
+    }
+
+    // Position of the first element equal to c, or -1
+    int find(const T& c)
+    {
+        int s = size();
+        int r = _r.relaxed();
+        for (int i = 0; i < s; i++)
+        {
+            if (_b[r] == c)
+                return i;
+            r = _inc(r);
+        }
+        return -1;
+    }
+
+private:
+    int _inc(int i, int n = 1)
+    {
+        return TinyGsmFifoIndex<N>::inc(i, n);
+    }
+
+    T                    _b[N];
+    TinyGsmFifoSpscIndex _w;
+    TinyGsmFifoSpscIndex _r;
+};
+
+#endif
@@ -0,0 +1,297 @@
+/**
+ * @file       TinyGsmXBeeApi.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy, XBee module by Sara Damiano
+ * @date       Nov 2016
+ */
+
+#ifndef TinyGsmXBeeApi_h
+#define TinyGsmXBeeApi_h
+
+// Frames of the XBee API mode (AP1, no escaping):
+//
+//   0x7E, length (2 bytes, big endian), frame data, checksum
+//
+// The frame data starts with the frame type, and the checksum is 0xFF less
+// the low byte of the sum of the frame data.  Included by
+// TinyGsmClientXBee.h when TINY_GSM_XBEE_API is defined.
+
+// Bytes kept of a received frame, payloads of socket data excepted
+#ifndef TINY_GSM_XBEE_FRAME_BUFFER
+  #define TINY_GSM_XBEE_FRAME_BUFFER 48
+#endif
+
+// Most data that goes into one socket data frame, either way (the NP
+// parameter for transmit frames)
+#ifndef TINY_GSM_XBEE_MAX_PAYLOAD
+  #define TINY_GSM_XBEE_MAX_PAYLOAD 1500
+#endif
+
+enum XBeeFrameType {
+  XBEE_FRAME_AT_COMMAND     = 0x08,
+  XBEE_FRAME_TX_SMS         = 0x1F,
+  XBEE_FRAME_TX_IPV4        = 0x20,
+  XBEE_FRAME_SOCKET_CREATE  = 0x40,
+  XBEE_FRAME_SOCKET_CONNECT = 0x42,
+  XBEE_FRAME_SOCKET_CLOSE   = 0x43,
+  XBEE_FRAME_SOCKET_SEND    = 0x44,
+  XBEE_FRAME_AT_RESPONSE    = 0x88,
+  XBEE_FRAME_TX_STATUS      = 0x89,
+  XBEE_FRAME_MODEM_STATUS   = 0x8A,
+  XBEE_FRAME_RX_IPV4        = 0xB0,
+  XBEE_FRAME_SOCKET_CREATED = 0xC0,
+  XBEE_FRAME_SOCKET_CONNECT_RESPONSE = 0xC2,
+  XBEE_FRAME_SOCKET_CLOSED  = 0xC3,
+  XBEE_FRAME_SOCKET_RECEIVE = 0xCD,
+  XBEE_FRAME_SOCKET_STATUS  = 0xCF,
+};
+
+// Sends one frame, its data given in up to three parts (i.e. a header, a
+// payload still in the caller's buffer and nothing), with no copies.
+static inline
+void TinyGsmXBeeSendFrame(Stream& stream,
+                          const uint8_t* a, size_t a_len,
+                          const uint8_t* b = NULL, size_t b_len = 0)
+{
+  uint16_t len = a_len + b_len;
+  uint8_t  start[3] = { 0x7E, (uint8_t)(len >> 8), (uint8_t)len };
+  uint8_t  sum = 0;
+  for (size_t i = 0; i < a_len; i++) sum += a[i];
+  for (size_t i = 0; i < b_len; i++) sum += b[i];
+  sum = 0xFF - sum;
+  stream.write(start, sizeof(start));
+  stream.write(a, a_len);
+  if (b_len) stream.write(b, b_len);
+  stream.write(&sum, 1);
+  stream.flush();
+}
+
+// Takes frames apart a byte at a time.  The start of the frame data is
+// kept in data(), but the payload of a socket data frame is handed back to
+// the caller byte by byte (XBEE_FEED_PAYLOAD), to go straight where it
+// belongs; it may only be used once the frame turns out to be good.
+class TinyGsmXBeeFrameReader
+{
+public:
+  enum Result {
+    XBEE_FEED_MORE = 0,   // nothing to do yet
+    XBEE_FEED_PAYLOAD,    // c is the next payload byte
+    XBEE_FEED_FRAME,      // a good frame is complete
+    XBEE_FEED_BAD,        // a frame ended with the wrong checksum
+  };
+
+  TinyGsmXBeeFrameReader() {
+    reset();
+  }
+
+  void reset() {
+    _state = 0;
+    _kept  = 0;
+  }
+
+  Result feed(uint8_t c) {
+    switch (_state) {
+    case 0:  // Anything but a start delimiter is noise
+      if (c == 0x7E) _state = 1;
+      return XBEE_FEED_MORE;
+    case 1:
+      _len   = (uint16_t)c << 8;
+      _state = 2;
+      return XBEE_FEED_MORE;
+    case 2:
+      _len  |= c;
+      _pos   = 0;
+      _kept  = 0;
+      _sum   = 0;
+      _state = _len ? 3 : 0;
+      return XBEE_FEED_MORE;
+    case 3:  // Frame data
+      _sum += c;
+      if (_pos == 0) {
+        _header = headerLength(c);
+      }
+      _pos++;
+      if (_pos == _len) {
+        _state = 4;
+      }
+      if (_pos > _header) {
+        return XBEE_FEED_PAYLOAD;
+      }
+      if (_kept < sizeof(_data)) {
+        _data[_kept++] = c;
+      }
+      return XBEE_FEED_MORE;
+    default:  // Checksum
+      _state = 0;
+      return ((uint8_t)(_sum + c) == 0xFF) ? XBEE_FEED_FRAME : XBEE_FEED_BAD;
+    }
+  }
+
+  uint8_t type() const {
+    return _data[0];
+  }
+
+  // The frame data after the type, as far as it was kept
+  const uint8_t* data() const {
+    return _data + 1;
+  }
+
+  size_t length() const {
+    return _kept ? _kept - 1 : 0;
+  }
+
+  // Bytes of payload in a socket data frame, so far
+  size_t payload() const {
+    return (_pos > _header) ? _pos - _header : 0;
+  }
+
+  // Whether the next byte fed is payload, and how much the frame carries
+  bool inPayload() const {
+    return _state == 3 && _pos >= _header;
+  }
+
+  size_t payloadLength() const {
+    return (_len > _header) ? _len - _header : 0;
+  }
+
+private:
+  // Frame data (with the type) before the payload of a socket data frame
+  static uint16_t headerLength(uint8_t type) {
+    switch (type) {
+    case XBEE_FRAME_SOCKET_RECEIVE:
+      return 4;   // type, frame id, socket id, status
+    case XBEE_FRAME_RX_IPV4:
+      return 11;  // type, source address, destination and source port, protocol, status
+    default:
+      return 0xFFFF;
+    }
+  }
+
+  uint8_t  _state;
+  uint16_t _len;
+  uint16_t _pos;
+  uint16_t _header;
+  uint8_t  _sum;
+  uint8_t  _kept;
+  uint8_t  _data[TINY_GSM_XBEE_FRAME_BUFFER];
+};
+
+/*
+ * AT command parameters
+ */
+
+// In API frames numeric parameters are binary, big endian, instead of hex
+// text, and IP addresses are 4 bytes.  Anything else is text either way.
+static inline
+bool TinyGsmXBeeIsNumeric(const char* cmd) {
+  static const char numeric[] TINY_GSM_PROGMEM =
+    "AP" "GT" "CT" "BD" "AM" "SM" "SO" "AI" "LM" "DB" "EE" "NR" "IP" "TD"
+    "%V" "TP" "CI" "DE" "TM" "HS";
+  for (size_t i = 0; i + 1 < sizeof(numeric); i += 2) {
+    if (TINY_GSM_PGM_BYTE(&numeric[i]) == cmd[0] &&
+        TINY_GSM_PGM_BYTE(&numeric[i+1]) == cmd[1]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline
+bool TinyGsmXBeeIsAddress(const char* cmd) {
+  return (cmd[0] == 'M' && cmd[1] == 'Y') ||
+         (cmd[0] == 'O' && cmd[1] == 'D') ||
+         (cmd[0] == 'L' && cmd[1] == 'A');
+}
+
+// Collects an AT command as it would be typed in command mode ("DE1F90",
+// "MY"), then sends it as a local AT command frame.  A command longer than
+// TINY_GSM_AT_BUFFER isn't sent at all, rather than cut short.
+class TinyGsmXBeeAtFrame : public Print
+{
+public:
+  TinyGsmXBeeAtFrame()
+    : _len(0), _overflow(false)
+  {
+    _cmd[0] = _cmd[1] = '\0';
+  }
+
+  virtual size_t write(uint8_t c) {
+    if (_len >= sizeof(_cmd)) {
+      _overflow = true;
+      return 0;
+    }
+    _cmd[_len++] = c;
+    return 1;
+  }
+
+  using Print::write;
+
+  // The two letters of the command
+  const char* command() const {
+    return _cmd;
+  }
+
+  // Returns false, having sent nothing, if the command didn't fit
+  bool send(Stream& stream, uint8_t frame_id) {
+    uint8_t head[4] = { XBEE_FRAME_AT_COMMAND, frame_id, 0, 0 };
+    if (_len < 2 || _overflow) {
+      return false;
+    }
+    head[2] = _cmd[0];
+    head[3] = _cmd[1];
+    const uint8_t* param = (const uint8_t*)_cmd + 2;
+    size_t param_len = _len - 2;
+    uint8_t num[4];
+    if (param_len && TinyGsmXBeeIsNumeric(_cmd)) {
+      param_len = hexToBinary(param, param_len, num);
+      param = num;
+    }
+    TinyGsmXBeeSendFrame(stream, head, sizeof(head), param, param_len);
+    return true;
+  }
+
+  // Turns a binary AT response back into what command mode would have
+  // answered: hex for a number, a dotted address, or the text itself
+  static void responseText(const char* cmd, const uint8_t* data, size_t len,
+                           String& out) {
+    out = "";
+    if (TinyGsmXBeeIsNumeric(cmd)) {
+      char hex[9];
+      len = TinyGsmMin(len, (size_t)4);
+      TinyGsmEncodeHex(data, len, hex);
+      hex[2 * len] = '\0';
+      const char* p = hex;
+      while (p[0] == '0' && p[1]) p++;  // "0064" was "64"
+      out = p;
+    } else if (TinyGsmXBeeIsAddress(cmd) && len == 4) {
+      char addr[16];
+      out = TinyGsmIpToString(IPAddress(data[0], data[1], data[2], data[3]), addr);
+    } else {
+      for (size_t i = 0; i < len; i++) {
+        out += (char)data[i];
+      }
+    }
+  }
+
+private:
+  // Hex digits to as few bytes as they take (up to 4)
+  static size_t hexToBinary(const uint8_t* hex, size_t len, uint8_t* out) {
+    uint32_t v = 0;
+    for (size_t i = 0; i < len; i++) {
+      v = (v << 4) | (TinyGsmHexNibble(hex[i]) & 0x0F);
+    }
+    size_t n = 1;
+    while (n < 4 && (v >> (8 * n))) n++;
+    for (size_t i = 0; i < n; i++) {
+      out[i] = v >> (8 * (n - 1 - i));
+    }
+    return n;
+  }
+
+  size_t _len;
+  bool   _overflow;
+  char   _cmd[TINY_GSM_AT_BUFFER];
+};
+
+#endif
@@ -53,6 +53,9 @@
 // Define the serial console for debug prints, if needed
 #define TINY_GSM_DEBUG SerialMon
 
+// Collect AT command timings and traffic counters, printed at the end
+//#define TINY_GSM_STATS
+
 // Range to attempt to autobaud
 #define GSM_AUTOBAUD_MIN 9600
 #define GSM_AUTOBAUD_MAX 115200
@@ -268,6 +271,11 @@ void loop() {
   SerialMon.println((bytesReceived == 121) ? "PASSED" : "FAILED");
   SerialMon.println(F("************************"));
 
+#ifdef TINY_GSM_STATS
+  SerialMon.println();
+  modem.printStats(SerialMon);
+#endif
+
   // Do nothing forevermore
   while (true) {
     delay(1000);
@@ -0,0 +1,330 @@
+/**
+ * @file       Arduino.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+// Just enough of the Arduino core to build TinyGSM on a PC, for the host
+// benchmarks in this folder.  String is kept on std::string, so its heap
+// use shows up in the allocation counts like it would on a board.
+
+#ifndef HostBench_Arduino_h
+#define HostBench_Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+
+typedef uint8_t byte;
+typedef bool    boolean;
+
+#define HEX 16
+#define DEC 10
+#define INPUT  0
+#define OUTPUT 1
+#define LOW    0
+#define HIGH   1
+
+class __FlashStringHelper;
+#define F(x) (x)
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+
+#define constrain(a, l, h) ((a) < (l) ? (l) : ((a) > (h) ? (h) : (a)))
+using std::min;
+using std::max;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+inline void pinMode(int, int) {}
+inline void digitalWrite(int, int) {}
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+class String
+{
+public:
+  String() {}
+  String(const char* c) : s(c ? c : "") {}
+  String(const std::string& x) : s(x) {}
+  String(char c) : s(1, c) {}
+  String(unsigned char v) : s(std::to_string(v)) {}
+  String(int v, int base = DEC) : s(number(v, base)) {}
+  String(unsigned v, int base = DEC) : s(number(v, base)) {}
+  String(long v) : s(std::to_string(v)) {}
+  String(unsigned long v) : s(std::to_string(v)) {}
+  String(double v, int digits = 2) {
+    char b[64];
+    snprintf(b, sizeof(b), "%.*f", digits, v);
+    s = b;
+  }
+
+  void reserve(size_t n) { s.reserve(n); }
+  unsigned length() const { return s.size(); }
+  const char* c_str() const { return s.c_str(); }
+  char operator[](unsigned i) const { return i < s.size() ? s[i] : 0; }
+  char& operator[](unsigned i) { return s[i]; }
+  char charAt(unsigned i) const { return (*this)[i]; }
+
+  String& operator+=(const String& o) { s += o.s; return *this; }
+  String& operator+=(const char* o) { s += o; return *this; }
+  String& operator+=(char c) { s += c; return *this; }
+  String& operator+=(unsigned char v) { s += std::to_string(v); return *this; }
+  String& operator+=(int v) { s += std::to_string(v); return *this; }
+  String& operator+=(unsigned v) { s += std::to_string(v); return *this; }
+  String& operator+=(long v) { s += std::to_string(v); return *this; }
+  String& operator+=(unsigned long v) { s += std::to_string(v); return *this; }
+  bool concat(const String& o) { s += o.s; return true; }
+  bool concat(char c) { s += c; return true; }
+
+  friend String operator+(const String& a, const String& b) { return String(a.s + b.s); }
+  friend String operator+(const String& a, const char* b) { return String(a.s + b); }
+  friend String operator+(const char* a, const String& b) { return String(a + b.s); }
+  bool operator==(const String& o) const { return s == o.s; }
+  bool operator==(const char* o) const { return s == o; }
+  bool operator!=(const String& o) const { return s != o.s; }
+  bool operator!=(const char* o) const { return s != o; }
+
+  bool equalsIgnoreCase(const String& o) const {
+    return s.size() == o.s.size() && !strcasecmp(s.c_str(), o.s.c_str());
+  }
+  bool startsWith(const String& x) const {
+    return s.compare(0, x.s.size(), x.s) == 0;
+  }
+  bool endsWith(const String& x) const {
+    return s.size() >= x.s.size() &&
+           s.compare(s.size() - x.s.size(), x.s.size(), x.s) == 0;
+  }
+  int indexOf(char c, unsigned from = 0) const { return pos(s.find(c, from)); }
+  int indexOf(const String& x, unsigned from = 0) const { return pos(s.find(x.s, from)); }
+  int lastIndexOf(char c) const { return pos(s.rfind(c)); }
+  int lastIndexOf(const String& x) const { return pos(s.rfind(x.s)); }
+  int lastIndexOf(const String& x, unsigned from) const { return pos(s.rfind(x.s, from)); }
+  String substring(unsigned a) const {
+    return a >= s.size() ? String() : String(s.substr(a));
+  }
+  String substring(unsigned a, unsigned b) const {
+    if (a > b) std::swap(a, b);
+    return a >= s.size() ? String() : String(s.substr(a, b - a));
+  }
+
+  long toInt() const { return atol(s.c_str()); }
+  float toFloat() const { return atof(s.c_str()); }
+  void trim() {
+    size_t a = s.find_first_not_of(" \t\r\n");
+    if (a == std::string::npos) {
+      s.clear();
+      return;
+    }
+    s = s.substr(a, s.find_last_not_of(" \t\r\n") - a + 1);
+  }
+  void replace(const String& from, const String& to) {
+    if (from.s.empty()) return;
+    size_t p = 0;
+    while ((p = s.find(from.s, p)) != std::string::npos) {
+      s.replace(p, from.s.size(), to.s);
+      p += to.s.size();
+    }
+  }
+  void remove(unsigned i) { if (i < s.size()) s.erase(i); }
+  void remove(unsigned i, unsigned n) { if (i < s.size()) s.erase(i, n); }
+  void toUpperCase() { for (size_t i = 0; i < s.size(); i++) s[i] = toupper(s[i]); }
+  void toCharArray(char* buf, unsigned n) const {
+    if (!n) return;
+    strncpy(buf, s.c_str(), n - 1);
+    buf[n - 1] = '\0';
+  }
+
+private:
+  static int pos(size_t p) { return p == std::string::npos ? -1 : (int)p; }
+  static std::string number(unsigned long v, int base) {
+    char b[34];
+    snprintf(b, sizeof(b), base == HEX ? "%lx" : "%lu", v);
+    return b;
+  }
+  static std::string number(long v, int base) {
+    return base == HEX ? number((unsigned long)v, base) : std::to_string(v);
+  }
+  static std::string number(int v, int base) { return number((long)v, base); }
+  static std::string number(unsigned v, int base) { return number((unsigned long)v, base); }
+
+  std::string s;
+};
+
+class Printable
+{
+public:
+  virtual ~Printable() {}
+};
+
+class Print
+{
+public:
+  Print() : write_error(0) {}
+  virtual ~Print() {}
+  int getWriteError() { return write_error; }
+  void clearWriteError() { setWriteError(0); }
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buf, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buf++);
+    return n;
+  }
+  size_t write(const char* str) { return str ? write((const uint8_t*)str, strlen(str)) : 0; }
+  size_t write(const char* buf, size_t size) { return write((const uint8_t*)buf, size); }
+  size_t write(char c) { return write((uint8_t)c); }
+  size_t write(int c) { return write((uint8_t)c); }
+  virtual void flush() {}
+
+  size_t print(const char* s) { return write(s); }
+  size_t print(const String& s) { return write(s.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char v, int base = DEC) { return printNumber(v, base); }
+  size_t print(int v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned v, int base = DEC) { return printNumber(v, base); }
+  size_t print(long v, int base = DEC) {
+    if (base == DEC && v < 0) return print('-') + printNumber(-v, base);
+    return printNumber(v, base);
+  }
+  size_t print(unsigned long v, int base = DEC) { return printNumber(v, base); }
+  size_t print(double v, int digits = 2) {
+    char b[64];
+    snprintf(b, sizeof(b), "%.*f", digits, v);
+    return write(b);
+  }
+  size_t print(const Printable&) { return 0; }
+
+  size_t println() { return write("\r\n"); }
+  template<typename T> size_t println(T v) { return print(v) + println(); }
+  template<typename T> size_t println(T v, int base) { return print(v, base) + println(); }
+
+protected:
+  void setWriteError(int err = 1) { write_error = err; }
+
+private:
+  int write_error;
+
+  size_t printNumber(unsigned long v, int base) {
+    char b[34];
+    snprintf(b, sizeof(b), base == HEX ? "%lX" : "%lu", v);
+    return write(b);
+  }
+};
+
+class Stream : public Print
+{
+public:
+  Stream() : _timeout(1000) {}
+
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+
+  virtual size_t readBytes(char* buf, size_t size) {
+    size_t n = 0;
+    while (n < size) {
+      int c = timedRead();
+      if (c < 0) break;
+      buf[n++] = (char)c;
+    }
+    return n;
+  }
+  size_t readBytes(uint8_t* buf, size_t size) { return readBytes((char*)buf, size); }
+  size_t readBytesUntil(char terminator, char* buf, size_t size) {
+    size_t n = 0;
+    while (n < size) {
+      int c = timedRead();
+      if (c < 0 || c == terminator) break;
+      buf[n++] = (char)c;
+    }
+    return n;
+  }
+  String readStringUntil(char terminator) {
+    String ret;
+    int c = timedRead();
+    while (c >= 0 && c != terminator) {
+      ret += (char)c;
+      c = timedRead();
+    }
+    return ret;
+  }
+  String readString() {
+    String ret;
+    int c = timedRead();
+    while (c >= 0) {
+      ret += (char)c;
+      c = timedRead();
+    }
+    return ret;
+  }
+  long parseInt() {
+    int c;
+    while ((c = timedPeek()) >= 0 && c != '-' && !isDigit(c)) read();
+    bool negative = (c == '-');
+    if (negative) read();
+    long v = 0;
+    while ((c = timedPeek()) >= 0 && isDigit(c)) {
+      v = v * 10 + (c - '0');
+      read();
+    }
+    return negative ? -v : v;
+  }
+  bool find(const char* target) {
+    size_t i = 0, n = strlen(target);
+    while (i < n) {
+      int c = timedRead();
+      if (c < 0) return false;
+      i = (c == target[i]) ? i + 1 : (c == target[0] ? 1 : 0);
+    }
+    return true;
+  }
+
+protected:
+  int timedRead() {
+    unsigned long start = millis();
+    do {
+      int c = read();
+      if (c >= 0) return c;
+    } while (millis() - start < _timeout);
+    return -1;
+  }
+  int timedPeek() {
+    unsigned long start = millis();
+    do {
+      int c = peek();
+      if (c >= 0) return c;
+    } while (millis() - start < _timeout);
+    return -1;
+  }
+
+  unsigned long _timeout;
+};
+
+// Serial goes to stdout, for TINY_GSM_DEBUG and printStats()
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long) {}
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+  virtual size_t write(uint8_t c) { return fwrite(&c, 1, 1, stdout); }
+  using Print::write;
+  operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+#endif
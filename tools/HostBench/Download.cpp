@@ -0,0 +1,143 @@
+/**
+ * @file       Download.cpp
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+// Downloads the extras/test_*.bin payloads through one driver, built with
+// -DTINY_GSM_MODEM_<name>, and a ReplayModem answering in its place.
+//
+//   Download [block] [file...]
+//
+// reads the payload in block byte reads (1460 by default) and prints, per
+// file: the throughput and the CPU time per byte (of the library and the
+// stand-in together), the heap allocations and waitResponse() calls made,
+// the AT commands sent and the UART traffic, with the time that traffic
+// would take at 115200 baud.
+
+#include "HostBench.h"
+
+static unsigned long responses = 0;
+#define TINY_GSM_WAIT_RESPONSE_HOOK() (responses++)
+
+#include "ReplayModem.h"
+#include <TinyGsmClient.h>
+#include <vector>
+
+static const char* modemName() {
+#if defined(TINY_GSM_MODEM_SIM800)
+  return "SIM800";
+#elif defined(TINY_GSM_MODEM_SIM808)
+  return "SIM808";
+#elif defined(TINY_GSM_MODEM_SIM868)
+  return "SIM868";
+#elif defined(TINY_GSM_MODEM_SIM900)
+  return "SIM900";
+#elif defined(TINY_GSM_MODEM_SIM7000)
+  return "SIM7000";
+#elif defined(TINY_GSM_MODEM_SIM5360)
+  return "SIM5360";
+#elif defined(TINY_GSM_MODEM_SIM7600)
+  return "SIM7600";
+#elif defined(TINY_GSM_MODEM_BG96)
+  return "BG96";
+#elif defined(TINY_GSM_MODEM_UBLOX)
+  return "UBLOX";
+#elif defined(TINY_GSM_MODEM_SARAR4)
+  return "SARAR4";
+#elif defined(TINY_GSM_MODEM_ESP8266)
+  return "ESP8266";
+#endif
+}
+
+static bool download(const char* file, size_t block) {
+  std::string payload;
+  if (!HostLoadExtra(file, payload)) {
+    return false;
+  }
+
+  ReplayModem replay;
+  replay.load(payload);
+  TinyGsm modem(replay);
+  TinyGsmClient client(modem, 0);
+  if (!client.connect("1.2.3.4", 80)) {
+    printf("%-8s %-14s connect failed\n", modemName(), file);
+    return false;
+  }
+
+  // The data URC's of the connect are handled before the clock starts
+  client.available();
+
+  std::vector<uint8_t> buf(block);
+  std::string got;
+  got.reserve(payload.size());
+
+  responses = 0;
+  replay.clearCounts();
+  unsigned long allocs = HostAllocations;
+  unsigned long start = micros();
+  double cpu = HostCpuSeconds();
+
+  unsigned long progress = millis();
+  while (got.size() < payload.size() && millis() - progress < 2000) {
+#if defined(REPLAY_IPD)
+    // As much as the client's fifo (one less than its size) has room for
+    size_t pushed = payload.size() - replay.left();
+    replay.allowPush(TINY_GSM_RX_BUFFER - 1 - (pushed - got.size()));
+#endif
+    int avail = client.available();
+    if (avail <= 0) {
+      continue;
+    }
+    int n = client.read(buf.data(), TinyGsmMin((size_t)avail, block));
+    if (n > 0) {
+      got.append((const char*)buf.data(), n);
+      progress = millis();
+    }
+  }
+
+  cpu = HostCpuSeconds() - cpu;
+  double wall = (micros() - start) / 1e6;
+  allocs = HostAllocations - allocs;
+  // Each byte a start bit, 8 data bits and a stop bit
+  double uart_s = (replay.txBytes + replay.rxBytes) * 10 / 115200.0;
+
+  if (got != payload) {
+    printf("%-8s %-14s FAILED, %u of %u bytes right\n", modemName(), file,
+           (unsigned)got.size(), (unsigned)payload.size());
+    return false;
+  }
+  printf("%-8s %-14s %8u B %8.2f MB/s %7.1f ns/B %7lu allocs %6lu waitResponse %6lu AT"
+         " | UART %7lu B %6.2f s @115200\n",
+         modemName(), file, (unsigned)got.size(),
+         wall > 0 ? got.size() / wall / 1e6 : 0.0, cpu * 1e9 / got.size(),
+         allocs, responses, replay.commands,
+         replay.txBytes + replay.rxBytes, uart_s);
+  client.stop();
+  return true;
+}
+
+int main(int argc, char** argv) {
+  size_t block = 1460;
+  int first = 1;
+  if (argc > 1 && isDigit(argv[1][0])) {
+    block = atoi(argv[1]);
+    first = 2;
+  }
+  static const char* files[] = {
+    "test_1k.bin", "test_10k.bin", "test_100k.bin", "test_1m.bin"
+  };
+  bool ok = true;
+  if (first < argc) {
+    for (int i = first; i < argc; i++) {
+      ok &= download(argv[i], block);
+    }
+  } else {
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+      ok &= download(files[i], block);
+    }
+  }
+  return ok ? 0 : 1;
+}
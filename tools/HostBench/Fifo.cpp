@@ -0,0 +1,129 @@
+/**
+ * @file       Fifo.cpp
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+// Times TinyGsmFifo against ModuloFifo, which wraps its indexes with % N
+// on every step like TinyGsmFifo did before TinyGsmFifoIndex, for byte and
+// 40 byte block transfers.
+
+#include "HostBench.h"
+#include <TinyGsmFifo.h>
+
+template <class T, unsigned N>
+class ModuloFifo
+{
+public:
+  ModuloFifo() : _w(0), _r(0) {}
+
+  int free() {
+    int s = _r - _w;
+    if (s <= 0) s += N;
+    return s - 1;
+  }
+
+  size_t size() {
+    int s = _w - _r;
+    if (s < 0) s += N;
+    return s;
+  }
+
+  bool put(const T& c) {
+    int i = _inc(_w);
+    if (i == _r) return false;
+    _b[_w] = c;
+    _w = i;
+    return true;
+  }
+
+  int put(const T* p, int n) {
+    int c = n;
+    int f;
+    while (c && (f = free()) > 0) {
+      if (c < f) f = c;
+      if (f > (int)N - _w) f = N - _w;
+      memcpy(&_b[_w], p, f * sizeof(T));
+      _w = _inc(_w, f);
+      c -= f;
+      p += f;
+    }
+    return n - c;
+  }
+
+  bool get(T* p) {
+    if (_r == _w) return false;
+    *p = _b[_r];
+    _r = _inc(_r);
+    return true;
+  }
+
+  int get(T* p, int n) {
+    int c = n;
+    int f;
+    while (c && (f = size()) > 0) {
+      if (c < f) f = c;
+      if (f > (int)N - _r) f = N - _r;
+      memcpy(p, &_b[_r], f * sizeof(T));
+      _r = _inc(_r, f);
+      c -= f;
+      p += f;
+    }
+    return n - c;
+  }
+
+private:
+  int _inc(int i, int n = 1) {
+    return (i + n) % N;
+  }
+
+  T   _b[N];
+  int _w;
+  int _r;
+};
+
+static const long ITERATIONS = 2000000;
+
+// Fills with 48 single bytes, then empties byte by byte
+template<class F>
+double bytewise() {
+  static F fifo;
+  volatile unsigned sum = 0;
+  uint8_t c;
+  double cpu = HostCpuSeconds();
+  for (long i = 0; i < ITERATIONS; i++) {
+    for (int k = 0; k < 48; k++) fifo.put((uint8_t)k);
+    while (fifo.get(&c)) sum += c;
+  }
+  return (HostCpuSeconds() - cpu) * 1e9 / (ITERATIONS * 48.0);
+}
+
+// Moves 40 byte blocks in and out
+template<class F>
+double blocks() {
+  static F fifo;
+  uint8_t in[40], out[40];
+  volatile unsigned sum = 0;
+  for (int k = 0; k < 40; k++) in[k] = k;
+  double cpu = HostCpuSeconds();
+  for (long i = 0; i < ITERATIONS; i++) {
+    fifo.put(in, 40);
+    fifo.get(out, 40);
+    sum += out[3];
+  }
+  return (HostCpuSeconds() - cpu) * 1e9 / (ITERATIONS * 40.0);
+}
+
+int main() {
+  printf("N=64   put/get per byte: %% N %5.2f ns/B, TinyGsmFifo %5.2f ns/B\n",
+         bytewise<ModuloFifo<uint8_t, 64> >(), bytewise<TinyGsmFifo<uint8_t, 64> >());
+  printf("N=100  put/get per byte: %% N %5.2f ns/B, TinyGsmFifo %5.2f ns/B\n",
+         bytewise<ModuloFifo<uint8_t, 100> >(), bytewise<TinyGsmFifo<uint8_t, 100> >());
+  printf("N=64   put/get 40 B:     %% N %5.2f ns/B, TinyGsmFifo %5.2f ns/B\n",
+         blocks<ModuloFifo<uint8_t, 64> >(), blocks<TinyGsmFifo<uint8_t, 64> >());
+  printf("N=1024 put/get 40 B:     %% N %5.2f ns/B, TinyGsmFifo %5.2f ns/B\n",
+         blocks<ModuloFifo<uint8_t, 1024> >(), blocks<TinyGsmFifo<uint8_t, 1024> >());
+  return 0;
+}
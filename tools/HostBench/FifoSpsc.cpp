@@ -0,0 +1,94 @@
+/**
+ * @file       FifoSpsc.cpp
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+// Stress test of TinyGsmFifoSpsc: a producer thread puts a counting
+// sequence with put(c), put(p, n) and writeSpan(), a consumer thread takes
+// it with get(c), get(p, n) and readSpan(), and checks every item arrives
+// in order.  Prints the items per second.  Worth running built with
+// -fsanitize=thread too.
+
+#include "HostBench.h"
+#include <TinyGsmFifoSpsc.h>
+#include <thread>
+
+template<unsigned N>
+bool run(const char* name, uint32_t total) {
+  static TinyGsmFifoSpsc<uint32_t, N> fifo;
+  unsigned long start = micros();
+
+  std::thread producer([total] {
+    uint32_t v = 0;
+    uint32_t block[37];
+    while (v < total) {
+      if (!fifo.writeable()) {
+        std::this_thread::yield();
+        continue;
+      }
+      switch (v % 3) {
+      case 0:
+        if (fifo.put(v)) v++;
+        break;
+      case 1: {
+        int n = 0;
+        for (; n < 37 && v + n < total; n++) block[n] = v + n;
+        v += fifo.put(block, n);
+        break;
+      }
+      default: {
+        int n;
+        uint32_t* p = fifo.writeSpan(n);
+        int k = 0;
+        for (; k < n && v < total; k++) p[k] = v++;
+        fifo.commitWrite(k);
+      }
+      }
+    }
+  });
+
+  uint32_t expect = 0;
+  bool bad = false;
+  uint32_t block[53];
+  while (expect < total && !bad) {
+    if (!fifo.readable()) {
+      std::this_thread::yield();
+      continue;
+    }
+    int n;
+    switch (expect % 3) {
+    case 0: {
+      uint32_t c;
+      if (fifo.peek(&c) && fifo.get(&c)) {
+        bad |= (c != expect++);
+      }
+      break;
+    }
+    case 1:
+      n = fifo.get(block, 53);
+      for (int i = 0; i < n; i++) bad |= (block[i] != expect++);
+      break;
+    default: {
+      uint32_t* p = fifo.readSpan(n);
+      for (int i = 0; i < n; i++) bad |= (p[i] != expect++);
+      fifo.consume(n);
+    }
+    }
+  }
+  producer.join();
+
+  double s = (micros() - start) / 1e6;
+  printf("%-7s %u items: %s, %.1f M items/s\n", name, total,
+         bad ? "ORDER ERROR" : "in order", total / s / 1e6);
+  return !bad;
+}
+
+int main() {
+  bool ok = run<64>("N=64", 500000);
+  ok &= run<100>("N=100", 5000000);
+  ok &= run<1024>("N=1024", 5000000);
+  return ok ? 0 : 1;
+}
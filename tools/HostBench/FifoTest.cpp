@@ -0,0 +1,207 @@
+/**
+ * @file       FifoTest.cpp
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+// Checks TinyGsmFifo and TinyGsmFifoSpsc against a std::deque, from one
+// thread (FifoSpsc.cpp runs the SPSC fifo across two): empty and full,
+// wraparound of put/get, peek() and find(), and where writeSpan() and
+// readSpan() end.
+// Power of two and other sizes are both covered, as they wrap differently.
+// Exits with 1 if any check failed.
+
+#include "HostBench.h"
+#include <TinyGsmFifo.h>
+#include <TinyGsmFifoSpsc.h>
+#include <deque>
+
+static int failures = 0;
+
+#define CHECK(x) do { \
+    if (!(x)) { \
+      printf("%s:%d: %s (%s, N=%u)\n", __FILE__, __LINE__, #x, name, (unsigned)N); \
+      failures++; \
+      return; \
+    } \
+  } while (0)
+
+template <class Fifo, class T, unsigned N>
+static void testEmptyAndFull(const char* name) {
+  Fifo f;
+  T c = 0;
+  int n = -1;
+  CHECK(!f.readable());
+  CHECK(f.size() == 0);
+  CHECK(f.free() == (int)N - 1);
+  CHECK(!f.get(&c));
+  CHECK(!f.peek(&c));
+  CHECK(f.find(0) == -1);
+  f.readSpan(n);
+  CHECK(n == 0);
+
+  for (unsigned i = 0; i < N - 1; i++) {
+    CHECK(f.put((T)i));
+  }
+  CHECK(!f.writeable());
+  CHECK(f.free() == 0);
+  CHECK(f.size() == N - 1);
+  CHECK(!f.put((T)0));
+  f.writeSpan(n);
+  CHECK(n == 0);
+  T more[2] = { 1, 2 };
+  CHECK(f.put(more, 2) == 0);
+  CHECK(!f.peek(&c, N - 1));
+  CHECK(f.peek(&c, N - 2) && c == (T)(N - 2));
+
+  for (unsigned i = 0; i < N - 1; i++) {
+    CHECK(f.get(&c) && c == (T)i);
+  }
+  CHECK(!f.readable());
+  CHECK(f.free() == (int)N - 1);
+}
+
+// Random mixes of every put and get flavour, so the indexes pass the end
+// of the buffer at every offset, checked against a deque after each step
+template <class Fifo, class T, unsigned N>
+static void testWraparound(const char* name) {
+  Fifo f;
+  std::deque<T> model;
+  T next = 0;
+  T buf[N];
+  srand(N);
+  for (int step = 0; step < 200000; step++) {
+    int n;
+    switch (rand() % 6) {
+    case 0:
+      if (f.put(next)) model.push_back(next++);
+      else CHECK(model.size() == N - 1);
+      break;
+    case 1: {
+      int want = rand() % N;
+      for (int i = 0; i < want; i++) buf[i] = next + i;
+      int put = f.put(buf, want);
+      CHECK(put == (int)std::min((size_t)want, N - 1 - model.size()));
+      for (int i = 0; i < put; i++) model.push_back(next++);
+      break;
+    }
+    case 2: {
+      T* p = f.writeSpan(n);
+      CHECK(n >= 0 && n <= (int)(N - 1 - model.size()));
+      int use = n ? rand() % (n + 1) : 0;
+      for (int i = 0; i < use; i++) {
+        p[i] = next;
+        model.push_back(next++);
+      }
+      f.commitWrite(use);
+      break;
+    }
+    case 3: {
+      T c;
+      if (f.get(&c)) {
+        CHECK(!model.empty() && c == model.front());
+        model.pop_front();
+      } else {
+        CHECK(model.empty());
+      }
+      break;
+    }
+    case 4: {
+      int want = rand() % N;
+      int got = f.get(buf, want);
+      CHECK(got == (int)std::min((size_t)want, model.size()));
+      for (int i = 0; i < got; i++) {
+        CHECK(buf[i] == model.front());
+        model.pop_front();
+      }
+      break;
+    }
+    case 5: {
+      T* p = f.readSpan(n);
+      CHECK(n >= 0 && n <= (int)model.size());
+      CHECK(model.empty() || n > 0);
+      int use = n ? rand() % (n + 1) : 0;
+      for (int i = 0; i < use; i++) {
+        CHECK(p[i] == model.front());
+        model.pop_front();
+      }
+      f.consume(use);
+      break;
+    }
+    }
+    CHECK(f.size() == model.size());
+    CHECK(f.free() == (int)(N - 1 - model.size()));
+    if (!model.empty()) {
+      T c;
+      int at = rand() % model.size();
+      CHECK(f.peek(&c, at) && c == model[at]);
+      CHECK(f.find(model[at]) == at);
+      CHECK(f.find(next) == -1);
+    }
+  }
+}
+
+// The spans stop at the end of the buffer and one short of the read index
+template <class Fifo, class T, unsigned N>
+static void testSpanBoundaries(const char* name) {
+  for (unsigned start = 0; start < N; start++) {
+    Fifo f;
+    T c;
+    int n;
+    // Move both indexes to start
+    for (unsigned i = 0; i < start; i++) {
+      CHECK(f.put((T)0) && f.get(&c));
+    }
+    f.writeSpan(n);
+    CHECK(n == (int)(start ? N - start : N - 1));
+    f.readSpan(n);
+    CHECK(n == 0);
+
+    // Fill it up through spans, the second one wraps to the front
+    T v = 0;
+    unsigned total = 0;
+    while (f.writeable()) {
+      T* p = f.writeSpan(n);
+      CHECK(n > 0);
+      for (int i = 0; i < n; i++) p[i] = v++;
+      f.commitWrite(n);
+      total += n;
+    }
+    CHECK(total == N - 1);
+
+    // And drain it the same way, in order
+    v = 0;
+    T* p = f.readSpan(n);
+    CHECK(n == (int)std::min(N - start, N - 1u));
+    while (f.readable()) {
+      p = f.readSpan(n);
+      CHECK(n > 0);
+      for (int i = 0; i < n; i++) CHECK(p[i] == v++);
+      f.consume(n);
+    }
+    CHECK(v == (T)(N - 1));
+  }
+}
+
+template <class Fifo, class T, unsigned N>
+static void testAll(const char* name) {
+  testEmptyAndFull<Fifo, T, N>(name);
+  testWraparound<Fifo, T, N>(name);
+  testSpanBoundaries<Fifo, T, N>(name);
+}
+
+int main() {
+  testAll<TinyGsmFifo<uint8_t, 8>, uint8_t, 8>("TinyGsmFifo<uint8_t>");
+  testAll<TinyGsmFifo<uint8_t, 7>, uint8_t, 7>("TinyGsmFifo<uint8_t>");
+  testAll<TinyGsmFifo<uint8_t, 64>, uint8_t, 64>("TinyGsmFifo<uint8_t>");
+  testAll<TinyGsmFifo<uint16_t, 16>, uint16_t, 16>("TinyGsmFifo<uint16_t>");
+  testAll<TinyGsmFifo<uint16_t, 100>, uint16_t, 100>("TinyGsmFifo<uint16_t>");
+  testAll<TinyGsmFifoSpsc<uint8_t, 8>, uint8_t, 8>("TinyGsmFifoSpsc<uint8_t>");
+  testAll<TinyGsmFifoSpsc<uint8_t, 7>, uint8_t, 7>("TinyGsmFifoSpsc<uint8_t>");
+  testAll<TinyGsmFifoSpsc<uint16_t, 16>, uint16_t, 16>("TinyGsmFifoSpsc<uint16_t>");
+  testAll<TinyGsmFifoSpsc<uint32_t, 100>, uint32_t, 100>("TinyGsmFifoSpsc<uint32_t>");
+  printf("%s\n", failures ? "FAILED" : "All fifo tests passed");
+  return failures ? 1 : 0;
+}
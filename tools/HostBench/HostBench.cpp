@@ -0,0 +1,67 @@
+/**
+ * @file       HostBench.cpp
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+// The Arduino core functions the stand-ins declare, and the counting
+// operator new behind HostAllocations
+
+#include "HostBench.h"
+#include <chrono>
+#include <new>
+#include <thread>
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+
+unsigned long HostAllocations = 0;
+
+static const std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+
+unsigned long millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+unsigned long micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+void delay(unsigned long ms) {
+  if (ms) std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void* operator new(size_t size) {
+  HostAllocations++;
+  void* p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) {
+  HostAllocations++;
+  void* p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
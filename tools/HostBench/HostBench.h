@@ -0,0 +1,46 @@
+/**
+ * @file       HostBench.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef HostBench_h
+#define HostBench_h
+
+#include "Arduino.h"
+#include <time.h>
+#include <string>
+
+// Heap allocations made through operator new / new[] since the start
+extern unsigned long HostAllocations;
+
+// CPU time of the process, in seconds
+static inline
+double HostCpuSeconds() {
+  return (double)clock() / CLOCKS_PER_SEC;
+}
+
+// Reads one of the payloads in extras/, i.e. "test_100k.bin".  The folder
+// can be moved with the HOST_BENCH_EXTRAS environment variable.
+static inline
+bool HostLoadExtra(const char* name, std::string& out) {
+  const char* dir = getenv("HOST_BENCH_EXTRAS");
+  std::string path = std::string(dir ? dir : "extras") + "/" + name;
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f) {
+    fprintf(stderr, "Can't open %s\n", path.c_str());
+    return false;
+  }
+  out.clear();
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    out.append(buf, n);
+  }
+  fclose(f);
+  return true;
+}
+
+#endif
@@ -0,0 +1,37 @@
+/**
+ * @file       IPAddress.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef HostBench_IPAddress_h
+#define HostBench_IPAddress_h
+
+#include "Arduino.h"
+
+class IPAddress : public Printable
+{
+public:
+  IPAddress() {
+    memset(_address, 0, sizeof(_address));
+  }
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+    _address[0] = a;
+    _address[1] = b;
+    _address[2] = c;
+    _address[3] = d;
+  }
+
+  uint8_t operator[](int i) const { return _address[i]; }
+  uint8_t& operator[](int i) { return _address[i]; }
+  bool operator==(const IPAddress& o) const { return !memcmp(_address, o._address, 4); }
+  bool operator!=(const IPAddress& o) const { return !(*this == o); }
+  uint8_t* raw_address() { return _address; }
+
+private:
+  uint8_t _address[4];
+};
+
+#endif
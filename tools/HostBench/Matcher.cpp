@@ -0,0 +1,112 @@
+/**
+ * @file       Matcher.cpp
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+// Feeds a SIM800 AT transcript, byte by byte, to TinyGsmMatcher and to the
+// String + endsWith() scan waitResponse() used before it, both looking for
+// OK, ERROR and the same 3 URC prefixes.  Prints MB/s and allocations.
+// Then times a pattern that overlaps itself, which makes a matcher that
+// rescans the pattern on a mismatch do work in proportion to its length.
+
+#include "HostBench.h"
+#include <TinyGsmCommon.h>
+
+static const char transcript[] =
+  "AT+CIPRXGET=4,0\r\r\n+CIPRXGET: 4,0,512\r\n\r\nOK\r\n"
+  "AT+CIPSTATUS=0\r\r\n+CIPSTATUS: 0,,\"TCP\",\"93.184.216.34\",\"80\",\"CONNECTED\"\r\n\r\nOK\r\n"
+  "AT+CSQ\r\r\n+CSQ: 21,0\r\n\r\nOK\r\n"
+  "AT+CREG?\r\r\n+CREG: 0,1\r\n\r\nOK\r\n";
+
+// What a SIM800 waitResponse() looks for, as the driver spells it
+static const char* responses[5] = { "OK\r\n", "ERROR\r\n", NULL, NULL, NULL };
+static const char* urcs[3] = { "\r\n+CIPRXGET:", "\r\n+RECEIVE:", "CLOSED\r\n" };
+
+static const long ITERATIONS = 200000;
+
+// A pattern that is nearly all one character, and input made of it
+static const char overlapping[] = "aaaaaaaaaaaaaaaaaaab";
+static const long OVERLAP_BYTES = 20000000;
+
+// The step TinyGsmMatcher took before it had failure tables: the longest k
+// such that p[0..k-1) is a suffix of p[0..s) and p[k-1] == c
+static uint8_t rescanNext(const char* p, uint8_t s, char c) {
+  if (p[s] == c) return s + 1;
+  for (uint8_t k = s; k > 0; k--) {
+    if (p[k - 1] != c) continue;
+    uint8_t j = 0;
+    while (j < k - 1 && p[j] == p[s - k + 1 + j]) j++;
+    if (j == k - 1) return k;
+  }
+  return 0;
+}
+
+static void report(const char* name, double cpu, unsigned long allocs, unsigned hits) {
+  double bytes = (double)(sizeof(transcript) - 1) * ITERATIONS;
+  printf("%-18s %7.1f MB/s %6.2f ns/B %9lu allocs (%u matches)\n",
+         name, bytes / cpu / 1e6, cpu * 1e9 / bytes, allocs, hits);
+}
+
+int main() {
+  unsigned hits = 0;
+
+  unsigned long allocs = HostAllocations;
+  double cpu = HostCpuSeconds();
+  for (long it = 0; it < ITERATIONS; it++) {
+    String data;
+    data.reserve(64);
+    for (const char* p = transcript; *p; p++) {
+      data += *p;
+      int index = 0;
+      for (int k = 0; k < 5 && !index; k++) {
+        if (responses[k] && data.endsWith(responses[k])) index = k + 1;
+      }
+      for (int k = 0; k < 3 && !index; k++) {
+        if (data.endsWith(urcs[k])) index = 6 + k;
+      }
+      if (index) {
+        hits++;
+        data = "";
+      }
+    }
+  }
+  report("String + endsWith", HostCpuSeconds() - cpu, HostAllocations - allocs, hits);
+
+  hits = 0;
+  allocs = HostAllocations;
+  cpu = HostCpuSeconds();
+  for (long it = 0; it < ITERATIONS; it++) {
+    TinyGsmMatcher<8> match;
+    for (int k = 0; k < 5; k++) match.add(responses[k]);
+    for (int k = 0; k < 3; k++) match.add(urcs[k]);
+    for (const char* p = transcript; *p; p++) {
+      if (match.feed(*p)) {
+        hits++;
+        match.reset();
+      }
+    }
+  }
+  report("TinyGsmMatcher", HostCpuSeconds() - cpu, HostAllocations - allocs, hits);
+
+  volatile uint8_t state = 0;
+  cpu = HostCpuSeconds();
+  for (long i = 0; i < OVERLAP_BYTES; i++) {
+    state = rescanNext(overlapping, state, 'a');
+  }
+  double rescan = HostCpuSeconds() - cpu;
+
+  TinyGsmMatcher<1> match;
+  match.add(overlapping);
+  hits = 0;
+  cpu = HostCpuSeconds();
+  for (long i = 0; i < OVERLAP_BYTES; i++) {
+    hits += match.feed('a');
+  }
+  double table = HostCpuSeconds() - cpu;
+  printf("Overlapping pattern: rescan %.2f ns/B, failure table %.2f ns/B (%u matches)\n",
+         rescan * 1e9 / OVERLAP_BYTES, table * 1e9 / OVERLAP_BYTES, hits);
+  return 0;
+}
@@ -0,0 +1,340 @@
+/**
+ * @file       ReplayModem.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef ReplayModem_h
+#define ReplayModem_h
+
+#include "Arduino.h"
+#include <string>
+
+// A Stream that plays the modem's side of one TCP download, the way the
+// modem picked with TINY_GSM_MODEM_* would: it answers the commands that
+// open, poll and read the socket with the modem's own responses and URC's,
+// and hands out the payload through the driver's read protocol.
+//
+//   +CIPRXGET   SIM800, SIM808, SIM868, SIM900, SIM7000, SIM5360, SIM7600
+//   +QIRD       BG96
+//   +USORD      UBLOX, SARAR4
+//   +IPD        ESP8266 (pushed, see allowPush())
+//
+// Any other command gets an OK.  Once the payload is out the socket
+// reports being closed.  Nothing is allocated after load(), so the heap
+// use measured around a download is the library's.
+
+#if defined(TINY_GSM_MODEM_SIM800) || defined(TINY_GSM_MODEM_SIM808) || \
+    defined(TINY_GSM_MODEM_SIM868) || defined(TINY_GSM_MODEM_SIM900) || \
+    defined(TINY_GSM_MODEM_SIM7000)
+  #define REPLAY_CIPRXGET
+  #define REPLAY_CIPSTART
+#elif defined(TINY_GSM_MODEM_SIM5360) || defined(TINY_GSM_MODEM_SIM7600)
+  #define REPLAY_CIPRXGET
+  #define REPLAY_CIPOPEN
+#elif defined(TINY_GSM_MODEM_BG96)
+  #define REPLAY_QIRD
+#elif defined(TINY_GSM_MODEM_UBLOX) || defined(TINY_GSM_MODEM_SARAR4)
+  #define REPLAY_USORD
+#elif defined(TINY_GSM_MODEM_ESP8266)
+  #define REPLAY_IPD
+#else
+  #error "No download transcript for this modem"
+#endif
+
+class ReplayModem : public Stream
+{
+public:
+  ReplayModem()
+    : _head(0), _pos(0), _push(0), _mux(0), _open(false)
+  {
+    _out.reserve(8192);
+    _line.reserve(256);
+    clearCounts();
+  }
+
+  // The data the next connection downloads
+  void load(const std::string& payload) {
+    _data = payload;
+    _pos  = 0;
+  }
+
+  // Bytes of the payload not handed to the driver yet
+  size_t left() const {
+    return _data.size() - _pos;
+  }
+
+  // What of that is in the modem's receive buffer, so can be read and is
+  // reported as available: the rest is still on its way
+  size_t buffered() const {
+    return TinyMin(left(), 8192);
+  }
+
+  // Modems that push their data send up to len more bytes, in +IPD's, as
+  // the driver reads the stream.  A real one wouldn't wait for room in the
+  // client's fifo, but the benchmark measures parsing, not what gets lost.
+  void allowPush(size_t len) {
+    _push = len;
+  }
+
+  void clearCounts() {
+    commands   = 0;
+    writeCalls = 0;
+    txBytes    = 0;
+    rxBytes    = 0;
+  }
+
+  unsigned long commands;    // AT commands the driver sent
+  unsigned long writeCalls;  // write() calls they took
+  unsigned long txBytes;     // bytes the driver sent
+  unsigned long rxBytes;     // bytes the driver read
+
+  virtual int available() {
+#if defined(REPLAY_IPD)
+    if (_head == _out.size() && _push && _open && left()) {
+      sendIpd();
+    }
+#endif
+    return _out.size() - _head;
+  }
+
+  virtual int read() {
+    if (_head == _out.size()) return -1;
+    rxBytes++;
+    return (uint8_t)_out[_head++];
+  }
+
+  virtual int peek() {
+    if (_head == _out.size()) return -1;
+    return (uint8_t)_out[_head];
+  }
+
+  virtual size_t readBytes(char* buf, size_t size) {
+    size_t n = TinyMin(size, _out.size() - _head);
+    memcpy(buf, _out.data() + _head, n);
+    _head   += n;
+    rxBytes += n;
+    return n;
+  }
+
+  virtual size_t write(uint8_t c) {
+    writeCalls++;
+    put(c);
+    return 1;
+  }
+
+  virtual size_t write(const uint8_t* buf, size_t size) {
+    writeCalls++;
+    for (size_t i = 0; i < size; i++) {
+      put(buf[i]);
+    }
+    return size;
+  }
+
+  using Print::write;
+
+private:
+  static size_t TinyMin(size_t a, size_t b) {
+    return a < b ? a : b;
+  }
+
+  void put(uint8_t c) {
+    txBytes++;
+    if (c == '\r' || c == '\n') {
+      if (_line.size() > 2 && _line[0] == 'A' && _line[1] == 'T') {
+        commands++;
+        command(_line.c_str() + 2);
+      }
+      _line.clear();
+    } else {
+      _line += (char)c;
+    }
+  }
+
+  void reply(const char* s) {
+    if (_head == _out.size()) {
+      _out.clear();
+      _head = 0;
+    }
+    _out.append(s);
+  }
+
+  void replyf(const char* format, int a, int b = 0, int c = 0, int d = 0) {
+    char buf[80];
+    snprintf(buf, sizeof(buf), format, a, b, c, d);
+    reply(buf);
+  }
+
+  void replyData(size_t len) {
+    _out.append(_data, _pos, len);
+    _pos += len;
+  }
+
+  bool connected() const {
+    return _open && left();
+  }
+
+  // One command line, after the "AT"
+  void command(const char* cmd) {
+    int a, b, c;
+#if defined(REPLAY_CIPSTART)
+    if (sscanf(cmd, "+CIPSTART=%d", &a) == 1) {
+      _mux  = a;
+      _open = true;
+      replyf("\r\nOK\r\n\r\n%d, CONNECT OK\r\n\r\n+CIPRXGET: 1,%d\r\n", a, a);
+      return;
+    }
+    if (sscanf(cmd, "+CIPSTATUS=%d", &a) == 1) {
+      replyf(connected() ? "\r\n+CIPSTATUS: %d,0,\"TCP\",\"1.2.3.4\",\"80\",\"CONNECTED\"\r\n\r\nOK\r\n"
+                         : "\r\n+CIPSTATUS: %d,0,\"TCP\",\"1.2.3.4\",\"80\",\"CLOSED\"\r\n\r\nOK\r\n", a);
+      return;
+    }
+    if (!strcmp(cmd, "+CIPSTATUS")) {
+      reply("\r\nOK\r\n\r\nSTATE: IP PROCESSING\r\n\r\n");
+      replyf(connected() ? "C: %d,0,\"TCP\",\"1.2.3.4\",\"80\",\"CONNECTED\"\r\n"
+                         : "C: %d,0,\"TCP\",\"1.2.3.4\",\"80\",\"CLOSED\"\r\n", _mux);
+      return;
+    }
+#endif
+#if defined(REPLAY_CIPOPEN)
+    if (sscanf(cmd, "+CIPOPEN=%d", &a) == 1) {
+      _mux  = a;
+      _open = true;
+      replyf("\r\nOK\r\n\r\n+CIPOPEN: %d,0\r\n\r\n+CIPRXGET: 1,%d\r\n", a, a);
+      return;
+    }
+    if (!strcmp(cmd, "+CIPCLOSE?")) {
+      reply("\r\n+CIPCLOSE: ");
+      for (int i = 0; i < 10; i++) {
+        reply(i ? "," : "");
+        reply(i == _mux && connected() ? "1" : "0");
+      }
+      reply("\r\n\r\nOK\r\n");
+      return;
+    }
+#endif
+#if defined(REPLAY_CIPRXGET)
+    if (sscanf(cmd, "+CIPRXGET=4,%d", &a) == 1) {
+      replyf("\r\n+CIPRXGET: 4,%d,%d\r\n\r\nOK\r\n", a, (int)buffered());
+      return;
+    }
+    if (sscanf(cmd, "+CIPRXGET=%d,%d,%d", &a, &b, &c) == 3 && (a == 2 || a == 3)) {
+      size_t n = TinyMin(c, buffered());
+      replyf("\r\n+CIPRXGET: %d,%d,%d,%d\r\n", a, b, (int)n, (int)TinyMin(left() - n, 8192));
+      if (a == 3) {
+        char hex[3];
+        for (size_t i = 0; i < n; i++) {
+          snprintf(hex, sizeof(hex), "%02X", (uint8_t)_data[_pos++]);
+          reply(hex);
+        }
+      } else {
+        replyData(n);
+      }
+      reply("\r\nOK\r\n");
+      return;
+    }
+#endif
+#if defined(REPLAY_QIRD)
+    if (sscanf(cmd, "+QIOPEN=1,%d", &a) == 1) {
+      _mux  = a;
+      _open = true;
+      replyf("\r\nOK\r\n\r\n+QIOPEN: %d,0\r\n\r\n+QIURC: \"recv\",%d\r\n", a, a);
+      return;
+    }
+    if (sscanf(cmd, "+QIRD=%d,%d", &a, &b) == 2) {
+      if (b == 0) {
+        replyf("\r\n+QIRD: %d,%d,%d\r\n\r\nOK\r\n",
+               (int)(_pos + buffered()), (int)_pos, (int)buffered());
+        return;
+      }
+      size_t n = TinyMin(b, buffered());
+      replyf("\r\n+QIRD: %d\r\n", (int)n);
+      replyData(n);
+      reply("\r\n\r\nOK\r\n");
+      return;
+    }
+    if (sscanf(cmd, "+QISTATE=1,%d", &a) == 1 || !strcmp(cmd, "+QISTATE=0,1")) {
+      replyf("\r\n+QISTATE: %d,\"TCP\",\"1.2.3.4\",80,5087,%d,1,%d,0,\"uart1\"\r\n\r\nOK\r\n",
+             _mux, connected() ? 2 : 4, _mux);
+      return;
+    }
+#endif
+#if defined(REPLAY_USORD)
+    if (!strcmp(cmd, "+USOCR=6")) {
+      replyf("\r\n+USOCR: %d\r\n\r\nOK\r\n", _mux);
+      return;
+    }
+    if (sscanf(cmd, "+USOCO=%d,\"%*[^\"]\",%d,%d", &a, &b, &c) == 3) {
+      _open = true;
+      replyf("\r\nOK\r\n\r\n+UUSOCO: %d,0\r\n\r\n+UUSORD: %d,%d\r\n", a, a, (int)buffered());
+      return;
+    }
+    if (sscanf(cmd, "+USOCO=%d", &a) == 1) {
+      _open = true;
+      replyf("\r\nOK\r\n\r\n+UUSORD: %d,%d\r\n", a, (int)buffered());
+      return;
+    }
+    if (sscanf(cmd, "+USORD=%d,%d", &a, &b) == 2) {
+      if (b == 0) {
+        replyf("\r\n+USORD: %d,%d\r\n\r\nOK\r\n", a, (int)buffered());
+        return;
+      }
+      size_t n = TinyMin(b, buffered());
+      replyf("\r\n+USORD: %d,%d,\"", a, (int)n);
+      replyData(n);
+      reply("\"\r\n\r\nOK\r\n");
+      return;
+    }
+    if (sscanf(cmd, "+USOCTL=%d,10", &a) == 1) {
+      replyf("\r\n+USOCTL: %d,10,%d\r\n\r\nOK\r\n", a, connected() ? 4 : 0);
+      return;
+    }
+#endif
+#if defined(REPLAY_IPD)
+    if (sscanf(cmd, "+CIPSTART=%d", &a) == 1) {
+      _mux  = a;
+      _open = true;
+      replyf("\r\n%d,CONNECT\r\n\r\nOK\r\n", a);
+      return;
+    }
+    if (!strcmp(cmd, "+CIPSTATUS")) {
+      if (connected()) {
+        replyf("\r\nSTATUS:3\r\n+CIPSTATUS:%d,\"TCP\",\"1.2.3.4\",80,5087,0\r\n\r\nOK\r\n", _mux);
+      } else {
+        reply("\r\nSTATUS:4\r\n\r\nOK\r\n");
+      }
+      return;
+    }
+#endif
+    (void)a;
+    (void)b;
+    (void)c;
+    reply("\r\nOK\r\n");
+  }
+
+#if defined(REPLAY_IPD)
+  // The ESP8266 sends at most a TCP segment per +IPD
+  void sendIpd() {
+    size_t n = TinyMin(TinyMin(_push, left()), 1460);
+    _push -= n;
+    replyf("\r\n+IPD,%d,%d:", _mux, (int)n);
+    replyData(n);
+    if (!left()) {
+      replyf("\r\n%d,CLOSED\r\n", _mux);
+    }
+  }
+#endif
+
+  std::string _out;   // what the driver is yet to read, from _head on
+  size_t      _head;
+  std::string _line;  // the command line coming in
+  std::string _data;  // the payload, handed out from _pos on
+  size_t      _pos;
+  size_t      _push;
+  int         _mux;
+  bool        _open;
+};
+
+#endif
@@ -0,0 +1,84 @@
+/**
+ * @file       SendAt.cpp
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+// Counts the stream write() calls and times the formatting of a few AT
+// commands, sent with sendAT() and, for comparison, printed one argument at
+// a time with streamPrint() the way sendAT() used to.
+
+#define TINY_GSM_MODEM_SIM800
+
+#include "HostBench.h"
+#include <TinyGsmClient.h>
+
+// Copies what's written into a ring, like a UART driver into its transmit
+// buffer, and counts the calls
+class CountingStream : public Stream
+{
+public:
+  CountingStream() : writeCalls(0), _pos(0) {}
+
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+  virtual size_t write(uint8_t c) {
+    return write(&c, 1);
+  }
+  virtual size_t write(const uint8_t* buf, size_t size) {
+    writeCalls++;
+    for (size_t i = 0; i < size; i++) {
+      _ring[_pos++ & (sizeof(_ring) - 1)] = buf[i];
+    }
+    return size;
+  }
+  using Print::write;
+
+  unsigned long writeCalls;
+
+private:
+  volatile uint8_t _ring[256];
+  size_t           _pos;
+};
+
+static const long ITERATIONS = 20000;
+
+template<typename... Args>
+static void measure(CountingStream& out, TinyGsm& modem, const char* name,
+                    Args... args) {
+  out.writeCalls = 0;
+  double cpu = HostCpuSeconds();
+  for (long i = 0; i < ITERATIONS; i++) {
+    modem.streamPrint(out, "AT", args..., GSM_NL);
+    out.flush();
+  }
+  double before = (HostCpuSeconds() - cpu) * 1e9 / ITERATIONS;
+  double before_calls = out.writeCalls / (double)ITERATIONS;
+
+  out.writeCalls = 0;
+  cpu = HostCpuSeconds();
+  for (long i = 0; i < ITERATIONS; i++) {
+    modem.sendAT(args...);
+  }
+  double after = (HostCpuSeconds() - cpu) * 1e9 / ITERATIONS;
+  double after_calls = out.writeCalls / (double)ITERATIONS;
+
+  printf("%-36s per argument %4.1f writes %6.0f ns | sendAT() %4.1f writes %6.0f ns\n",
+         name, before_calls, before, after_calls, after);
+}
+
+int main() {
+  CountingStream out;
+  TinyGsm modem(out);
+
+  measure(out, modem, "+CIPRXGET=2,<mux>,<len>",
+          GF("+CIPRXGET=2,"), 1, ',', (uint16_t)1460);
+  measure(out, modem, "+CSTT with a 41 char APN",
+          GF("+CSTT=\""), "a.very.long.access.point.name.example.com",
+          GF("\",\""), "username", GF("\",\""), "password", GF("\""));
+  measure(out, modem, "+CSQ", GF("+CSQ"));
+  return 0;
+}